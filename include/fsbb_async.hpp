@@ -0,0 +1,461 @@
+#pragma once
+
+#include "fsbb_single.hpp"
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+/*
+    Asynchronous enter/exit functions of single-state machines (requires C++20 coroutines).
+
+    An on_enter which starts streaming assets, or an on_exit which waits for a fade-out, can be a
+    coroutine returning async_task: it runs synchronously until it suspends, e.g. on an async_executor
+    or on an awaitable of a streaming system, and the machine continues it later. Meanwhile the
+    asynchronous manipulator tracks the phase of the transition (exiting the old state, then entering
+    the new one), and update() only checks whether the current phase has finished, so it never blocks.
+
+    change_state() queues a transition and returns async_transition, which can be polled or co_await-ed
+    by other coroutines. Like queue_change_state() of the queued manipulator, only the last requested
+    state is kept while a transition is in progress; transitions which were replaced complete together
+    with the one which replaced them.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+/*
+    Resumes coroutines in the thread which calls run(), e.g. once per frame in the main thread.
+    Coroutines can be posted from any thread, e.g. by a completion callback of a streaming system.
+*/
+class async_executor
+{
+public:
+    void post( std::coroutine_handle<> handle )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_handles.push_back( handle );
+    }
+
+      // Resumes coroutines posted before the call, returns their number. Coroutines posted by resumed
+      // ones wait for the next call.
+    size_t run()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_running.swap( m_handles );
+        }
+
+        const size_t count = m_running.size();
+        for ( size_t i = 0; i < count; ++i )
+            m_running[i].resume();
+
+        m_running.clear();
+
+        return count;
+    }
+
+    size_t get_pending_count() const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_handles.size();
+    }
+
+      // co_await executor.schedule() suspends the coroutine until the next run()
+    struct schedule_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( std::coroutine_handle<> handle ) { m_executor.post( handle ); }
+        void await_resume() const noexcept {}
+
+        async_executor& m_executor;
+    };
+
+    schedule_awaiter schedule() { return schedule_awaiter{ *this }; }
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::coroutine_handle<> > m_handles;
+
+      // Used only by run(), keeps its memory between calls
+    std::vector<std::coroutine_handle<> > m_running;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Coroutine type of asynchronous enter/exit functions. Starts immediately, and keeps its frame
+    after finishing until the machine sees it. A default-constructed task is finished.
+*/
+class async_task
+{
+public:
+    struct promise_type
+    {
+        async_task get_return_object() { return async_task( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { m_exception = std::current_exception(); }
+
+        std::exception_ptr m_exception;
+    };
+
+    async_task() {}
+    async_task( async_task&& other ) noexcept : m_handle( std::exchange( other.m_handle, std::coroutine_handle<promise_type>() ) ) {}
+    ~async_task() { destroy(); }
+
+    async_task& operator=( async_task&& other ) noexcept
+    {
+        if ( this != &other )
+        {
+            destroy();
+            m_handle = std::exchange( other.m_handle, std::coroutine_handle<promise_type>() );
+        }
+
+        return *this;
+    }
+
+    bool is_done() const { return !m_handle || m_handle.done(); }
+
+      // Exception thrown by the finished coroutine, if any
+    std::exception_ptr get_exception() const { return m_handle ? m_handle.promise().m_exception : std::exception_ptr(); }
+
+private:
+    explicit async_task( std::coroutine_handle<promise_type> handle ) : m_handle( handle ) {}
+
+    void destroy()
+    {
+        if ( m_handle )
+            m_handle.destroy();
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+//----------------------------------------------------------------
+
+enum async_phase
+{
+    async_idle,
+    async_exiting,      // on_exit of the current state is running
+    async_entering      // on_enter of the new (already current) state is running
+};
+
+//----------------------------------------------------------------
+// Enter/Exit policies
+//----------------------------------------------------------------
+
+/*
+    Calls on_enter/on_exit functions of the state, like enter_exit_policy_notify. Functions may return
+    async_task to run asynchronously, or void to finish immediately.
+
+    A suspended function outlives the update() which started it, so it should take a value context
+    by value, and a reference context must outlive the transition.
+*/
+struct enter_exit_policy_async
+{
+    template<typename t_state_id, typename t_state, typename t_context>
+    static async_task on_enter( state_and_id<t_state_id, t_state>& state, context_holder<t_context>& ctx ) { return to_task( [&] { return state.state->on_enter( ctx.m_context ); } ); }
+
+    template<typename t_state_id, typename t_state>
+    static async_task on_enter( state_and_id<t_state_id, t_state>& state, context_holder<void>& ctx ) { return to_task( [&] { return state.state->on_enter(); } ); }
+
+    template<typename t_state_id, typename t_state, typename t_context>
+    static async_task on_exit( state_and_id<t_state_id, t_state>& state, context_holder<t_context>& ctx ) { return to_task( [&] { return state.state->on_exit( ctx.m_context ); } ); }
+
+    template<typename t_state_id, typename t_state>
+    static async_task on_exit( state_and_id<t_state_id, t_state>& state, context_holder<void>& ctx ) { return to_task( [&] { return state.state->on_exit(); } ); }
+
+private:
+    template<typename t_call>
+    static async_task to_task( t_call call )
+    {
+        if constexpr ( std::is_same<decltype( call() ), async_task>::value )
+            return call();
+        else
+        {
+            call();
+            return async_task();
+        }
+    }
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_single_async_impl
+{
+    typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_single_async_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : m_state_container_impl( state_container_impl )
+        , m_state_registry( state_registry )
+        , m_phase( async_idle )
+        , m_entering_state( 0 )
+        , m_next_state( 0 )
+        , m_requested_count( 0 )
+        , m_started_count( 0 )
+        , m_completed_count( 0 )
+        , m_executor( 0 )
+    {}
+
+    t_state_container_impl& m_state_container_impl;
+    t_state_registry& m_state_registry;
+
+    async_phase m_phase;
+    async_task m_task;
+
+      // State which is entered after the current one is exited
+    state_and_id<t_state_id, t_state>* m_entering_state;
+
+      // State requested while a transition is in progress
+    state_and_id<t_state_id, t_state>* m_next_state;
+
+      // Transitions are numbered from 1 in order of requests. A started transition completes all
+      // requests up to m_started_count.
+    size_t m_requested_count;
+    size_t m_started_count;
+    size_t m_completed_count;
+
+      // Ranges [first; last] of numbers of failed transitions, adjacent ranges are merged
+    std::vector<std::pair<size_t, size_t> > m_failed_transitions;
+
+      // Coroutines which co_await transitions, and numbers of these transitions
+    std::vector<std::pair<size_t, std::coroutine_handle<> > > m_waiters;
+    std::vector<std::coroutine_handle<> > m_resumed;
+
+      // Resumes waiters when set, otherwise they are resumed by update()
+    async_executor* m_executor;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Result of change_state(). Completes when the requested state (or a state requested after it)
+    was entered, or when the transition failed because an enter/exit function threw. co_await returns
+    false if the state was not registered, or the transition failed. The machine must outlive the
+    transition.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class async_transition
+{
+public:
+    typedef state_manipulator_single_async_impl<t_state_id, t_state, t_state_registry> t_impl;
+
+    async_transition( t_impl* impl, size_t number ) : m_impl( impl ), m_number( number ) {}
+
+    bool is_valid() const { return m_impl != 0; }
+    bool is_done() const { return m_impl == 0 || m_impl->m_completed_count >= m_number; }
+
+    bool is_failed() const
+    {
+        if ( m_impl == 0 || m_impl->m_completed_count < m_number )
+            return false;
+
+        for ( size_t i = m_impl->m_failed_transitions.size(); i-- > 0; )
+        {
+            if ( m_impl->m_failed_transitions[i].first <= m_number )
+                return m_number <= m_impl->m_failed_transitions[i].second;
+        }
+
+        return false;
+    }
+
+    bool await_ready() const { return is_done(); }
+    void await_suspend( std::coroutine_handle<> handle ) { m_impl->m_waiters.push_back( std::make_pair( m_number, handle ) ); }
+    bool await_resume() const { return is_valid() && !is_failed(); }
+
+private:
+    t_impl* m_impl;
+    size_t m_number;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_async,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_single_async_interface
+{
+public:
+    typedef state_manipulator_single_async_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef async_transition<t_state_id, t_state, t_state_registry> t_transition;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_single_async_interface( t_impl& impl ) : m_impl( impl ) {}
+
+      // Queues the transition, which is started by the next update(). Returns an invalid (and done)
+      // transition if the state is not registered.
+    t_transition change_state( t_state_id id )
+    {
+        state_and_id<t_state_id, t_state>* new_state = m_impl.m_state_registry.find_state( id );
+        if ( new_state == 0 )
+            return t_transition( 0, 0 );
+
+        m_impl.m_next_state = new_state;
+
+        return t_transition( &m_impl, ++m_impl.m_requested_count );
+    }
+
+      // Advances the transition as far as it can go without waiting, and starts the queued one.
+      // Rethrows an exception of a failed enter/exit function, leaving the machine idle: a failed
+      // exit keeps the current state, and a failed enter keeps the new one, which is already current.
+    void update( context_holder<t_context> ctx )
+    {
+        state_and_id<t_state_id, t_state>*& current_state = m_impl.m_state_container_impl.m_current_state;
+
+        for ( ;; )
+        {
+            if ( m_impl.m_phase != async_idle )
+            {
+                if ( !m_impl.m_task.is_done() )
+                    return;
+
+                const std::exception_ptr exception = m_impl.m_task.get_exception();
+                if ( exception )
+                {
+                    fail_transition();
+                    std::rethrow_exception( exception );
+                }
+
+                if ( m_impl.m_phase == async_exiting )
+                {
+                    current_state = m_impl.m_entering_state;
+                    m_impl.m_entering_state = 0;
+                    m_impl.m_phase = async_idle;
+                    start_call( async_entering, 0, [&] { return t_on_enter_exit_policy::on_enter( *current_state, ctx ); } );
+                }
+                else
+                {
+                    m_impl.m_phase = async_idle;
+                    m_impl.m_task = async_task();
+                    complete_transition( true );
+                }
+            }
+            else
+            {
+                if ( m_impl.m_next_state == 0 )
+                    return;
+
+                m_impl.m_started_count = m_impl.m_requested_count;
+
+                state_and_id<t_state_id, t_state>* next_state = m_impl.m_next_state;
+                m_impl.m_next_state = 0;
+
+                if ( current_state != 0 )
+                    start_call( async_exiting, next_state, [&] { return t_on_enter_exit_policy::on_exit( *current_state, ctx ); } );
+                else
+                {
+                    current_state = next_state;
+                    start_call( async_entering, 0, [&] { return t_on_enter_exit_policy::on_enter( *current_state, ctx ); } );
+                }
+            }
+        }
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+    async_phase get_async_phase() const { return m_impl.m_phase; }
+    bool is_transition_in_progress() const { return m_impl.m_phase != async_idle || m_impl.m_next_state != 0; }
+
+      // State which is entered after the current one is exited, if the machine is exiting
+    t_state_id get_entering_state_id() const { return m_impl.m_entering_state ? m_impl.m_entering_state->id : t_state_id(); }
+
+      // Coroutines which co_await transitions are resumed by the executor instead of update()
+    void set_async_executor( async_executor* executor ) { m_impl.m_executor = executor; }
+
+protected:
+      // Calls an enter/exit function, and enters the phase once it returns (finished or suspended).
+      // If the function throws synchronously, the transition fails as if its coroutine threw.
+    template<typename t_call>
+    void start_call( async_phase phase, state_and_id<t_state_id, t_state>* entering_state, t_call call )
+    {
+        async_task task;
+        try
+        {
+            task = call();
+        }
+        catch ( ... )
+        {
+            fail_transition();
+            throw;
+        }
+
+        m_impl.m_task = std::move( task );
+        m_impl.m_phase = phase;
+        m_impl.m_entering_state = entering_state;
+    }
+
+    void fail_transition()
+    {
+        m_impl.m_phase = async_idle;
+        m_impl.m_task = async_task();
+        m_impl.m_entering_state = 0;
+        complete_transition( false );
+    }
+
+      // Resumes coroutines which wait for started transitions, in order of their co_await. Without an
+      // executor they are resumed right here, so they must not call update().
+    void complete_transition( bool succeeded )
+    {
+        if ( !succeeded )
+        {
+            const size_t first = m_impl.m_completed_count + 1;
+            if ( !m_impl.m_failed_transitions.empty() && m_impl.m_failed_transitions.back().second + 1 == first )
+                m_impl.m_failed_transitions.back().second = m_impl.m_started_count;
+            else
+                m_impl.m_failed_transitions.push_back( std::make_pair( first, m_impl.m_started_count ) );
+        }
+
+        m_impl.m_completed_count = m_impl.m_started_count;
+
+        size_t waiting = 0;
+        for ( size_t i = 0; i < m_impl.m_waiters.size(); ++i )
+        {
+            if ( m_impl.m_waiters[i].first <= m_impl.m_completed_count )
+                m_impl.m_resumed.push_back( m_impl.m_waiters[i].second );
+            else
+                m_impl.m_waiters[waiting++] = m_impl.m_waiters[i];
+        }
+        m_impl.m_waiters.resize( waiting );
+
+        for ( size_t i = 0; i < m_impl.m_resumed.size(); ++i )
+        {
+            if ( m_impl.m_executor )
+                m_impl.m_executor->post( m_impl.m_resumed[i] );
+            else
+                m_impl.m_resumed[i].resume();
+        }
+
+        m_impl.m_resumed.clear();
+    }
+
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+}
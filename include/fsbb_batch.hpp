@@ -0,0 +1,245 @@
+#pragma once
+
+#include "fsbb_world.hpp"
+#include <stdint.h>
+
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && defined( __x86_64__ )
+#define FSBB_BATCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+/*
+    Dense transition table for dispatching events to many instances of a machine world at once.
+
+    Rules "in state S, event E leads to state T" are compiled into a table of target state indices,
+    indexed by (state index, event index). fsm_single_world::queue_dispatch() reads targets for a whole
+    batch of instances from the table, and queues changes of state only for instances that have a
+    transition, so the following update() calls exit/enter functions only for them.
+
+    Unlike the transition-table manipulator, rules have no guards, so a batch never calls user code.
+    On x86-64 with GCC or Clang, targets are read with AVX2 gathers if the CPU supports them, and
+    with a scalar loop otherwise.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+template
+<
+    typename t_event_id,
+    typename t_event_lookup_policy = registry_lookup_linear
+>
+class batch_transition_table
+{
+public:
+    typedef t_event_id event_id;
+
+    batch_transition_table()
+        : m_states_count( 0 )
+        , m_dirty( false )
+        , m_vectorized( is_avx2_supported() )
+    {}
+
+      // Adds a rule: when "event" is dispatched to an instance in state "source", it changes state to
+      // "target". Only the first rule for the same state and event is used. Both states must be already
+      // registered in the registry of the world, otherwise returns false.
+    template<typename t_state_registry, typename t_state_id>
+    bool add_transition( const t_state_registry& registry, const t_state_id& source, const t_event_id& event, const t_state_id& target )
+    {
+        const size_t source_index = registry.find_state_index( source );
+        const size_t target_index = registry.find_state_index( target );
+        if ( source_index == invalid_state_index || target_index == invalid_state_index )
+            return false;
+
+        size_t event_index = m_events_index.find( event, m_events );
+        if ( event_index == invalid_state_index )
+        {
+            if ( !m_events_index.insert( event, m_events.size() ) )
+                return false;
+
+            event_and_id e;
+            e.id = event;
+            m_events.push_back( e );
+            event_index = m_events.size() - 1;
+        }
+
+        rule r;
+        r.source = source_index;
+        r.event = event_index;
+        r.target = target_index;
+        m_rules.push_back( r );
+
+        m_dirty = true;
+
+        return true;
+    }
+
+    size_t find_event_index( const t_event_id& event ) const { return m_events_index.find( event, m_events ); }
+
+    size_t get_events_count() const { return m_events.size(); }
+    size_t get_transitions_count() const { return m_rules.size(); }
+
+      // Vectorized reads are used only if the CPU supports them
+    void set_vectorized( bool vectorized ) { m_vectorized = vectorized && is_avx2_supported(); }
+    bool is_vectorized() const { return m_vectorized; }
+
+    static bool is_avx2_supported()
+    {
+#if defined( FSBB_BATCH_AVX2 )
+        static const bool supported = __builtin_cpu_supports( "avx2" );
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+      // Rebuilds the table after rules, events or states were added
+    void prepare( size_t states_count )
+    {
+        if ( !m_dirty && m_states_count == states_count )
+            return;
+
+          // An extra column for unknown events, which has no transitions
+        const size_t stride = m_events.size() + 1;
+        m_table.assign( states_count * stride, -1 );
+
+          // Walking rules backwards lets the first rule for a pair overwrite the rest
+        for ( size_t i = m_rules.size(); i-- > 0; )
+            m_table[m_rules[i].source * stride + m_rules[i].event] = (int32_t)m_rules[i].target;
+
+        m_states_count = states_count;
+        m_dirty = false;
+    }
+
+      // Maps events to indices for find_targets(), unknown events to the column without transitions
+    const uint32_t* find_event_indices( const t_event_id* events, size_t count )
+    {
+        m_event_indices.resize( count );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const size_t index = i > 0 && events[i] == events[i - 1] ? m_event_indices[i - 1] : find_event_index( events[i] );
+            m_event_indices[i] = (uint32_t)( index != invalid_state_index ? index : m_events.size() );
+        }
+
+        return m_event_indices.empty() ? 0 : &m_event_indices[0];
+    }
+
+      // For every i < count, finds the target of the instance instances[i] (or i, if instances is 0)
+      // in state states[instance] for the event events[i] (or event_index, if events is 0), and calls
+      // callback( instance, target ) if there is one. Returns the number of found targets.
+      // States of instances are registry indices, or invalid_state_index for instances without a state.
+    template<typename t_callback>
+    size_t find_targets( const size_t* states, const size_t* instances, size_t count, const uint32_t* events, size_t event_index, t_callback callback ) const
+    {
+#if defined( FSBB_BATCH_AVX2 )
+        if ( m_vectorized )
+            return find_targets_avx2( states, instances, count, events, event_index, callback );
+#endif
+        return find_targets_scalar( states, instances, count, events, event_index, callback, 0 );
+    }
+
+protected:
+    struct event_and_id
+    {
+        t_event_id id;
+    };
+
+    struct rule
+    {
+        size_t source;
+        size_t event;
+        size_t target;
+    };
+
+    template<typename t_callback>
+    size_t find_targets_scalar( const size_t* states, const size_t* instances, size_t count, const uint32_t* events, size_t event_index, t_callback& callback, size_t first ) const
+    {
+        const size_t stride = m_events.size() + 1;
+
+        size_t found = 0;
+        for ( size_t i = first; i < count; ++i )
+        {
+            const size_t instance = instances ? instances[i] : i;
+            const size_t state = states[instance];
+            if ( state >= m_states_count )
+                continue;
+
+            const int32_t target = m_table[state * stride + ( events ? events[i] : event_index )];
+            if ( target >= 0 )
+            {
+                callback( instance, (size_t)target );
+                ++found;
+            }
+        }
+
+        return found;
+    }
+
+#if defined( FSBB_BATCH_AVX2 )
+      // Four instances at a time: states are 64-bit, so a gather reads four targets
+    template<typename t_callback>
+    __attribute__(( target( "avx2" ) ))
+    size_t find_targets_avx2( const size_t* states, const size_t* instances, size_t count, const uint32_t* events, size_t event_index, t_callback& callback ) const
+    {
+        if ( m_table.empty() )
+            return 0;
+
+        const int* table = &m_table[0];
+        const __m256i stride = _mm256_set1_epi64x( (long long)( m_events.size() + 1 ) );
+        const __m256i states_count = _mm256_set1_epi64x( (long long)m_states_count );
+        const __m256i no_state = _mm256_set1_epi64x( -1 );
+        const __m256i same_event = _mm256_set1_epi64x( (long long)event_index );
+        const __m256i even_lanes = _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 );
+        const __m128i no_target = _mm_set1_epi32( -1 );
+
+        size_t found = 0;
+        size_t i = 0;
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            const __m256i state = instances
+                ? _mm256_i64gather_epi64( (const long long*)states, _mm256_loadu_si256( (const __m256i*)( instances + i ) ), 8 )
+                : _mm256_loadu_si256( (const __m256i*)( states + i ) );
+            const __m256i event = events ? _mm256_cvtepu32_epi64( _mm_loadu_si128( (const __m128i*)( events + i ) ) ) : same_event;
+
+              // Instances without a state, or in states registered after the table was built, are skipped.
+              // Valid state indices fit 32 bits, so a 32-bit multiply is enough.
+            const __m256i valid = _mm256_and_si256( _mm256_cmpgt_epi64( state, no_state ), _mm256_cmpgt_epi64( states_count, state ) );
+            const __m128i mask = _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( valid, even_lanes ) );
+            const __m256i index = _mm256_add_epi64( _mm256_mul_epu32( state, stride ), event );
+
+            const __m128i targets = _mm256_mask_i64gather_epi32( no_target, table, index, mask, 4 );
+            int lanes = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( targets, no_target ) ) );
+            if ( lanes == 0 )
+                continue;
+
+            int32_t values[4];
+            _mm_storeu_si128( (__m128i*)values, targets );
+            for ( ; lanes != 0; lanes &= lanes - 1 )
+            {
+                const int lane = __builtin_ctz( lanes );
+                callback( instances ? instances[i + lane] : i + lane, (size_t)values[lane] );
+                ++found;
+            }
+        }
+
+        return found + find_targets_scalar( states, instances, count, events, event_index, callback, i );
+    }
+#endif
+
+    std::vector<event_and_id> m_events;
+    typename t_event_lookup_policy::template index<t_event_id> m_events_index;
+
+    std::vector<rule> m_rules;
+
+      // m_table[state * ( events count + 1 ) + event] is the target state index, or -1
+    std::vector<int32_t> m_table;
+    size_t m_states_count;
+    bool m_dirty;
+    bool m_vectorized;
+
+    std::vector<uint32_t> m_event_indices;
+};
+
+//----------------------------------------------------------------
+}
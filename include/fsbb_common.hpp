@@ -1,6 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <new>
 
 namespace fsbb
 {
@@ -19,21 +26,539 @@ struct state_and_id
 
 //----------------------------------------------------------------
 
+const size_t invalid_state_index = static_cast<size_t>( -1 );
+
+//----------------------------------------------------------------
+// Registry lookup policies
+//----------------------------------------------------------------
+
+/*
+    Scans all registered states. Cheapest to build and best for a handful of states.
+*/
+struct registry_lookup_linear
+{
+    template<typename t_state_id>
+    class index
+    {
+    public:
+        void clear() {}
+        void reserve( size_t count ) {}
+        bool insert( const t_state_id& id, size_t slot ) { return true; }
+
+        template<typename t_states>
+        size_t find( const t_state_id& id, const t_states& states ) const
+        {
+            for ( size_t i = 0; i < states.size(); ++i )
+            {
+                if ( states[i].id == id )
+                    return i;
+            }
+
+            return invalid_state_index;
+        }
+    };
+};
+
+//----------------------------------------------------------------
+
+/*
+    Open-addressing hash table with linear probing. Works for any id that t_hash can hash.
+    The table stores hashes and registry slots only, ids are compared against the registry itself.
+*/
+template<template<typename> class t_hash = std::hash>
+struct registry_lookup_hashed
+{
+    template<typename t_state_id>
+    class index
+    {
+    public:
+        index() : m_count( 0 ) {}
+
+        void clear()
+        {
+            m_entries.clear();
+            m_count = 0;
+        }
+
+        void reserve( size_t count )
+        {
+            if ( count * 2 > m_entries.size() )
+                rehash( count * 2 );
+        }
+
+        bool insert( const t_state_id& id, size_t slot )
+        {
+            reserve( m_count + 1 );
+
+            entry e;
+            e.hash = t_hash<t_state_id>()( id );
+            e.slot = slot;
+            place( e );
+            ++m_count;
+
+            return true;
+        }
+
+        template<typename t_states>
+        size_t find( const t_state_id& id, const t_states& states ) const
+        {
+            if ( m_entries.empty() )
+                return invalid_state_index;
+
+            const size_t hash = t_hash<t_state_id>()( id );
+            const size_t mask = m_entries.size() - 1;
+            for ( size_t i = hash & mask; m_entries[i].slot != invalid_state_index; i = ( i + 1 ) & mask )
+            {
+                if ( m_entries[i].hash == hash && states[m_entries[i].slot].id == id )
+                    return m_entries[i].slot;
+            }
+
+            return invalid_state_index;
+        }
+
+    private:
+        struct entry
+        {
+            entry() : hash( 0 ), slot( invalid_state_index ) {}
+
+            size_t hash;
+            size_t slot;
+        };
+
+        void place( const entry& e )
+        {
+            const size_t mask = m_entries.size() - 1;
+            size_t i = e.hash & mask;
+            while ( m_entries[i].slot != invalid_state_index )
+                i = ( i + 1 ) & mask;
+
+            m_entries[i] = e;
+        }
+
+        void rehash( size_t min_size )
+        {
+            size_t size = 8;
+            while ( size < min_size )
+                size *= 2;
+
+            std::vector<entry> old_entries( size );
+            old_entries.swap( m_entries );
+
+            for ( size_t i = 0; i < old_entries.size(); ++i )
+            {
+                if ( old_entries[i].slot != invalid_state_index )
+                    place( old_entries[i] );
+            }
+        }
+
+        std::vector<entry> m_entries;
+        size_t m_count;
+    };
+};
+
+//----------------------------------------------------------------
+
+/*
+    Uses the id itself as an index into a table. Meant for dense non-negative integer or enum ids:
+    the table is as large as the biggest registered id, so sparse ids waste memory.
+*/
+struct registry_lookup_direct
+{
+    template<typename t_state_id>
+    class index
+    {
+    public:
+        void clear() { m_slots.clear(); }
+        void reserve( size_t count ) { m_slots.reserve( count ); }
+
+        bool insert( const t_state_id& id, size_t slot )
+        {
+            if ( static_cast<long long>( id ) < 0 )
+                return false;
+
+            const size_t key = static_cast<size_t>( id );
+            if ( key >= m_slots.size() )
+                m_slots.resize( key + 1, invalid_state_index );
+
+            m_slots[key] = slot;
+
+            return true;
+        }
+
+        template<typename t_states>
+        size_t find( const t_state_id& id, const t_states& states ) const
+        {
+            const size_t key = static_cast<size_t>( id );
+            return key < m_slots.size() ? m_slots[key] : invalid_state_index;
+        }
+
+    private:
+        std::vector<size_t> m_slots;
+    };
+};
+
+//----------------------------------------------------------------
+
+/*
+    Keeps ids in a sorted array and uses binary search. Requires operator< for ids.
+    Cheaper in memory than hashed lookup, and does not require ids to be dense.
+*/
+struct registry_lookup_sorted
+{
+    template<typename t_state_id>
+    class index
+    {
+    public:
+        void clear() { m_keys.clear(); }
+        void reserve( size_t count ) { m_keys.reserve( count ); }
+
+        bool insert( const t_state_id& id, size_t slot )
+        {
+            m_keys.insert( std::lower_bound( m_keys.begin(), m_keys.end(), id, key_less() ), key( id, slot ) );
+            return true;
+        }
+
+        template<typename t_states>
+        size_t find( const t_state_id& id, const t_states& states ) const
+        {
+            typename std::vector<key>::const_iterator iter = std::lower_bound( m_keys.begin(), m_keys.end(), id, key_less() );
+            if ( iter == m_keys.end() || id < iter->first )
+                return invalid_state_index;
+
+            return iter->second;
+        }
+
+    private:
+        typedef std::pair<t_state_id, size_t> key;
+
+        struct key_less
+        {
+            bool operator()( const key& k, const t_state_id& id ) const { return k.first < id; }
+        };
+
+        std::vector<key> m_keys;
+    };
+};
+
+//----------------------------------------------------------------
+
+//----------------------------------------------------------------
+// Registry storage policies
+//----------------------------------------------------------------
+
+/*
+    Stores states in a single std::vector. Registering a state may reallocate the vector, which
+    invalidates pointers to states held by containers and manipulators. Register all states
+    before using the machine, or use registry_storage_chunked.
+*/
+struct registry_storage_vector
+{
+    template<typename t_value>
+    class storage : public std::vector<t_value>
+    {
+    public:
+        size_t index_of( const t_value* value ) const { return value - &( *this )[0]; }
+    };
+};
+
+//----------------------------------------------------------------
+
+/*
+    Stores states in blocks which are never moved or freed until the registry is destroyed,
+    so pointers to states stay valid when new states are registered.
+    Block k holds t_block_size * 2^k states, so the block and the offset of a state are computed
+    from its index with a bit scan, and the number of blocks stays small. reserve() allocates all
+    blocks needed for the requested states with a single allocation.
+*/
+template<size_t t_block_size = 64>
+struct registry_storage_chunked
+{
+    template<typename t_value>
+    class storage
+    {
+    public:
+        storage() : m_size( 0 ), m_blocks_count( 0 ), m_owned_blocks( 0 ) {}
+        storage( const storage& other ) : m_size( 0 ), m_blocks_count( 0 ), m_owned_blocks( 0 ) { append( other ); }
+        ~storage() { clear(); }
+
+        storage& operator=( const storage& other )
+        {
+            if ( this != &other )
+            {
+                clear();
+                append( other );
+            }
+
+            return *this;
+        }
+
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        t_value& operator[]( size_t index )
+        {
+            const size_t b = block_of( index );
+            return m_blocks[b][index - first_of( b )];
+        }
+
+        const t_value& operator[]( size_t index ) const
+        {
+            const size_t b = block_of( index );
+            return m_blocks[b][index - first_of( b )];
+        }
+
+        void reserve( size_t count )
+        {
+            if ( count > first_of( m_blocks_count ) )
+                add_blocks( block_of( count - 1 ) + 1 );
+        }
+
+        void push_back( const t_value& value )
+        {
+            if ( m_size == first_of( m_blocks_count ) )
+                add_blocks( m_blocks_count + 1 );
+
+            new ( &( *this )[m_size] ) t_value( value );
+            ++m_size;
+        }
+
+          // Checks the blocks from the last one, which holds about half of the states
+        size_t index_of( const t_value* value ) const
+        {
+            for ( size_t b = m_blocks_count; b-- > 0; )
+            {
+                if ( value >= m_blocks[b] && value < m_blocks[b] + ( t_block_size << b ) )
+                {
+                    const size_t index = first_of( b ) + ( value - m_blocks[b] );
+                    return index < m_size ? index : invalid_state_index;
+                }
+            }
+
+            return invalid_state_index;
+        }
+
+        void clear()
+        {
+            for ( size_t i = 0; i < m_size; ++i )
+                ( *this )[i].~t_value();
+
+            for ( size_t b = 0; b < m_blocks_count; ++b )
+            {
+                if ( m_owned_blocks & ( size_t( 1 ) << b ) )
+                    ::operator delete( m_blocks[b] );
+            }
+
+            m_size = 0;
+            m_blocks_count = 0;
+            m_owned_blocks = 0;
+        }
+
+    private:
+          // Enough for 2^32 - 1 states even with blocks of one state
+        static const size_t max_blocks = 32;
+
+        static size_t first_of( size_t block ) { return t_block_size * ( ( size_t( 1 ) << block ) - 1 ); }
+
+        static size_t block_of( size_t index )
+        {
+            const size_t blocks = index / t_block_size + 1;
+#if defined( __GNUC__ ) || defined( __clang__ )
+            return sizeof( unsigned long long ) * 8 - 1 - __builtin_clzll( blocks );
+#else
+            size_t b = 0;
+            while ( blocks >> ( b + 1 ) )
+                ++b;
+
+            return b;
+#endif
+        }
+
+          // Allocates blocks up to "count" as one piece of memory, which is freed with its first block
+        void add_blocks( size_t count )
+        {
+            const size_t first = first_of( m_blocks_count );
+            t_value* data = static_cast<t_value*>( ::operator new( ( first_of( count ) - first ) * sizeof( t_value ) ) );
+
+            m_owned_blocks |= size_t( 1 ) << m_blocks_count;
+            for ( ; m_blocks_count < count; ++m_blocks_count )
+                m_blocks[m_blocks_count] = data + ( first_of( m_blocks_count ) - first );
+        }
+
+        void append( const storage& other )
+        {
+            reserve( size() + other.size() );
+            for ( size_t i = 0; i < other.size(); ++i )
+                push_back( other[i] );
+        }
+
+        t_value* m_blocks[max_blocks];
+        size_t m_size;
+        size_t m_blocks_count;
+
+          // Bit b is set if block b starts an allocation
+        size_t m_owned_blocks;
+    };
+};
+
+//----------------------------------------------------------------
+
+/*
+    A vector with fixed capacity, which stores its elements inline. Provides the subset of std::vector
+    interface used by FSBB. Elements should be default-constructible: all t_capacity elements
+    exist all the time, and only the first size() of them are in use.
+*/
+template<typename T, size_t t_capacity>
+class fixed_vector
+{
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    fixed_vector() : m_size( 0 ) {}
+
+    iterator begin() { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+    reverse_iterator rbegin() { return reverse_iterator( end() ); }
+    reverse_iterator rend() { return reverse_iterator( begin() ); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator( end() ); }
+    const_reverse_iterator rend() const { return const_reverse_iterator( begin() ); }
+
+    size_t size() const { return m_size; }
+    size_t max_size() const { return t_capacity; }
+    size_t capacity() const { return t_capacity; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[]( size_t index ) { return m_data[index]; }
+    const T& operator[]( size_t index ) const { return m_data[index]; }
+    T& back() { return m_data[m_size - 1]; }
+    const T& back() const { return m_data[m_size - 1]; }
+
+    void reserve( size_t count ) {}
+
+      // Calling push_back or insert on a full vector is an error
+    void push_back( const T& value ) { m_data[m_size++] = value; }
+    void pop_back() { --m_size; }
+
+    iterator insert( iterator position, const T& value )
+    {
+        std::copy_backward( position, end(), end() + 1 );
+        *position = value;
+        ++m_size;
+        return position;
+    }
+
+    iterator erase( iterator position ) { return erase( position, position + 1 ); }
+
+    iterator erase( iterator first, iterator last )
+    {
+        std::copy( last, end(), first );
+        m_size -= last - first;
+        return first;
+    }
+
+    void clear() { m_size = 0; }
+
+private:
+    T m_data[t_capacity];
+    size_t m_size;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Temporary vector for operations that need a copy of a machine's data, e.g. of the stack, without
+    keeping it in every machine. Vectors with dynamic memory are taken from a pool of the calling thread,
+    and returned to it by the destructor, so they keep their memory, and nested operations get distinct
+    vectors. Fixed vectors are stored inline, on the call stack, so they never allocate.
+*/
+template<typename t_vector>
+class scratch_vector
+{
+public:
+    scratch_vector() : m_vector( acquire() ) {}
+    ~scratch_vector() { release( m_vector ); }
+
+    t_vector& get() { return *m_vector; }
+
+private:
+    scratch_vector( const scratch_vector& );
+    scratch_vector& operator=( const scratch_vector& );
+
+    struct pool
+    {
+        ~pool()
+        {
+            for ( size_t i = 0; i < m_free.size(); ++i )
+                delete m_free[i];
+        }
+
+        std::vector<t_vector*> m_free;
+    };
+
+    static pool& get_pool()
+    {
+        static thread_local pool instance;
+        return instance;
+    }
+
+    static t_vector* acquire()
+    {
+        pool& p = get_pool();
+        if ( p.m_free.empty() )
+            return new t_vector();
+
+        t_vector* vector = p.m_free.back();
+        p.m_free.pop_back();
+        return vector;
+    }
+
+    static void release( t_vector* vector )
+    {
+        vector->clear();
+        get_pool().m_free.push_back( vector );
+    }
+
+    t_vector* m_vector;
+};
+
+template<typename T, size_t t_capacity>
+class scratch_vector<fixed_vector<T, t_capacity> >
+{
+public:
+    fixed_vector<T, t_capacity>& get() { return m_vector; }
+
+private:
+    fixed_vector<T, t_capacity> m_vector;
+};
+
+//----------------------------------------------------------------
+
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_lookup_policy = registry_lookup_linear,
+    typename t_storage_policy = registry_storage_vector
 >
 class state_registry
 {
 public:
-    typedef std::vector<state_and_id<t_state_id, t_state> > states_vector;
+    typedef typename t_storage_policy::template storage<state_and_id<t_state_id, t_state> > states_vector;
+    typedef typename t_lookup_policy::template index<t_state_id> lookup_index;
 
     bool register_state( t_state_id id, t_state state )
     {
         if ( find_state( id ) != 0 )
             return false;
 
+        if ( !m_index.insert( id, m_states.size() ) )
+            return false;
+
         state_and_id<t_state_id, t_state> s;
         s.id = id;
         s.state = state;
@@ -42,34 +567,159 @@ public:
         return true;
     }
 
-    state_and_id<t_state_id, t_state>* find_state( t_state_id id )
+      // Registers all states in range [first; last), which should contain objects with "id" and "state" fields,
+      // like state_and_id. Returns the number of states actually registered.
+    template<typename t_iterator>
+    size_t register_states( t_iterator first, t_iterator last )
     {
-        for ( size_t i = 0; i < m_states.size(); ++i )
+        reserve( m_states.size() + std::distance( first, last ) );
+
+        size_t registered = 0;
+        for ( ; first != last; ++first )
         {
-            if ( m_states[i].id == id )
-                return &m_states[i];
+            if ( register_state( first->id, first->state ) )
+                ++registered;
         }
 
-        return 0;
+        return registered;
     }
 
+    void reserve( size_t count )
+    {
+        m_states.reserve( count );
+        m_index.reserve( count );
+    }
+
+    state_and_id<t_state_id, t_state>* find_state( t_state_id id )
+    {
+        const size_t index = find_state_index( id );
+        return index != invalid_state_index ? &m_states[index] : 0;
+    }
+
+    size_t find_state_index( const t_state_id& id ) const { return m_index.find( id, m_states ); }
+
+    size_t get_state_index( const state_and_id<t_state_id, t_state>* state ) const { return m_states.index_of( state ); }
+    state_and_id<t_state_id, t_state>& get_state( size_t index ) { return m_states[index]; }
+    size_t get_states_count() const { return m_states.size(); }
+
     states_vector & get_states() { return m_states; }
 
 protected:
     states_vector m_states;
+    lookup_index m_index;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Refers to a registry shared by many machines, which is frozen for them: register_state() of a
+    machine fails. A machine holds a single pointer instead of its own copy of all states, so it is
+    constructed without registering anything, and attached to the shared registry in constant time.
+    An unattached machine has no states.
+
+    The shared registry is owned by the caller (e.g. it is static, or allocated in the same arena as
+    the machines), and must outlive the machines. With registry_storage_vector, all states should be
+    registered into it before machines use it, since registering reallocates states.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_registry_shared
+{
+public:
+    typedef t_state_registry shared_registry;
+
+    state_registry_shared() : m_registry( 0 ) {}
+
+    void attach( t_state_registry& registry ) { m_registry = &registry; }
+    t_state_registry* get_shared_registry() const { return m_registry; }
+
+    bool register_state( t_state_id id, t_state state ) { return false; }
+
+    template<typename t_iterator>
+    size_t register_states( t_iterator first, t_iterator last ) { return 0; }
+
+    void reserve( size_t count ) {}
+
+    state_and_id<t_state_id, t_state>* find_state( t_state_id id ) { return m_registry ? m_registry->find_state( id ) : 0; }
+    size_t find_state_index( const t_state_id& id ) const { return m_registry ? m_registry->find_state_index( id ) : invalid_state_index; }
+
+    size_t get_state_index( const state_and_id<t_state_id, t_state>* state ) const { return m_registry->get_state_index( state ); }
+    state_and_id<t_state_id, t_state>& get_state( size_t index ) { return m_registry->get_state( index ); }
+    size_t get_states_count() const { return m_registry ? m_registry->get_states_count() : 0; }
+
+private:
+    t_state_registry* m_registry;
 };
 
 //----------------------------------------------------------------
 
+/*
+    Context given to a manipulator method, which is passed on to enter/exit policies and further calls.
+
+    A value context is not copied if it can be bound as a non-const reference: the holder refers to a
+    non-const argument (or a temporary) of the call, which lives until the call returns, so passing the
+    holder around costs a pointer regardless of the size of the context. Enter/exit functions may take
+    it by non-const reference, and then modify the caller's object. A const argument is copied once
+    per call, into a temporary of the caller, and functions modify the copy.
+*/
+template<typename T>
+struct context_copy
+{
+    context_copy() : m_value( 0 ) {}
+    ~context_copy()
+    {
+        if ( m_value )
+            m_value->~T();
+    }
+
+    T& assign( const T& t )
+    {
+        m_value = new ( m_storage ) T( t );
+        return *m_value;
+    }
+
+private:
+    context_copy( const context_copy& );
+    context_copy& operator=( const context_copy& );
+
+    alignas( T ) unsigned char m_storage[sizeof( T )];
+    T* m_value;
+};
+
 template<typename T>
 struct context_holder
 {
-    context_holder( T t )
+    context_holder( T& t )
+        : m_context(t)
+    {
+    }
+
+    context_holder( T&& t )
+        : m_context(t)
+    {
+    }
+
+    context_holder( const T& t, context_copy<T>&& copy = context_copy<T>() )
+        : m_context( copy.assign( t ) )
+    {
+    }
+
+    T& m_context;
+};
+
+template<typename T>
+struct context_holder<T&>
+{
+    context_holder( T& t )
         : m_context(t)
     {
     }
 
-    T m_context;
+    T& m_context;
 };
 
 template<>
@@ -90,7 +740,7 @@ template
     typename t_state_manipulator_interface
 >
 class fsm : 
-    public state_registry<t_state_id, t_state>,
+    public t_state_manipulator_interface::t_registry,
     public t_state_container_interface,
     public t_state_manipulator_interface
 {
@@ -101,6 +751,23 @@ public:
         , m_state_manipulator( m_state_container, *this )
     {}
 
+      // Binary snapshots of current and queued states, see fsbb_snapshot.hpp
+    template<typename t_snapshot_writer>
+    void save_snapshot( t_snapshot_writer& writer ) const
+    {
+        const typename t_state_manipulator_interface::t_registry& registry = *this;
+        snapshot_save( writer, registry, m_state_container );
+        snapshot_save( writer, registry, m_state_manipulator );
+    }
+
+      // Does not call enter/exit functions
+    template<typename t_snapshot_reader>
+    bool restore_snapshot( t_snapshot_reader& reader )
+    {
+        typename t_state_manipulator_interface::t_registry& registry = *this;
+        return snapshot_restore( reader, registry, m_state_container ) && snapshot_restore( reader, registry, m_state_manipulator );
+    }
+
 protected:
     typename t_state_container_interface::t_impl m_state_container;
     typename t_state_manipulator_interface::t_impl m_state_manipulator;
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "fsbb_stacked.hpp"
+#include <atomic>
+
+/*
+    Building blocks for machines which receive queued actions from several threads.
+
+    The owning thread is the only one allowed to call update() and immediate functions, but any
+    thread can call queue_* functions. Queued actions are stored in a fixed-size lock-free ring
+    buffer, so queueing never allocates memory (as long as copying a state id does not allocate).
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+/*
+    Bounded multiple-producer single-consumer queue. Each cell has a sequence number which tells
+    producers and the consumer whether the cell is free or filled for a given position in the queue.
+    t_capacity must be a power of two.
+*/
+template<typename T, size_t t_capacity>
+class mpsc_ring_buffer
+{
+public:
+    mpsc_ring_buffer() : m_enqueue_pos( 0 ), m_dequeue_pos( 0 )
+    {
+        static_assert( t_capacity != 0 && ( t_capacity & ( t_capacity - 1 ) ) == 0, "Capacity must be a power of two" );
+
+        for ( size_t i = 0; i < t_capacity; ++i )
+            m_cells[i].sequence.store( i, std::memory_order_relaxed );
+    }
+
+      // Can be called from any thread. Returns false if the queue is full.
+    bool try_push( const T& value )
+    {
+        cell* c;
+        size_t pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        for ( ;; )
+        {
+            c = &m_cells[pos & ( t_capacity - 1 )];
+            const size_t sequence = c->sequence.load( std::memory_order_acquire );
+            const ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+
+            if ( diff == 0 )
+            {
+                if ( m_enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if ( diff < 0 )
+                return false;
+            else
+                pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        }
+
+        c->value = value;
+        c->sequence.store( pos + 1, std::memory_order_release );
+
+        return true;
+    }
+
+      // Can be called only from the consumer thread. Returns false if the queue is empty.
+    bool try_pop( T& value )
+    {
+        cell& c = m_cells[m_dequeue_pos & ( t_capacity - 1 )];
+        const size_t sequence = c.sequence.load( std::memory_order_acquire );
+        if ( (ptrdiff_t)sequence - (ptrdiff_t)( m_dequeue_pos + 1 ) < 0 )
+            return false;
+
+        value = c.value;
+        c.sequence.store( m_dequeue_pos + t_capacity, std::memory_order_release );
+        ++m_dequeue_pos;
+
+        return true;
+    }
+
+    static size_t capacity() { return t_capacity; }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    mpsc_ring_buffer( const mpsc_ring_buffer& );
+    mpsc_ring_buffer& operator=( const mpsc_ring_buffer& );
+
+    cell m_cells[t_capacity];
+    alignas( 64 ) std::atomic<size_t> m_enqueue_pos;
+    alignas( 64 ) size_t m_dequeue_pos;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_stacked_concurrent_impl_base
+{
+    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_stacked_concurrent_impl_base
+        (
+            state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry>& immediate_impl,
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : m_immediate_impl( immediate_impl )
+        , m_state_container_impl( state_container_impl )
+        , m_state_registry( state_registry )
+    {}
+
+    state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry>& m_immediate_impl;
+    t_state_container_impl& m_state_container_impl;
+    t_state_registry& m_state_registry;
+
+    typedef typename state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_state_registry>::queued_action queued_action;
+    mpsc_ring_buffer<queued_action, t_capacity> m_queued_actions;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_stacked_concurrent_interface_base
+{
+public:
+    typedef state_manipulator_stacked_concurrent_impl_base<t_state_id, t_state, t_capacity, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_stacked_concurrent_interface_base(
+        state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>& immediate_interface,
+        t_impl& impl
+    )
+        : m_immediate_interface( immediate_interface )
+        , m_impl( impl )
+    {}
+
+      // All queue_* functions are thread-safe, and return false if the queue is full
+
+    bool queue_push_state( t_state_id id )
+    {
+        return m_impl.m_queued_actions.try_push( typename t_impl::queued_action( t_impl::queued_action::push, id ) );
+    }
+
+    bool queue_pop_state()
+    {
+        return m_impl.m_queued_actions.try_push( typename t_impl::queued_action( t_impl::queued_action::pop, t_state_id() ) );
+    }
+
+    bool queue_remove_state( t_state_id id )
+    {
+        return m_impl.m_queued_actions.try_push( typename t_impl::queued_action( t_impl::queued_action::remove, id ) );
+    }
+
+    bool queue_remove_state_and_all_above( t_state_id id )
+    {
+        return m_impl.m_queued_actions.try_push( typename t_impl::queued_action( t_impl::queued_action::remove_and_above, id ) );
+    }
+
+    bool queue_remove_all_states()
+    {
+        return m_impl.m_queued_actions.try_push( typename t_impl::queued_action( t_impl::queued_action::remove_all, t_state_id() ) );
+    }
+
+      // Must be called only from the owning thread. Actions queued while update is running
+      // may be executed either by this update or by the next one.
+    void update(context_holder<t_context> ctx)
+    {
+        typename t_impl::queued_action action;
+        for ( size_t i = 0; i < t_capacity && m_impl.m_queued_actions.try_pop( action ); ++i )
+            apply_queued_action( m_immediate_interface, action, ctx );
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+protected:
+    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>& m_immediate_interface;
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_stacked_concurrent_impl : public state_manipulator_stacked_concurrent_impl_base<t_state_id, t_state, t_capacity, t_state_registry>
+{
+    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_stacked_concurrent_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_stacked_concurrent_impl_base<t_state_id, t_state, t_capacity, t_state_registry>( m_immediate_impl, state_container_impl, state_registry )
+        , m_immediate_impl( state_container_impl, state_registry )
+    {}
+
+    state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry> m_immediate_impl;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_stacked_concurrent_interface : public state_manipulator_stacked_concurrent_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_capacity, t_state_registry>
+{
+public:
+    typedef state_manipulator_stacked_concurrent_impl<t_state_id, t_state, t_capacity, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_stacked_concurrent_interface( t_impl& impl )
+        : state_manipulator_stacked_concurrent_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_capacity, t_state_registry>( m_immediate_interface, impl )
+        , m_immediate_interface( impl.m_immediate_impl )
+    {}
+
+protected:
+    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry> m_immediate_interface;
+};
+
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_stacked_concurrent_combined_impl :
+    public state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry>,
+    public state_manipulator_stacked_concurrent_impl<t_state_id, t_state, t_capacity, t_state_registry>
+{
+    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_stacked_concurrent_combined_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+        , state_manipulator_stacked_concurrent_impl<t_state_id, t_state, t_capacity, t_state_registry>( state_container_impl, state_registry )
+    {}
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_stacked_concurrent_combined_interface :
+    public state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>,
+    public state_manipulator_stacked_concurrent_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_capacity, t_state_registry>
+{
+public:
+    typedef state_manipulator_stacked_concurrent_combined_impl<t_state_id, t_state, t_capacity, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_stacked_concurrent_combined_interface( t_impl& impl )
+        : state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
+        , state_manipulator_stacked_concurrent_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_capacity, t_state_registry>( impl )
+    {}
+};
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,556 @@
+#pragma once
+
+#include "fsbb_single.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+    Precompiled state graphs: states, events, transitions and names of a machine compiled into a flat
+    binary blob, which is used directly as a read-only registry.
+
+    A blob is built once, by state_graph_builder or by the fsbb_graph_compiler tool, and saved to a file.
+    At startup, state_graph_file maps the file into memory, and state_registry_graph uses it in place:
+    nothing is parsed, registered or allocated, and processes which map the same file share its pages.
+
+    A blob contains only offsets from its start, so it can be mapped at any address. State IDs, event
+    IDs and state values are 32-bit unsigned integers; a state value usually is an index into a table
+    of behaviours of the application. Blobs use the byte order of the machine which built them, and
+    are rejected by machines with another byte order.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+typedef std::uint32_t graph_id;
+typedef state_and_id<graph_id, graph_id> graph_state;
+
+static const graph_id invalid_graph_index = 0xFFFFFFFF;
+
+struct graph_key
+{
+    graph_id id;
+    graph_id slot;
+};
+
+  // All offsets are in bytes from the start of the blob, and are multiples of 4
+struct state_graph_header
+{
+    char magic[4];
+    std::uint32_t byte_order;
+    std::uint32_t version;
+    std::uint32_t size;
+
+    std::uint32_t states_count;
+    std::uint32_t events_count;
+
+    std::uint32_t states_offset;        // graph_state[states_count], in order of addition
+    std::uint32_t state_keys_offset;    // graph_key[states_count], sorted by id
+    std::uint32_t events_offset;        // graph_id[events_count], in order of addition
+    std::uint32_t event_keys_offset;    // graph_key[events_count], sorted by id
+    std::uint32_t transitions_offset;   // graph_id[states_count * events_count], target state index or invalid_graph_index
+    std::uint32_t state_names_offset;   // std::uint32_t[states_count], offsets of names in strings
+    std::uint32_t event_names_offset;   // std::uint32_t[events_count], offsets of names in strings
+    std::uint32_t strings_offset;       // zero-terminated strings
+    std::uint32_t strings_size;
+};
+
+static const std::uint32_t state_graph_byte_order = 0x01020304;
+static const std::uint32_t state_graph_version = 1;
+
+//----------------------------------------------------------------
+
+/*
+    Read-only view of a blob. attach() checks the header and that all sections are inside the blob,
+    and every lookup checks the indices it reads, so a corrupted blob can not make it read outside.
+*/
+class state_graph
+{
+public:
+    state_graph() { detach(); }
+
+    bool attach( const void* data, size_t size )
+    {
+        detach();
+
+        const unsigned char* bytes = static_cast<const unsigned char*>( data );
+        if ( bytes == 0 || size < sizeof( state_graph_header ) || reinterpret_cast<std::uintptr_t>( bytes ) % 4 != 0 )
+            return false;
+
+        const state_graph_header& header = *reinterpret_cast<const state_graph_header*>( bytes );
+        if ( std::memcmp( header.magic, "FSBG", 4 ) != 0 || header.byte_order != state_graph_byte_order || header.version != state_graph_version )
+            return false;
+
+        if ( header.size > size || header.strings_size == 0 )
+            return false;
+
+        const std::uint64_t states = header.states_count;
+        const std::uint64_t events = header.events_count;
+        if ( !section( header, header.states_offset, states * sizeof( graph_state ) )
+            || !section( header, header.state_keys_offset, states * sizeof( graph_key ) )
+            || !section( header, header.events_offset, events * sizeof( graph_id ) )
+            || !section( header, header.event_keys_offset, events * sizeof( graph_key ) )
+            || !section( header, header.transitions_offset, states * events * sizeof( graph_id ) )
+            || !section( header, header.state_names_offset, states * sizeof( std::uint32_t ) )
+            || !section( header, header.event_names_offset, events * sizeof( std::uint32_t ) )
+            || !section( header, header.strings_offset, header.strings_size ) )
+            return false;
+
+        if ( bytes[header.strings_offset + header.strings_size - 1] != 0 )
+            return false;
+
+        m_header = &header;
+        m_states = reinterpret_cast<const graph_state*>( bytes + header.states_offset );
+        m_state_keys = reinterpret_cast<const graph_key*>( bytes + header.state_keys_offset );
+        m_events = reinterpret_cast<const graph_id*>( bytes + header.events_offset );
+        m_event_keys = reinterpret_cast<const graph_key*>( bytes + header.event_keys_offset );
+        m_transitions = reinterpret_cast<const graph_id*>( bytes + header.transitions_offset );
+        m_state_names = reinterpret_cast<const std::uint32_t*>( bytes + header.state_names_offset );
+        m_event_names = reinterpret_cast<const std::uint32_t*>( bytes + header.event_names_offset );
+        m_strings = reinterpret_cast<const char*>( bytes + header.strings_offset );
+
+        return true;
+    }
+
+    void detach()
+    {
+        m_header = 0;
+        m_states = 0;
+        m_state_keys = 0;
+        m_events = 0;
+        m_event_keys = 0;
+        m_transitions = 0;
+        m_state_names = 0;
+        m_event_names = 0;
+        m_strings = 0;
+    }
+
+    bool is_attached() const { return m_header != 0; }
+    size_t get_size() const { return m_header ? m_header->size : 0; }
+
+    size_t get_states_count() const { return m_header ? m_header->states_count : 0; }
+    const graph_state* get_states() const { return m_states; }
+    const graph_state& get_state( size_t index ) const { return m_states[index]; }
+    size_t find_state_index( graph_id id ) const { return find( m_state_keys, get_states_count(), id ); }
+    const char* get_state_name( size_t index ) const { return get_string( m_state_names[index] ); }
+
+    size_t get_events_count() const { return m_header ? m_header->events_count : 0; }
+    graph_id get_event_id( size_t index ) const { return m_events[index]; }
+    size_t find_event_index( graph_id id ) const { return find( m_event_keys, get_events_count(), id ); }
+    const char* get_event_name( size_t index ) const { return get_string( m_event_names[index] ); }
+
+      // Index of the state which "event" leads to from "state", or invalid_state_index
+    size_t get_transition( size_t state, size_t event ) const
+    {
+        const graph_id target = m_transitions[state * m_header->events_count + event];
+        return target < m_header->states_count ? target : invalid_state_index;
+    }
+
+private:
+    static bool section( const state_graph_header& header, std::uint64_t offset, std::uint64_t size )
+    {
+        return offset % 4 == 0 && offset >= sizeof( state_graph_header ) && offset + size <= header.size;
+    }
+
+    struct key_less
+    {
+        bool operator()( const graph_key& key, graph_id id ) const { return key.id < id; }
+    };
+
+    static size_t find( const graph_key* keys, size_t count, graph_id id )
+    {
+        const graph_key* key = std::lower_bound( keys, keys + count, id, key_less() );
+        return key != keys + count && key->id == id && key->slot < count ? key->slot : invalid_state_index;
+    }
+
+    const char* get_string( std::uint32_t offset ) const { return offset < m_header->strings_size ? m_strings + offset : ""; }
+
+    const state_graph_header* m_header;
+    const graph_state* m_states;
+    const graph_key* m_state_keys;
+    const graph_id* m_events;
+    const graph_key* m_event_keys;
+    const graph_id* m_transitions;
+    const std::uint32_t* m_state_names;
+    const std::uint32_t* m_event_names;
+    const char* m_strings;
+};
+
+//----------------------------------------------------------------
+
+  // Compiles a machine definition into a blob
+class state_graph_builder
+{
+public:
+      // States get indices in order of addition. Returns false if the id is already added.
+    bool add_state( graph_id id, const std::string& name = std::string(), graph_id value = 0 )
+    {
+        if ( find_state( id ) != invalid_state_index )
+            return false;
+
+        state s;
+        s.id = id;
+        s.value = value;
+        s.name = name;
+        m_states.push_back( s );
+
+        return true;
+    }
+
+    bool add_event( graph_id id, const std::string& name = std::string() )
+    {
+        if ( find_event( id ) != invalid_state_index )
+            return false;
+
+        event e;
+        e.id = id;
+        e.name = name;
+        m_events.push_back( e );
+
+        return true;
+    }
+
+      // States and the event must be already added, and there can be only one transition for each state and event
+    bool add_transition( graph_id source, graph_id event, graph_id target )
+    {
+        transition t;
+        t.source = find_state( source );
+        t.event = find_event( event );
+        t.target = find_state( target );
+        if ( t.source == invalid_state_index || t.event == invalid_state_index || t.target == invalid_state_index )
+            return false;
+
+        for ( size_t i = 0; i < m_transitions.size(); ++i )
+            if ( m_transitions[i].source == t.source && m_transitions[i].event == t.event )
+                return false;
+
+        m_transitions.push_back( t );
+
+        return true;
+    }
+
+    size_t find_state( graph_id id ) const
+    {
+        for ( size_t i = 0; i < m_states.size(); ++i )
+            if ( m_states[i].id == id )
+                return i;
+
+        return invalid_state_index;
+    }
+
+    size_t find_event( graph_id id ) const
+    {
+        for ( size_t i = 0; i < m_events.size(); ++i )
+            if ( m_events[i].id == id )
+                return i;
+
+        return invalid_state_index;
+    }
+
+      // Replaces contents of the blob
+    void build( std::vector<unsigned char>& blob ) const
+    {
+        std::string strings( 1, '\0' );
+        std::vector<std::uint32_t> state_names( m_states.size() );
+        std::vector<std::uint32_t> event_names( m_events.size() );
+        for ( size_t i = 0; i < m_states.size(); ++i )
+            state_names[i] = add_string( strings, m_states[i].name );
+        for ( size_t i = 0; i < m_events.size(); ++i )
+            event_names[i] = add_string( strings, m_events[i].name );
+
+        const size_t states_count = m_states.size();
+        const size_t events_count = m_events.size();
+
+        state_graph_header header;
+        std::memset( &header, 0, sizeof( header ) );
+        std::memcpy( header.magic, "FSBG", 4 );
+        header.byte_order = state_graph_byte_order;
+        header.version = state_graph_version;
+        header.states_count = (std::uint32_t)states_count;
+        header.events_count = (std::uint32_t)events_count;
+
+        size_t size = sizeof( state_graph_header );
+        header.states_offset = allocate( size, states_count * sizeof( graph_state ) );
+        header.state_keys_offset = allocate( size, states_count * sizeof( graph_key ) );
+        header.events_offset = allocate( size, events_count * sizeof( graph_id ) );
+        header.event_keys_offset = allocate( size, events_count * sizeof( graph_key ) );
+        header.transitions_offset = allocate( size, states_count * events_count * sizeof( graph_id ) );
+        header.state_names_offset = allocate( size, states_count * sizeof( std::uint32_t ) );
+        header.event_names_offset = allocate( size, events_count * sizeof( std::uint32_t ) );
+        header.strings_offset = allocate( size, strings.size() );
+        header.strings_size = (std::uint32_t)strings.size();
+        header.size = (std::uint32_t)size;
+
+        blob.assign( size, 0 );
+        std::memcpy( &blob[0], &header, sizeof( header ) );
+
+        std::vector<graph_key> keys( states_count );
+        for ( size_t i = 0; i < states_count; ++i )
+        {
+            graph_state s;
+            s.id = m_states[i].id;
+            s.state = m_states[i].value;
+            std::memcpy( &blob[header.states_offset + i * sizeof( graph_state )], &s, sizeof( s ) );
+
+            keys[i].id = m_states[i].id;
+            keys[i].slot = (graph_id)i;
+        }
+        write_keys( blob, header.state_keys_offset, keys );
+
+        keys.resize( events_count );
+        for ( size_t i = 0; i < events_count; ++i )
+        {
+            std::memcpy( &blob[header.events_offset + i * sizeof( graph_id )], &m_events[i].id, sizeof( graph_id ) );
+
+            keys[i].id = m_events[i].id;
+            keys[i].slot = (graph_id)i;
+        }
+        write_keys( blob, header.event_keys_offset, keys );
+
+        std::vector<graph_id> transitions( states_count * events_count, invalid_graph_index );
+        for ( size_t i = 0; i < m_transitions.size(); ++i )
+            transitions[m_transitions[i].source * events_count + m_transitions[i].event] = (graph_id)m_transitions[i].target;
+
+        if ( !transitions.empty() )
+            std::memcpy( &blob[header.transitions_offset], &transitions[0], transitions.size() * sizeof( graph_id ) );
+        if ( states_count > 0 )
+            std::memcpy( &blob[header.state_names_offset], &state_names[0], states_count * sizeof( std::uint32_t ) );
+        if ( events_count > 0 )
+            std::memcpy( &blob[header.event_names_offset], &event_names[0], events_count * sizeof( std::uint32_t ) );
+        std::memcpy( &blob[header.strings_offset], strings.data(), strings.size() );
+    }
+
+private:
+    struct state
+    {
+        graph_id id;
+        graph_id value;
+        std::string name;
+    };
+
+    struct event
+    {
+        graph_id id;
+        std::string name;
+    };
+
+    struct transition
+    {
+        size_t source;
+        size_t event;
+        size_t target;
+    };
+
+    struct key_less
+    {
+        bool operator()( const graph_key& a, const graph_key& b ) const { return a.id < b.id; }
+    };
+
+    static std::uint32_t allocate( size_t& size, size_t bytes )
+    {
+        const size_t offset = size;
+        size = ( size + bytes + 3 ) & ~(size_t)3;
+        return (std::uint32_t)offset;
+    }
+
+      // Empty names share the empty string at offset 0
+    static std::uint32_t add_string( std::string& strings, const std::string& value )
+    {
+        if ( value.empty() )
+            return 0;
+
+        const size_t offset = strings.size();
+        strings.append( value.c_str(), value.size() + 1 );
+        return (std::uint32_t)offset;
+    }
+
+    static void write_keys( std::vector<unsigned char>& blob, size_t offset, std::vector<graph_key>& keys )
+    {
+        std::sort( keys.begin(), keys.end(), key_less() );
+        if ( !keys.empty() )
+            std::memcpy( &blob[offset], &keys[0], keys.size() * sizeof( graph_key ) );
+    }
+
+    std::vector<state> m_states;
+    std::vector<event> m_events;
+    std::vector<transition> m_transitions;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Maps a blob file into memory, read-only. Where memory mapping is not available, reads the file
+    into memory instead.
+*/
+class state_graph_file
+{
+public:
+    state_graph_file() : m_data( 0 ), m_size( 0 ) {}
+    ~state_graph_file() { close(); }
+
+    bool open( const char* path )
+    {
+        close();
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+        const int file = ::open( path, O_RDONLY );
+        if ( file < 0 )
+            return false;
+
+        struct stat info;
+        void* data = MAP_FAILED;
+        if ( ::fstat( file, &info ) == 0 && info.st_size > 0 )
+            data = ::mmap( 0, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0 );
+        ::close( file );
+
+        if ( data == MAP_FAILED )
+            return false;
+
+        m_data = data;
+        m_size = (size_t)info.st_size;
+#else
+        FILE* file = std::fopen( path, "rb" );
+        if ( file == 0 )
+            return false;
+
+        unsigned char buffer[4096];
+        for ( size_t read; ( read = std::fread( buffer, 1, sizeof( buffer ), file ) ) > 0; )
+            m_buffer.insert( m_buffer.end(), buffer, buffer + read );
+        std::fclose( file );
+
+        if ( m_buffer.empty() )
+            return false;
+
+        m_data = &m_buffer[0];
+        m_size = m_buffer.size();
+#endif
+
+        return true;
+    }
+
+    void close()
+    {
+#if defined( __unix__ ) || defined( __APPLE__ )
+        if ( m_data != 0 )
+            ::munmap( m_data, m_size );
+#else
+        m_buffer.clear();
+#endif
+        m_data = 0;
+        m_size = 0;
+    }
+
+    const void* get_data() const { return m_data; }
+    size_t get_size() const { return m_size; }
+
+private:
+    state_graph_file( const state_graph_file& );
+    state_graph_file& operator=( const state_graph_file& );
+
+    void* m_data;
+    size_t m_size;
+#if !defined( __unix__ ) && !defined( __APPLE__ )
+    std::vector<unsigned char> m_buffer;
+#endif
+};
+
+//----------------------------------------------------------------
+// State registry
+//----------------------------------------------------------------
+
+/*
+    Registry which uses states of an attached blob in place. States can not be registered.
+    Manipulators keep non-const pointers to states, as with other registries, but never write through
+    them, so the blob can be mapped read-only.
+*/
+class state_registry_graph
+{
+public:
+    bool attach( const void* data, size_t size ) { return m_graph.attach( data, size ); }
+    bool attach( const state_graph_file& file ) { return m_graph.attach( file.get_data(), file.get_size() ); }
+
+    const state_graph& get_graph() const { return m_graph; }
+
+    bool register_state( graph_id id, graph_id state ) { return false; }
+
+    template<typename t_iterator>
+    size_t register_states( t_iterator first, t_iterator last ) { return 0; }
+
+    void reserve( size_t count ) {}
+
+    graph_state* find_state( graph_id id )
+    {
+        const size_t index = find_state_index( id );
+        return index != invalid_state_index ? &get_state( index ) : 0;
+    }
+
+    size_t find_state_index( const graph_id& id ) const { return m_graph.find_state_index( id ); }
+
+    size_t get_state_index( const graph_state* state ) const { return state - m_graph.get_states(); }
+    graph_state& get_state( size_t index ) { return const_cast<graph_state&>( m_graph.get_state( index ) ); }
+    size_t get_states_count() const { return m_graph.get_states_count(); }
+
+private:
+    state_graph m_graph;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void
+>
+class state_manipulator_single_graph_interface :
+    public state_manipulator_single_immediate_interface<graph_id, graph_id, t_on_enter_exit_policy, t_context, state_registry_graph>
+{
+public:
+    typedef state_manipulator_single_immediate_impl<graph_id, graph_id, state_registry_graph> t_impl;
+    typedef state_registry_graph t_registry;
+
+    state_manipulator_single_graph_interface( t_impl& impl )
+        : state_manipulator_single_immediate_interface<graph_id, graph_id, t_on_enter_exit_policy, t_context, state_registry_graph>( impl )
+        , m_graph_impl( impl )
+    {}
+
+      // Changes state along the transition of the blob for the current state and the event.
+      // Returns false if there is no current state, or no such transition.
+    bool dispatch( graph_id event, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        graph_state *& current_state = m_graph_impl.m_state_container_impl.m_current_state;
+        if ( current_state == 0 )
+            return false;
+
+        const state_graph& graph = m_graph_impl.m_state_registry.get_graph();
+        const size_t event_index = graph.find_event_index( event );
+        if ( event_index == invalid_state_index )
+            return false;
+
+        const size_t target = graph.get_transition( m_graph_impl.m_state_registry.get_state_index( current_state ), event_index );
+        if ( target == invalid_state_index )
+            return false;
+
+        t_on_enter_exit_policy::on_exit( *current_state, ctx );
+        current_state = &m_graph_impl.m_state_registry.get_state( target );
+        t_on_enter_exit_policy::on_enter( *current_state, ctx );
+
+        return true;
+    }
+
+protected:
+    t_impl& m_graph_impl;
+};
+
+//----------------------------------------------------------------
+}
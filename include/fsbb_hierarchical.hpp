@@ -0,0 +1,424 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+
+/*
+    Building blocks for hierarchical machines, where states can be nested into other states,
+    e.g. Locomotion > Grounded > Running.
+
+    The current state is always a leaf of the active branch, and all its ancestors are active, too.
+    Changing state to a state exits active states from the leaf up to the nearest common ancestor of
+    the current state and the target, and then enters states from there down to the target. If the
+    target has an initial child state, its initial children are entered, too, down to a leaf.
+
+    Transition to an active state (e.g. to the current state, or to its parent) exits and enters it
+    again, just like changing state of a single-state machine to the current state does.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+/*
+    Parent links between states, identified by registry slots, and data precomputed from them:
+    the chain of states from the root to each state, the initial leaf of each state, and the depth
+    of the common part of chains of two states. Chains are rebuilt when links or the number of states
+    change, and common depths are computed on the first transition between two states and cached,
+    so changing state never walks the hierarchy.
+
+    The cache takes states count squared 16-bit values, and so suits machines with up to several
+    thousands of states.
+*/
+class state_hierarchy
+{
+public:
+    state_hierarchy() : m_states_count( 0 ), m_dirty( false ) {}
+
+      // Fails if the parent is the child itself, or a descendant of it
+    bool set_parent( size_t child, size_t parent )
+    {
+        grow( child > parent ? child + 1 : parent + 1 );
+
+        for ( size_t s = parent; s != invalid_state_index; s = m_parents[s] )
+            if ( s == child )
+                return false;
+
+        if ( m_parents[child] != invalid_state_index && m_initial_children[m_parents[child]] == child )
+            m_initial_children[m_parents[child]] = invalid_state_index;
+
+        m_parents[child] = parent;
+        m_dirty = true;
+
+        return true;
+    }
+
+      // Fails if the child is not a direct child of the parent
+    bool set_initial_child( size_t parent, size_t child )
+    {
+        grow( child > parent ? child + 1 : parent + 1 );
+
+        if ( m_parents[child] != parent )
+            return false;
+
+        m_initial_children[parent] = child;
+        m_dirty = true;
+
+        return true;
+    }
+
+    size_t get_parent( size_t state ) const { return state < m_parents.size() ? m_parents[state] : invalid_state_index; }
+
+      // Rebuilds precomputed data if needed. Must be called before using functions below.
+    void prepare( size_t states_count )
+    {
+        if ( !m_dirty && states_count == m_states_count )
+            return;
+
+        grow( states_count );
+        m_states_count = states_count;
+
+        m_chain_offsets.assign( states_count, 0 );
+        m_depths.assign( states_count, 0 );
+        m_initial_leaves.assign( states_count, 0 );
+        m_chains.clear();
+
+        for ( size_t i = 0; i < states_count; ++i )
+        {
+            size_t depth = 0;
+            for ( size_t s = i; s != invalid_state_index; s = m_parents[s] )
+                ++depth;
+
+            m_chain_offsets[i] = m_chains.size();
+            m_depths[i] = depth;
+            m_chains.resize( m_chains.size() + depth );
+
+            size_t s = i;
+            for ( size_t d = depth; d-- > 0; s = m_parents[s] )
+                m_chains[m_chain_offsets[i] + d] = s;
+
+            size_t leaf = i;
+            while ( m_initial_children[leaf] != invalid_state_index )
+                leaf = m_initial_children[leaf];
+            m_initial_leaves[i] = leaf;
+        }
+
+        m_common_depths.assign( states_count * states_count, unknown_depth );
+        m_dirty = false;
+    }
+
+      // States from the root to the state itself
+    const size_t* get_chain( size_t state ) const { return &m_chains[m_chain_offsets[state]]; }
+    size_t get_depth( size_t state ) const { return m_depths[state]; }
+
+      // The state itself, if it has no initial child, otherwise the leaf reached through initial children
+    size_t get_initial_leaf( size_t state ) const { return m_initial_leaves[state]; }
+
+      // Number of states shared by chains of both states
+    size_t get_common_depth( size_t from, size_t to )
+    {
+        unsigned short& common = m_common_depths[from * m_states_count + to];
+        if ( common == unknown_depth )
+        {
+            const size_t* from_chain = get_chain( from );
+            const size_t* to_chain = get_chain( to );
+            const size_t max_depth = m_depths[from] < m_depths[to] ? m_depths[from] : m_depths[to];
+
+            size_t depth = 0;
+            while ( depth < max_depth && from_chain[depth] == to_chain[depth] )
+                ++depth;
+
+            common = (unsigned short)depth;
+        }
+
+        return common;
+    }
+
+private:
+    enum { unknown_depth = 0xFFFF };
+
+    void grow( size_t states_count )
+    {
+        if ( m_parents.size() < states_count )
+        {
+            m_parents.resize( states_count, invalid_state_index );
+            m_initial_children.resize( states_count, invalid_state_index );
+        }
+    }
+
+    std::vector<size_t> m_parents;
+    std::vector<size_t> m_initial_children;
+
+    size_t m_states_count;
+    bool m_dirty;
+    std::vector<size_t> m_chains;
+    std::vector<size_t> m_chain_offsets;
+    std::vector<size_t> m_depths;
+    std::vector<size_t> m_initial_leaves;
+    std::vector<unsigned short> m_common_depths;
+};
+
+//----------------------------------------------------------------
+// State containers ( impl; interface )
+//----------------------------------------------------------------
+
+/*
+    Active states are kept as registry slots rather than pointers, like in fsbb_world.hpp, so
+    registering states after transitions never invalidates them, whatever the registry storage.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_container_hierarchical_impl
+{
+    typedef std::vector<size_t> active_states_vector;
+
+    state_container_hierarchical_impl() : m_current_state( invalid_state_index ), m_state_registry( 0 ) {}
+
+      // Registry slots of active states from the root to the current state, and of the current state
+    active_states_vector m_active_states;
+    size_t m_current_state;
+
+      // Set by the manipulator
+    t_state_registry* m_state_registry;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_container_hierarchical_interface
+{
+public:
+    typedef state_container_hierarchical_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef typename t_impl::active_states_vector active_states_vector;
+
+    state_container_hierarchical_interface( t_impl& impl ) : m_impl( impl ) {}
+
+    t_state_id get_current_state_id() const { return !m_impl.m_active_states.empty() ? m_impl.m_state_registry->get_state( m_impl.m_active_states.back() ).id : t_state_id(); }
+    const t_state get_current_state() const { return !m_impl.m_active_states.empty() ? m_impl.m_state_registry->get_state( m_impl.m_active_states.back() ).state : 0; }
+
+      // Returns true if the state is the current state or one of its ancestors
+    bool is_in_state( t_state_id id ) const
+    {
+        const size_t slot = m_impl.m_state_registry ? m_impl.m_state_registry->find_state_index( id ) : invalid_state_index;
+        return slot != invalid_state_index && std::find( m_impl.m_active_states.begin(), m_impl.m_active_states.end(), slot ) != m_impl.m_active_states.end();
+    }
+
+      // Registry slots of active states, from the root to the current state
+    const active_states_vector& get_active_states() const { return m_impl.m_active_states; }
+
+protected:
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_hierarchical_immediate_impl
+{
+    typedef state_container_hierarchical_impl<t_state_id, t_state, t_state_registry> t_state_container_impl;
+    state_manipulator_hierarchical_immediate_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : m_state_container_impl( state_container_impl )
+        , m_state_registry( state_registry )
+    {
+        m_state_container_impl.m_state_registry = &m_state_registry;
+    }
+
+    t_state_container_impl& m_state_container_impl;
+    t_state_registry& m_state_registry;
+    state_hierarchy m_hierarchy;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_hierarchical_immediate_interface
+{
+public:
+    typedef state_manipulator_hierarchical_immediate_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_hierarchical_immediate_interface( t_impl& impl ) : m_impl( impl ) {}
+
+      // Makes "child" a substate of "parent". Both states must be registered, the child must not be
+      // active, and the parent must not be the child or its descendant, otherwise returns false.
+    bool set_parent( t_state_id child, t_state_id parent )
+    {
+        const size_t child_index = m_impl.m_state_registry.find_state_index( child );
+        const size_t parent_index = m_impl.m_state_registry.find_state_index( parent );
+        if ( child_index == invalid_state_index || parent_index == invalid_state_index )
+            return false;
+
+        if ( is_active( child_index ) )
+            return false;
+
+        return m_impl.m_hierarchy.set_parent( child_index, parent_index );
+    }
+
+      // Makes "child" the state that is entered when changing state to "parent".
+      // The child must be a direct substate of the parent, otherwise returns false.
+    bool set_initial_state( t_state_id parent, t_state_id child )
+    {
+        const size_t parent_index = m_impl.m_state_registry.find_state_index( parent );
+        const size_t child_index = m_impl.m_state_registry.find_state_index( child );
+        if ( child_index == invalid_state_index || parent_index == invalid_state_index )
+            return false;
+
+        return m_impl.m_hierarchy.set_initial_child( parent_index, child_index );
+    }
+
+    bool change_state_immediate( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        const size_t target = m_impl.m_state_registry.find_state_index( id );
+        if ( target == invalid_state_index )
+            return false;
+
+        change_state_by_index( target, ctx );
+
+        return true;
+    }
+
+protected:
+    void change_state_by_index( size_t target, context_holder<t_context>& ctx )
+    {
+        state_hierarchy& hierarchy = m_impl.m_hierarchy;
+        hierarchy.prepare( m_impl.m_state_registry.get_states_count() );
+
+        typename t_impl::t_state_container_impl::active_states_vector& active_states = m_impl.m_state_container_impl.m_active_states;
+        size_t& current_state = m_impl.m_state_container_impl.m_current_state;
+
+          // The target itself is always exited and entered again, if it is active
+        size_t common_depth = 0;
+        if ( current_state != invalid_state_index )
+        {
+            common_depth = hierarchy.get_common_depth( current_state, target );
+            if ( common_depth >= hierarchy.get_depth( target ) )
+                common_depth = hierarchy.get_depth( target ) - 1;
+        }
+
+        while ( active_states.size() > common_depth )
+        {
+            const size_t exited_state = active_states.back();
+            active_states.pop_back();
+            t_on_enter_exit_policy::on_exit( m_impl.m_state_registry.get_state( exited_state ), ctx );
+        }
+
+        const size_t leaf = hierarchy.get_initial_leaf( target );
+        const size_t* chain = hierarchy.get_chain( leaf );
+        current_state = leaf;
+
+        for ( size_t i = common_depth; i < hierarchy.get_depth( leaf ); ++i )
+        {
+            active_states.push_back( chain[i] );
+            t_on_enter_exit_policy::on_enter( m_impl.m_state_registry.get_state( chain[i] ), ctx );
+        }
+    }
+
+    bool is_active( size_t index ) const
+    {
+        const typename t_impl::t_state_container_impl::active_states_vector& active_states = m_impl.m_state_container_impl.m_active_states;
+        return std::find( active_states.begin(), active_states.end(), index ) != active_states.end();
+    }
+
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_hierarchical_combined_impl : public state_manipulator_hierarchical_immediate_impl<t_state_id, t_state, t_state_registry>
+{
+    typedef state_container_hierarchical_impl<t_state_id, t_state, t_state_registry> t_state_container_impl;
+    state_manipulator_hierarchical_combined_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_hierarchical_immediate_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+        , m_next_state( invalid_state_index )
+    {}
+
+    size_t m_next_state;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_hierarchical_combined_interface :
+    public state_manipulator_hierarchical_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>
+{
+public:
+    typedef state_manipulator_hierarchical_combined_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_hierarchical_combined_interface( t_impl& impl )
+        : state_manipulator_hierarchical_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
+        , m_combined_impl( impl )
+    {}
+
+      // As with single-state queued manipulator, only the last queued change of state is executed
+    bool queue_change_state( t_state_id id )
+    {
+        const size_t next_state = m_combined_impl.m_state_registry.find_state_index( id );
+        if ( next_state == invalid_state_index )
+            return false;
+
+        m_combined_impl.m_next_state = next_state;
+
+        return true;
+    }
+
+    void update( context_holder<t_context> ctx )
+    {
+        if ( m_combined_impl.m_next_state == invalid_state_index )
+            return;
+
+        const size_t next_state = m_combined_impl.m_next_state;
+        m_combined_impl.m_next_state = invalid_state_index;
+
+        this->change_state_by_index( next_state, ctx );
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+protected:
+    t_impl& m_combined_impl;
+};
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+#include <string>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+
+/*
+    Interned string state ids, for data-driven machines which name their states with strings.
+
+    symbol_table maps names to dense 32-bit handles, starting from 1, and caches a hash of every name.
+    interned_id holds the handle and the hash, so comparing, copying and hashing ids never touches
+    the name: state lookups, stacked container searches and queued actions cost the same as with
+    integer ids. Names are only used when ids are loaded from or written to text.
+
+    Handles are unique within a single table, so ids of different tables must not be mixed. Most
+    programs use the global table, through intern().
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+class interned_id
+{
+public:
+      // Invalid id
+    interned_id() : m_handle( 0 ), m_hash( 0 ) {}
+
+    uint32_t get_handle() const { return m_handle; }
+    uint32_t get_hash() const { return m_hash; }
+    bool is_valid() const { return m_handle != 0; }
+
+    bool operator==( const interned_id& other ) const { return m_handle == other.m_handle; }
+    bool operator!=( const interned_id& other ) const { return m_handle != other.m_handle; }
+
+      // Order of interning, not of names. Enough for registry_lookup_sorted.
+    bool operator<( const interned_id& other ) const { return m_handle < other.m_handle; }
+
+      // Handles are dense, so ids can be used with registry_lookup_direct
+    explicit operator long long() const { return m_handle; }
+    explicit operator size_t() const { return m_handle; }
+
+private:
+    friend class symbol_table;
+
+    interned_id( uint32_t handle, uint32_t hash ) : m_handle( handle ), m_hash( hash ) {}
+
+    uint32_t m_handle;
+    uint32_t m_hash;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Open-addressing hash table of names. Interning and reading names are guarded by a mutex,
+    so a table can be shared by machines updated in different threads.
+*/
+class symbol_table
+{
+public:
+    symbol_table()
+    {
+          // Handle 0 is the invalid id
+        m_names.push_back( std::string() );
+        m_hashes.push_back( 0 );
+    }
+
+      // FNV-1a, stable between runs and platforms
+    static uint32_t hash( const char* name, size_t length )
+    {
+        uint32_t result = 2166136261u;
+        for ( size_t i = 0; i < length; ++i )
+        {
+            result ^= static_cast<unsigned char>( name[i] );
+            result *= 16777619u;
+        }
+
+        return result;
+    }
+
+      // Returns the id of the name, adding it to the table if it's not there yet
+    interned_id intern( const char* name, size_t length )
+    {
+        const uint32_t name_hash = hash( name, length );
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        const uint32_t handle = find_handle( name, length, name_hash );
+        if ( handle != 0 )
+            return interned_id( handle, name_hash );
+
+        if ( ( m_names.size() + 1 ) * 2 > m_slots.size() )
+            rehash( ( m_names.size() + 1 ) * 2 );
+
+        const uint32_t new_handle = static_cast<uint32_t>( m_names.size() );
+        m_names.push_back( std::string( name, length ) );
+        m_hashes.push_back( name_hash );
+        place( new_handle );
+
+        return interned_id( new_handle, name_hash );
+    }
+
+    interned_id intern( const std::string& name ) { return intern( name.data(), name.size() ); }
+    interned_id intern( const char* name ) { return intern( name, strlen( name ) ); }
+
+      // Returns the id of the name, or an invalid id if the name was never interned
+    interned_id find( const std::string& name ) const
+    {
+        const uint32_t name_hash = hash( name.data(), name.size() );
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        const uint32_t handle = find_handle( name.data(), name.size(), name_hash );
+        return handle != 0 ? interned_id( handle, name_hash ) : interned_id();
+    }
+
+      // Returns an empty string for the invalid id. Names are never moved, so the reference stays valid.
+    const std::string& get_name( interned_id id ) const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return id.m_handle < m_names.size() ? m_names[id.m_handle] : m_names[0];
+    }
+
+      // Not counting the invalid id
+    size_t get_symbols_count() const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_names.size() - 1;
+    }
+
+    static symbol_table& global()
+    {
+        static symbol_table table;
+        return table;
+    }
+
+private:
+    uint32_t find_handle( const char* name, size_t length, uint32_t name_hash ) const
+    {
+        if ( m_slots.empty() )
+            return 0;
+
+        const size_t mask = m_slots.size() - 1;
+        for ( size_t i = name_hash & mask; m_slots[i] != 0; i = ( i + 1 ) & mask )
+        {
+            const uint32_t handle = m_slots[i];
+            if ( m_hashes[handle] == name_hash && m_names[handle].size() == length && memcmp( m_names[handle].data(), name, length ) == 0 )
+                return handle;
+        }
+
+        return 0;
+    }
+
+    void place( uint32_t handle )
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t i = m_hashes[handle] & mask;
+        while ( m_slots[i] != 0 )
+            i = ( i + 1 ) & mask;
+
+        m_slots[i] = handle;
+    }
+
+    void rehash( size_t min_size )
+    {
+        size_t size = 16;
+        while ( size < min_size )
+            size *= 2;
+
+        m_slots.assign( size, 0 );
+        for ( uint32_t handle = 1; handle < m_names.size(); ++handle )
+            place( handle );
+    }
+
+    mutable std::mutex m_mutex;
+
+      // Indexed by handle. Deque does not move names when it grows.
+    std::deque<std::string> m_names;
+    std::vector<uint32_t> m_hashes;
+
+      // Handles, 0 is an empty slot
+    std::vector<uint32_t> m_slots;
+};
+
+//----------------------------------------------------------------
+
+  // Interns the name in the global table
+inline interned_id intern( const std::string& name ) { return symbol_table::global().intern( name ); }
+inline interned_id intern( const char* name ) { return symbol_table::global().intern( name ); }
+
+  // Name of an id from the global table
+inline const std::string& get_interned_name( interned_id id ) { return symbol_table::global().get_name( id ); }
+
+  // Text form of ids of the global table, e.g. for trace export and for loading machines from text files
+inline std::ostream& operator<<( std::ostream& out, interned_id id ) { return out << get_interned_name( id ); }
+
+inline std::istream& operator>>( std::istream& in, interned_id& id )
+{
+    std::string name;
+    if ( in >> name )
+        id = intern( name );
+
+    return in;
+}
+
+//----------------------------------------------------------------
+}
+
+namespace std
+{
+  // Cached hash, so registry_lookup_hashed<> does not hash names
+template<>
+struct hash<fsbb::interned_id>
+{
+    size_t operator()( const fsbb::interned_id& id ) const { return id.get_hash(); }
+};
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+/*
+    Parallel update of many independent state machines.
+
+    parallel_update_pool is a small work-stealing thread pool. A job is split into chunks of items,
+    which are initially distributed evenly between workers. When a worker runs out of its own chunks,
+    it steals chunks from the back of other workers' queues. The thread that starts a job works on it
+    too, as worker 0.
+
+    Machines updated in parallel must not share anything that their enter/exit functions modify,
+    including state objects. To make that easier, each worker gets its own context object.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+class parallel_update_pool
+{
+public:
+      // threads_count = 0 uses one worker per hardware thread
+    explicit parallel_update_pool( size_t threads_count = 0 )
+        : m_workers_count( threads_count != 0 ? threads_count : default_threads_count() )
+        , m_queues( new worker_queue[m_workers_count] )
+        , m_job( 0 )
+        , m_run( 0 )
+        , m_items_count( 0 )
+        , m_chunk_size( 1 )
+        , m_generation( 0 )
+        , m_active( 0 )
+        , m_stop( false )
+    {
+        for ( size_t i = 1; i < m_workers_count; ++i )
+            m_threads.push_back( std::thread( &parallel_update_pool::worker_loop, this, i ) );
+    }
+
+    ~parallel_update_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_start.notify_all();
+
+        for ( size_t i = 0; i < m_threads.size(); ++i )
+            m_threads[i].join();
+    }
+
+    size_t get_workers_count() const { return m_workers_count; }
+
+      // Calls f( first, last, worker ) for ranges of items [first; last) covering [0; items_count),
+      // each at most chunk_size items long. Returns when all items are processed.
+    template<typename t_functor>
+    void run( size_t items_count, size_t chunk_size, t_functor& f )
+    {
+        if ( items_count == 0 )
+            return;
+
+        m_chunk_size = chunk_size != 0 ? chunk_size : 1;
+        m_items_count = items_count;
+        m_job = &f;
+        m_run = &run_functor<t_functor>;
+
+        const size_t chunks_count = ( items_count + m_chunk_size - 1 ) / m_chunk_size;
+        for ( size_t i = 0; i < m_workers_count; ++i )
+        {
+            m_queues[i].front = chunks_count * i / m_workers_count;
+            m_queues[i].back = chunks_count * ( i + 1 ) / m_workers_count;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_active = m_workers_count - 1;
+            ++m_generation;
+        }
+        m_start.notify_all();
+
+        execute( 0 );
+
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_done.wait( lock, [this]{ return m_active == 0; } );
+    }
+
+private:
+    struct worker_queue
+    {
+        worker_queue() : front( 0 ), back( 0 ) {}
+
+        std::mutex lock;
+        size_t front;
+        size_t back;
+        char padding[64];
+    };
+
+    static size_t default_threads_count()
+    {
+        const size_t count = std::thread::hardware_concurrency();
+        return count != 0 ? count : 1;
+    }
+
+    template<typename t_functor>
+    static void run_functor( void* job, size_t first, size_t last, size_t worker )
+    {
+        ( *static_cast<t_functor*>( job ) )( first, last, worker );
+    }
+
+      // Takes a chunk from the front of worker's own queue, or steals one from the back of another queue
+    bool pop_chunk( size_t worker, size_t& chunk )
+    {
+        {
+            worker_queue& own = m_queues[worker];
+            std::lock_guard<std::mutex> lock( own.lock );
+            if ( own.front < own.back )
+            {
+                chunk = own.front++;
+                return true;
+            }
+        }
+
+        for ( size_t i = 1; i < m_workers_count; ++i )
+        {
+            worker_queue& victim = m_queues[( worker + i ) % m_workers_count];
+            std::lock_guard<std::mutex> lock( victim.lock );
+            if ( victim.front < victim.back )
+            {
+                chunk = --victim.back;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void execute( size_t worker )
+    {
+        size_t chunk;
+        while ( pop_chunk( worker, chunk ) )
+        {
+            const size_t first = chunk * m_chunk_size;
+            const size_t last = first + m_chunk_size < m_items_count ? first + m_chunk_size : m_items_count;
+            m_run( m_job, first, last, worker );
+        }
+    }
+
+    void worker_loop( size_t worker )
+    {
+        size_t generation = 0;
+        for ( ;; )
+        {
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_start.wait( lock, [&]{ return m_stop || m_generation != generation; } );
+                if ( m_stop )
+                    return;
+
+                generation = m_generation;
+            }
+
+            execute( worker );
+
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                --m_active;
+            }
+            m_done.notify_one();
+        }
+    }
+
+    parallel_update_pool( const parallel_update_pool& );
+    parallel_update_pool& operator=( const parallel_update_pool& );
+
+    const size_t m_workers_count;
+    std::unique_ptr<worker_queue[]> m_queues;
+    std::vector<std::thread> m_threads;
+
+    void* m_job;
+    void (*m_run)( void* job, size_t first, size_t last, size_t worker );
+    size_t m_items_count;
+    size_t m_chunk_size;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    size_t m_generation;
+    size_t m_active;
+    bool m_stop;
+};
+
+//----------------------------------------------------------------
+
+template<typename t_machine>
+t_machine& parallel_machine_ref( t_machine& machine ) { return machine; }
+
+template<typename t_machine>
+t_machine& parallel_machine_ref( t_machine* machine ) { return *machine; }
+
+template<typename t_iterator, typename t_worker_context>
+struct parallel_update_job
+{
+    parallel_update_job( t_iterator machines, t_worker_context* contexts ) : m_machines( machines ), m_contexts( contexts ) {}
+
+    void operator()( size_t first, size_t last, size_t worker )
+    {
+        t_worker_context& ctx = m_contexts[worker];
+        for ( size_t i = first; i < last; ++i )
+            parallel_machine_ref( m_machines[i] ).update( ctx );
+    }
+
+    t_iterator m_machines;
+    t_worker_context* m_contexts;
+};
+
+template<typename t_iterator>
+struct parallel_update_job<t_iterator, void>
+{
+    parallel_update_job( t_iterator machines ) : m_machines( machines ) {}
+
+    void operator()( size_t first, size_t last, size_t worker )
+    {
+        for ( size_t i = first; i < last; ++i )
+            parallel_machine_ref( m_machines[i] ).update();
+    }
+
+    t_iterator m_machines;
+};
+
+//----------------------------------------------------------------
+
+  // Calls update( worker_contexts[worker] ) for all machines in [first; last), which can be machines or
+  // pointers to machines. worker_contexts must have an element for each worker of the pool, otherwise
+  // returns false without updating anything.
+template<typename t_iterator, typename t_worker_context>
+bool update_parallel( parallel_update_pool& pool, t_iterator first, t_iterator last, std::vector<t_worker_context>& worker_contexts, size_t chunk_size = 256 )
+{
+    if ( worker_contexts.size() < pool.get_workers_count() )
+        return false;
+
+    parallel_update_job<t_iterator, t_worker_context> job( first, &worker_contexts[0] );
+    pool.run( last - first, chunk_size, job );
+
+    return true;
+}
+
+  // Calls update() for all machines in [first; last), for machines with void context
+template<typename t_iterator>
+void update_parallel( parallel_update_pool& pool, t_iterator first, t_iterator last, size_t chunk_size = 256 )
+{
+    parallel_update_job<t_iterator, void> job( first );
+    pool.run( last - first, chunk_size, job );
+}
+
+//----------------------------------------------------------------
+}
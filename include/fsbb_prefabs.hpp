@@ -1,11 +1,33 @@
 #pragma once
 
 #include "fsbb_single.hpp"
+#include "fsbb_transitions.hpp"
 #include "fsbb_stacked.hpp"
+#include "fsbb_hierarchical.hpp"
+#include "fsbb_regions.hpp"
+#include "fsbb_concurrent.hpp"
+#include "fsbb_trace.hpp"
+#include "fsbb_statistics.hpp"
+#include "fsbb_snapshot.hpp"
+#include "fsbb_graph.hpp"
+#include "fsbb_rollback.hpp"
+#include "fsbb_interned.hpp"
+#include "fsbb_static.hpp"
+#include "fsbb_world.hpp"
+#include "fsbb_batch.hpp"
+
+#if __cplusplus >= 201703L
+#include "fsbb_variant.hpp"
+#endif
+
+#if __cplusplus >= 202002L
+#include "fsbb_async.hpp"
+#endif
 
 /*
     This file contains some "pre-fabricated" finite-state machines, which implement use-cases I consider common.
     They can be furhter parametrized with state ID and state type for use in your code.
+    The last parameter of every machine is the state registry, which allows to choose a lookup policy for states.
 
     Each machine is described by a simple table:
 
@@ -28,7 +50,8 @@ namespace fsbb
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_single_immediate
     : public fsm
@@ -36,7 +59,7 @@ class fsm_single_immediate
         t_state_id,
         t_state,
         state_container_single_interface<t_state_id, t_state>,
-        state_manipulator_single_immediate_interface<t_state_id, t_state>
+        state_manipulator_single_immediate_interface<t_state_id, t_state, enter_exit_policy_default, void, t_state_registry>
     >
 {
 };
@@ -53,7 +76,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_single_immediate_enter_exit
     : public fsm
@@ -61,7 +85,7 @@ class fsm_single_immediate_enter_exit
         t_state_id,
         t_state,
         state_container_single_interface<t_state_id, t_state>,
-        state_manipulator_single_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context>
+        state_manipulator_single_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
     >
 {
 };
@@ -78,7 +102,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_single_queued_enter_exit
     : public fsm
@@ -86,7 +111,7 @@ class fsm_single_queued_enter_exit
         t_state_id,
         t_state,
         state_container_single_interface<t_state_id, t_state>,
-        state_manipulator_single_queued_interface<t_state_id, t_state, enter_exit_policy_notify, t_context>
+        state_manipulator_single_queued_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
     >
 {
 };
@@ -103,7 +128,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_single_combined_enter_exit
     : public fsm
@@ -111,7 +137,35 @@ class fsm_single_combined_enter_exit
         t_state_id,
         t_state,
         state_container_single_interface<t_state_id, t_state>,
-        state_manipulator_single_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context>
+        state_manipulator_single_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : single
+    Switching     : by events, according to transition rules; also immediate
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_event_id,
+    typename t_context = void,
+    typename t_event_lookup_policy = registry_lookup_linear,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_transition_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_single_interface<t_state_id, t_state>,
+        state_manipulator_single_transition_interface<t_state_id, t_state, t_event_id, enter_exit_policy_notify, t_context, t_event_lookup_policy, t_state_registry>
     >
 {
 };
@@ -126,7 +180,8 @@ class fsm_single_combined_enter_exit
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_stacked_immediate
     : public fsm
@@ -134,7 +189,7 @@ class fsm_stacked_immediate
         t_state_id,
         t_state,
         state_container_stacked_interface<t_state_id, t_state>,
-        state_manipulator_stacked_immediate_interface<t_state_id, t_state>
+        state_manipulator_stacked_immediate_interface<t_state_id, t_state, enter_exit_policy_default, void, t_state_registry>
     >
 {
 };
@@ -151,7 +206,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_stacked_immediate_enter_exit
     : public fsm
@@ -159,7 +215,7 @@ class fsm_stacked_immediate_enter_exit
         t_state_id,
         t_state,
         state_container_stacked_interface<t_state_id, t_state>,
-        state_manipulator_stacked_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context >
+        state_manipulator_stacked_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
     >
 {
 };
@@ -176,7 +232,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_stacked_queued_enter_exit
     : public fsm
@@ -184,7 +241,7 @@ class fsm_stacked_queued_enter_exit
         t_state_id,
         t_state,
         state_container_stacked_interface<t_state_id, t_state>,
-        state_manipulator_stacked_queued_interface<t_state_id, t_state, enter_exit_policy_notify, t_context>
+        state_manipulator_stacked_queued_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
     >
 {
 };
@@ -201,7 +258,8 @@ template
 <
     typename t_state_id,
     typename t_state,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class fsm_stacked_combined_enter_exit
     : public fsm
@@ -209,10 +267,451 @@ class fsm_stacked_combined_enter_exit
         t_state_id,
         t_state,
         state_container_stacked_interface<t_state_id, t_state>,
-        state_manipulator_stacked_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context>
+        state_manipulator_stacked_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : keeps position of every state in the stack, so finding and removing states does not
+                    scan the stack. Uses hashed registry lookup by default.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state, registry_lookup_hashed<> >
+>
+class fsm_stacked_indexed_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state, stacked_storage_indexed<> >,
+        state_manipulator_stacked_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry, stacked_storage_indexed<> >
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack of at most t_stack_capacity states
+    Switching     : combined, with at most t_queue_capacity queued actions
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : the stack and the queue are stored inside the machine, so it never allocates memory
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    size_t t_stack_capacity,
+    size_t t_queue_capacity,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_stacked_fixed_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state, stacked_storage_fixed<t_stack_capacity, t_queue_capacity> >,
+        state_manipulator_stacked_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry, stacked_storage_fixed<t_stack_capacity, t_queue_capacity> >
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : queue_* functions can be called from any thread, but update() and immediate
+                    functions only from the owning thread. At most t_capacity actions can be queued.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    size_t t_capacity = 1024,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_stacked_concurrent_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state>,
+        state_manipulator_stacked_concurrent_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_capacity, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : single
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : records calls and callbacks into a ring buffer, which can be exported to Chrome trace
+                    JSON. With trace_policy_statistics, collects per-state statistics instead.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_traced_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_single_interface<t_state_id, t_state>,
+        state_manipulator_single_traced_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_trace_policy, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : records calls and callbacks into a ring buffer, which can be exported to Chrome trace
+                    JSON. With trace_policy_statistics, collects per-state statistics instead, and with
+                    trace_policy_none, nothing is recorded.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_stacked_traced_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state>,
+        state_manipulator_stacked_traced_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_trace_policy, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : can be rewound to any of the last t_frames frames in which it changed, without
+                    calling enter/exit functions. Frames are counted by a clock, which can be shared.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    size_t t_frames = 8,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_stacked_rollback_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state>,
+        state_manipulator_stacked_rollback_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_frames, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : hierarchical, i.e. a leaf state and all its ancestors
+    Switching     : immediate
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : only states below the common ancestor of the current and the target state are
+                    exited and entered.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_hierarchical_immediate_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_hierarchical_interface<t_state_id, t_state, t_state_registry>,
+        state_manipulator_hierarchical_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : hierarchical, i.e. a leaf state and all its ancestors
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : only states below the common ancestor of the current and the target state are
+                    exited and entered.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_hierarchical_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_hierarchical_interface<t_state_id, t_state, t_state_registry>,
+        state_manipulator_hierarchical_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : one single state per orthogonal region
+    Switching     : immediate
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : regions share one registry, and are added with add_region().
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_regions_immediate_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_regions_interface<t_state_id, t_state>,
+        state_manipulator_regions_immediate_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : one single state per orthogonal region
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : regions share one registry and one queue of changes, which are applied to all
+                    regions by a single update() call.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_regions_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_regions_interface<t_state_id, t_state>,
+        state_manipulator_regions_combined_interface<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : single
+    Switching     : immediate
+    Reactions     : call on_enter/on_exit functions of the state. States are a compile-time list of types,
+                    which are stored by value in the machine and called directly, without virtual calls.
+    Comment       : states are identified by their type or by their index in the list.
+*/
+template
+<
+    typename t_context,
+    typename... t_states
+>
+class fsm_static_single_immediate_enter_exit
+    : public fsm
+    <
+        size_t,
+        std::tuple<t_states...>,
+        state_container_static_interface<static_state_registry<t_states...> >,
+        state_manipulator_static_immediate_interface<static_state_registry<t_states...>, enter_exit_policy_static_notify, t_context>
+    >
+{
+};
+
+//----------------------------------------------------------------
+#if __cplusplus >= 201703L
+
+/*
+    Current state : single
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    std::variant of state types which provide these two functions.
+    Comment       : states are stored by value in the registry, and called without virtual calls.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_variant_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_single_interface<t_state_id, t_state>,
+        state_manipulator_single_combined_interface<t_state_id, t_state, enter_exit_policy_variant_notify, t_context, t_state_registry>
+    >
+{
+};
+
+//----------------------------------------------------------------
+
+/*
+    Current state : stack
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    std::variant of state types which provide these two functions.
+    Comment       : states are stored by value in the registry, and called without virtual calls.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_stacked_variant_combined_enter_exit
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_stacked_interface<t_state_id, t_state>,
+        state_manipulator_stacked_combined_interface<t_state_id, t_state, enter_exit_policy_variant_notify, t_context, t_state_registry>
+    >
+{
+};
+
+#endif
+
+//----------------------------------------------------------------
+/*
+    Current state : single, for each of many instances
+    Switching     : combined
+    Reactions     : call on_enter/on_exit functions of the state. The state in this case must be
+                    a pointer type which provides these two functions.
+    Comment       : all instances share one registry, and queued changes of all instances are
+                    processed by a single update() call.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_world_enter_exit
+    : public fsm_single_world<t_state_id, t_state, enter_exit_policy_notify, t_context, t_state_registry>
+{
+};
+
+//----------------------------------------------------------------
+/*
+    Current state : single
+    Switching     : immediate, and by events along transitions of a precompiled state graph
+    Reactions     : as defined by t_on_enter_exit_policy. States are 32-bit values stored in the graph,
+                    e.g. indices into a table of behaviours.
+    Comment       : the registry is read-only, and uses a blob attached with attach().
+*/
+template
+<
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void
+>
+class fsm_single_graph
+    : public fsm
+    <
+        graph_id,
+        graph_id,
+        state_container_single_interface<graph_id, graph_id>,
+        state_manipulator_single_graph_interface<t_on_enter_exit_policy, t_context>
+    >
+{
+};
+
+//----------------------------------------------------------------
+#if __cplusplus >= 202002L
+
+/*
+    Current state : single
+    Switching     : queued, by change_state() which returns an awaitable transition
+    Reactions     : call on_enter/on_exit functions of the state, which may be coroutines returning
+                    async_task. update() advances a suspended transition without waiting for it.
+    Comment       : requires C++20.
+*/
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_async
+    : public fsm
+    <
+        t_state_id,
+        t_state,
+        state_container_single_interface<t_state_id, t_state>,
+        state_manipulator_single_async_interface<t_state_id, t_state, enter_exit_policy_async, t_context, t_state_registry>
     >
 {
 };
 
+#endif
 //----------------------------------------------------------------
 }
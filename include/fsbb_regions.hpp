@@ -0,0 +1,264 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+
+/*
+    Building blocks for machines with orthogonal regions, i.e. several independent single-state
+    machines which are active at the same time, e.g. movement, weapon and emote of a character.
+
+    All regions share one registry and one buffer of queued changes of state, and one update()
+    call applies queued changes of all regions. Regions are identified by the index returned from
+    add_region().
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+// State containers ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state
+>
+struct state_container_regions_impl
+{
+      // Current state of every region, 0 if the region has not entered any state yet
+    std::vector<state_and_id<t_state_id, t_state>*> m_current_states;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state
+>
+class state_container_regions_interface
+{
+public:
+    typedef state_container_regions_impl<t_state_id, t_state> t_impl;
+
+    state_container_regions_interface( t_impl& impl ) : m_impl( impl ) {}
+
+    size_t get_regions_count() const { return m_impl.m_current_states.size(); }
+
+    t_state_id get_current_state_id( size_t region ) const
+    {
+        const state_and_id<t_state_id, t_state>* current_state = m_impl.m_current_states[region];
+        return current_state ? current_state->id : t_state_id();
+    }
+
+    const t_state get_current_state( size_t region ) const
+    {
+        const state_and_id<t_state_id, t_state>* current_state = m_impl.m_current_states[region];
+        return current_state ? current_state->state : 0;
+    }
+
+protected:
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_regions_immediate_impl
+{
+    typedef state_container_regions_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_regions_immediate_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : m_state_container_impl( state_container_impl )
+        , m_state_registry( state_registry )
+    {}
+
+    t_state_container_impl& m_state_container_impl;
+    t_state_registry& m_state_registry;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_regions_immediate_interface
+{
+public:
+    typedef state_manipulator_regions_immediate_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_regions_immediate_interface( t_impl& impl ) : m_impl( impl ) {}
+
+      // Adds a region which has no current state, and returns its index
+    size_t add_region()
+    {
+        m_impl.m_state_container_impl.m_current_states.push_back( 0 );
+        return m_impl.m_state_container_impl.m_current_states.size() - 1;
+    }
+
+    void reserve_regions( size_t count ) { m_impl.m_state_container_impl.m_current_states.reserve( count ); }
+
+    bool change_state_immediate( size_t region, t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        if ( region >= m_impl.m_state_container_impl.m_current_states.size() )
+            return false;
+
+        state_and_id<t_state_id, t_state>* new_state = m_impl.m_state_registry.find_state( id );
+        if ( new_state == 0 )
+            return false;
+
+        change_region_state( region, new_state, ctx );
+
+        return true;
+    }
+
+protected:
+    void change_region_state( size_t region, state_and_id<t_state_id, t_state>* new_state, context_holder<t_context>& ctx )
+    {
+        state_and_id<t_state_id, t_state> *& current_state = m_impl.m_state_container_impl.m_current_states[region];
+        if ( current_state != 0 )
+            t_on_enter_exit_policy::on_exit( *current_state, ctx );
+
+        current_state = new_state;
+
+        t_on_enter_exit_policy::on_enter( *current_state, ctx );
+    }
+
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_regions_combined_impl : public state_manipulator_regions_immediate_impl<t_state_id, t_state, t_state_registry>
+{
+    typedef state_container_regions_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_regions_combined_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_regions_immediate_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+    {}
+
+    struct queued_action
+    {
+        size_t region;
+        state_and_id<t_state_id, t_state>* state;
+    };
+
+      // Queued changes of all regions in order of queuing, and position of the change of every region in it
+    std::vector<queued_action> m_queued_actions;
+    std::vector<size_t> m_queued_positions;
+
+      // Changes being applied by update(), kept to reuse its memory
+    std::vector<queued_action> m_updated_actions;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_regions_combined_interface :
+    public state_manipulator_regions_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>
+{
+public:
+    typedef state_manipulator_regions_combined_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_regions_combined_interface( t_impl& impl )
+        : state_manipulator_regions_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
+        , m_combined_impl( impl )
+    {}
+
+    void reserve_regions( size_t count )
+    {
+        state_manipulator_regions_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>::reserve_regions( count );
+        m_combined_impl.m_queued_positions.reserve( count );
+        m_combined_impl.m_queued_actions.reserve( count );
+        m_combined_impl.m_updated_actions.reserve( count );
+    }
+
+      // Since each region has at most one queued change, queues grow here, and queuing never allocates memory
+    size_t add_region()
+    {
+        m_combined_impl.m_queued_positions.push_back( invalid_state_index );
+        if ( m_combined_impl.m_queued_actions.capacity() < m_combined_impl.m_queued_positions.size() )
+            reserve_regions( m_combined_impl.m_queued_positions.capacity() );
+        return state_manipulator_regions_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>::add_region();
+    }
+
+      // As with single-state queued manipulator, only the last queued change of state of each region is executed
+    bool queue_change_state( size_t region, t_state_id id )
+    {
+        if ( region >= m_combined_impl.m_queued_positions.size() )
+            return false;
+
+        state_and_id<t_state_id, t_state>* new_state = m_combined_impl.m_state_registry.find_state( id );
+        if ( new_state == 0 )
+            return false;
+
+        size_t& position = m_combined_impl.m_queued_positions[region];
+        if ( position == invalid_state_index )
+        {
+            typename t_impl::queued_action action;
+            action.region = region;
+            action.state = new_state;
+
+            position = m_combined_impl.m_queued_actions.size();
+            m_combined_impl.m_queued_actions.push_back( action );
+        }
+        else
+            m_combined_impl.m_queued_actions[position].state = new_state;
+
+        return true;
+    }
+
+      // Applies queued changes of all regions, in order in which regions were first queued.
+      // Changes queued by enter/exit functions are applied on the next update.
+    void update( context_holder<t_context> ctx )
+    {
+        std::vector<typename t_impl::queued_action>& actions = m_combined_impl.m_updated_actions;
+        actions.swap( m_combined_impl.m_queued_actions );
+
+        for ( size_t i = 0; i < actions.size(); ++i )
+            m_combined_impl.m_queued_positions[actions[i].region] = invalid_state_index;
+
+        for ( size_t i = 0; i < actions.size(); ++i )
+            this->change_region_state( actions[i].region, actions[i].state, ctx );
+
+        actions.clear();
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+protected:
+    t_impl& m_combined_impl;
+};
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "fsbb_stacked.hpp"
+
+/*
+    Rollback of stacked machines, for netcode which resimulates the last few frames on misprediction.
+
+    Frames are counted by a rollback_clock, which can be shared by any number of machines, so
+    checkpointing a frame is a single increment for all of them. A machine saves its stack and queue
+    only when it is changed for the first time after a checkpoint (copy-on-write), into a ring of the
+    last t_frames saved frames, whose memory is reused. Machines which did not change during a frame
+    cost nothing.
+
+    rewind() restores the stack and the queue of a checkpointed frame, without calling enter/exit
+    functions, and forgets all later frames.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+class rollback_clock
+{
+public:
+    rollback_clock() : m_frame( 0 ) {}
+
+    size_t get_frame() const { return m_frame; }
+
+      // Marks the current state of all machines which use this clock as the state of the frame.
+      // Frames must increase, except after rewind().
+    void checkpoint( size_t frame ) { m_frame = frame; }
+
+      // Should be called when all machines which use this clock were rewound to the frame
+    void rewind( size_t frame ) { m_frame = frame; }
+
+private:
+    size_t m_frame;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    size_t t_frames = 8,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
+>
+struct state_manipulator_stacked_rollback_impl : public state_manipulator_stacked_combined_impl<t_state_id, t_state, t_state_registry, t_storage_policy>
+{
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
+    typedef typename state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_state_registry, t_storage_policy>::queued_actions_vector queued_actions_vector;
+
+    state_manipulator_stacked_rollback_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_stacked_combined_impl<t_state_id, t_state, t_state_registry, t_storage_policy>( state_container_impl, state_registry )
+        , m_rollback_container_impl( state_container_impl )
+        , m_clock( &m_own_clock )
+        , m_first( 0 )
+        , m_count( 0 )
+        , m_oldest_frame( 0 )
+    {}
+
+      // Stack and queue as they were at the checkpoint of the frame
+    struct saved_frame
+    {
+        size_t m_frame;
+        t_state_container_impl m_container;
+        queued_actions_vector m_queued_actions;
+    };
+
+      // Combined impl has this reference in both of its bases
+    t_state_container_impl& m_rollback_container_impl;
+
+    rollback_clock m_own_clock;
+    rollback_clock* m_clock;
+
+      // Ring of saved frames, from the oldest one
+    saved_frame m_saved_frames[t_frames];
+    size_t m_first;
+    size_t m_count;
+
+      // Frames before this one can not be restored anymore
+    size_t m_oldest_frame;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    size_t t_frames = 8,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
+>
+class state_manipulator_stacked_rollback_interface :
+    public state_manipulator_stacked_combined_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>
+{
+public:
+    typedef state_manipulator_stacked_combined_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy> t_combined_interface;
+    typedef state_manipulator_stacked_rollback_impl<t_state_id, t_state, t_frames, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
+
+    state_manipulator_stacked_rollback_interface( t_impl& impl )
+        : t_combined_interface( impl )
+        , m_rollback_impl( impl )
+    {}
+
+      // Uses a clock shared with other machines instead of the own one. Forgets saved frames.
+    void set_rollback_clock( rollback_clock& clock )
+    {
+        m_rollback_impl.m_clock = &clock;
+        m_rollback_impl.m_count = 0;
+        m_rollback_impl.m_oldest_frame = clock.get_frame();
+    }
+
+    rollback_clock& get_rollback_clock() { return *m_rollback_impl.m_clock; }
+
+      // Same as get_rollback_clock().checkpoint( frame )
+    void checkpoint( size_t frame ) { m_rollback_impl.m_clock->checkpoint( frame ); }
+
+      // Restores the stack and the queue of the checkpointed frame, and forgets later frames. Returns false
+      // if the frame is later than the current one, or older than the oldest saved one.
+      // Does not change the clock, which is shared with other machines.
+    bool rewind( size_t frame )
+    {
+        if ( frame < m_rollback_impl.m_oldest_frame || frame > m_rollback_impl.m_clock->get_frame() )
+            return false;
+
+          // The state of the frame is the state saved at the first change after it, if the machine changed since
+        size_t count = m_rollback_impl.m_count;
+        while ( count > 0 && get_saved_frame( count - 1 ).m_frame >= frame )
+            --count;
+
+        if ( count < m_rollback_impl.m_count )
+        {
+            typename t_impl::saved_frame& saved = get_saved_frame( count );
+            m_rollback_impl.m_rollback_container_impl = saved.m_container;
+            m_rollback_impl.m_queued_actions = saved.m_queued_actions;
+            m_rollback_impl.m_count = count;
+        }
+
+        return true;
+    }
+
+    size_t get_saved_frames_count() const { return m_rollback_impl.m_count; }
+
+    bool replace_top_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::replace_top_state( id, ctx );
+    }
+
+    bool push_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::push_state( id, ctx );
+    }
+
+    bool insert_state( t_state_id id, size_t position, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::insert_state( id, position, ctx );
+    }
+
+    bool pop_state( context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::pop_state( ctx );
+    }
+
+    bool remove_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::remove_state( id, ctx );
+    }
+
+    bool remove_state_and_all_above( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        return t_combined_interface::remove_state_and_all_above( id, ctx );
+    }
+
+    void remove_all_states( context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        save_frame();
+        t_combined_interface::remove_all_states( ctx );
+    }
+
+    bool queue_push_state( t_state_id id )
+    {
+        save_frame();
+        return t_combined_interface::queue_push_state( id );
+    }
+
+    bool queue_pop_state()
+    {
+        save_frame();
+        return t_combined_interface::queue_pop_state();
+    }
+
+    bool queue_remove_state( t_state_id id )
+    {
+        save_frame();
+        return t_combined_interface::queue_remove_state( id );
+    }
+
+    bool queue_remove_state_and_all_above( t_state_id id )
+    {
+        save_frame();
+        return t_combined_interface::queue_remove_state_and_all_above( id );
+    }
+
+    bool queue_remove_all_states()
+    {
+        save_frame();
+        return t_combined_interface::queue_remove_all_states();
+    }
+
+      // Does not save the frame when nothing is queued, since then update() changes nothing
+    void update( context_holder<t_context> ctx )
+    {
+        if ( m_rollback_impl.m_queued_actions.empty() )
+            return;
+
+        save_frame();
+        t_combined_interface::update( ctx );
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+protected:
+    typename t_impl::saved_frame& get_saved_frame( size_t i ) { return m_rollback_impl.m_saved_frames[( m_rollback_impl.m_first + i ) % t_frames]; }
+
+      // Saves the stack and the queue before the first change after the checkpoint
+    void save_frame()
+    {
+        const size_t frame = m_rollback_impl.m_clock->get_frame();
+        if ( m_rollback_impl.m_count > 0 && get_saved_frame( m_rollback_impl.m_count - 1 ).m_frame == frame )
+            return;
+
+        if ( m_rollback_impl.m_count == t_frames )
+        {
+            m_rollback_impl.m_oldest_frame = get_saved_frame( 0 ).m_frame + 1;
+            m_rollback_impl.m_first = ( m_rollback_impl.m_first + 1 ) % t_frames;
+            --m_rollback_impl.m_count;
+        }
+
+        typename t_impl::saved_frame& saved = get_saved_frame( m_rollback_impl.m_count );
+        saved.m_frame = frame;
+        saved.m_container = m_rollback_impl.m_rollback_container_impl;
+        saved.m_queued_actions = m_rollback_impl.m_queued_actions;
+        ++m_rollback_impl.m_count;
+    }
+
+    t_impl& m_rollback_impl;
+};
+
+//----------------------------------------------------------------
+}
@@ -46,7 +46,8 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 struct state_manipulator_single_immediate_impl
 {
@@ -54,14 +55,14 @@ struct state_manipulator_single_immediate_impl
     state_manipulator_single_immediate_impl
         ( 
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
         : m_state_container_impl( state_container_impl ) 
         , m_state_registry( state_registry )
     {}
     
     t_state_container_impl& m_state_container_impl;
-    state_registry<t_state_id, t_state>& m_state_registry;
+    t_state_registry& m_state_registry;
 };
 
 template
@@ -69,12 +70,14 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class state_manipulator_single_immediate_interface
 {
 public:
-    typedef state_manipulator_single_immediate_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_single_immediate_interface( t_impl& impl ) : m_impl( impl ) {}
 
@@ -104,16 +107,17 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 struct state_manipulator_single_queued_impl_base
 {
     typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
     state_manipulator_single_queued_impl_base
         ( 
-            state_manipulator_single_immediate_impl<t_state_id, t_state>& immediate_impl,
+            state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>& immediate_impl,
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
         : m_immediate_impl( immediate_impl )
         , m_state_container_impl( state_container_impl ) 
@@ -121,9 +125,9 @@ struct state_manipulator_single_queued_impl_base
         , m_next_state( 0 )
     {}
     
-    state_manipulator_single_immediate_impl<t_state_id, t_state>& m_immediate_impl;
+    state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>& m_immediate_impl;
     t_state_container_impl& m_state_container_impl;
-    state_registry<t_state_id, t_state>& m_state_registry;
+    t_state_registry& m_state_registry;
     state_and_id<t_state_id, t_state> *m_next_state;
 };
 
@@ -132,15 +136,17 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class state_manipulator_single_queued_interface_base
 {
 public:
-    typedef state_manipulator_single_queued_impl_base<t_state_id, t_state> t_impl;
+    typedef state_manipulator_single_queued_impl_base<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_single_queued_interface_base(
-        state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>& immediate_interface,
+        state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>& immediate_interface,
         t_impl& impl 
     ) 
         : m_immediate_interface( immediate_interface )
@@ -177,7 +183,7 @@ public:
 
 protected:
     t_impl& m_impl;
-    state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>& m_immediate_interface;
+    state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>& m_immediate_interface;
 };
 
 //----------------------------------------------------------------
@@ -185,21 +191,22 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
-struct state_manipulator_single_queued_impl : public state_manipulator_single_queued_impl_base<t_state_id, t_state>
+struct state_manipulator_single_queued_impl : public state_manipulator_single_queued_impl_base<t_state_id, t_state, t_state_registry>
 {
     typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
     state_manipulator_single_queued_impl
         (
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
-        : state_manipulator_single_queued_impl_base<t_state_id, t_state>( m_immediate_impl, state_container_impl, state_registry )
+        : state_manipulator_single_queued_impl_base<t_state_id, t_state, t_state_registry>( m_immediate_impl, state_container_impl, state_registry )
         , m_immediate_impl( state_container_impl, state_registry )
     {}
 
-    state_manipulator_single_immediate_impl<t_state_id, t_state> m_immediate_impl;
+    state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry> m_immediate_impl;
 };
 
 template
@@ -207,20 +214,22 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
-class state_manipulator_single_queued_interface : public state_manipulator_single_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context>
+class state_manipulator_single_queued_interface : public state_manipulator_single_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>
 {
 public:
-    typedef state_manipulator_single_queued_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_single_queued_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_single_queued_interface( t_impl& impl ) 
-        : state_manipulator_single_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context>( m_immediate_interface, impl )
+        : state_manipulator_single_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( m_immediate_interface, impl )
         , m_immediate_interface( impl.m_immediate_impl )
     {}
 
 protected:
-    state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context> m_immediate_interface;
+    state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry> m_immediate_interface;
 };
 
 //----------------------------------------------------------------
@@ -228,20 +237,21 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 struct state_manipulator_single_combined_impl : 
-    public state_manipulator_single_immediate_impl<t_state_id, t_state>,
-    public state_manipulator_single_queued_impl<t_state_id, t_state>
+    public state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>,
+    public state_manipulator_single_queued_impl<t_state_id, t_state, t_state_registry>
 {
     typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
     state_manipulator_single_combined_impl
         ( 
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
-        : state_manipulator_single_immediate_impl<t_state_id, t_state>( state_container_impl, state_registry )
-        , state_manipulator_single_queued_impl<t_state_id, t_state>( state_container_impl, state_registry )
+        : state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+        , state_manipulator_single_queued_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
     {}
 };
 
@@ -250,18 +260,20 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
 >
 class state_manipulator_single_combined_interface :
-    public state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>,
-    public state_manipulator_single_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>
+    public state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>,
+    public state_manipulator_single_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>
 {
 public:
-    typedef state_manipulator_single_combined_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_single_combined_impl<t_state_id, t_state, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_single_combined_interface( t_impl& impl ) 
-        : state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>( impl )
-        , state_manipulator_single_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>( impl )
+        : state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
+        , state_manipulator_single_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
     {}
 };
 
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "fsbb_single.hpp"
+#include "fsbb_stacked.hpp"
+
+/*
+    Binary snapshots of the runtime state of machines, for save games, rollback and migration of
+    machines between servers.
+
+    Current and queued states are stored as registry indices rather than pointers, so a snapshot can be
+    restored into another machine (or another process), as long as its states were registered in the
+    same order. Restoring a snapshot does not call enter/exit functions: states are just made current.
+
+    Snapshots of many machines are written one after another into one contiguous buffer, so saving
+    does not allocate memory per machine, and restoring does not allocate at all, once the machines
+    have grown their stacks and queues.
+
+    Format: every value is a little-endian 32-bit unsigned integer, except actions, which are single bytes.
+    - single-state container: index of the current state;
+    - single-state queued manipulator: index of the queued state;
+    - stacked-state container: number of states, index of every state from the bottom;
+    - stacked-state queued manipulator: number of actions, action and state index of every action.
+    Invalid (none) index is 0xFFFFFFFF.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+class snapshot_writer
+{
+public:
+      // Appends data to the end of the buffer
+    snapshot_writer( std::vector<unsigned char>& buffer ) : m_buffer( buffer ) {}
+
+    void write_byte( unsigned char value ) { m_buffer.push_back( value ); }
+
+    void write_count( size_t value )
+    {
+        const unsigned char bytes[4] = { (unsigned char)value, (unsigned char)( value >> 8 ), (unsigned char)( value >> 16 ), (unsigned char)( value >> 24 ) };
+        m_buffer.insert( m_buffer.end(), bytes, bytes + 4 );
+    }
+
+    void write_index( size_t index ) { write_count( index != invalid_state_index ? index : 0xFFFFFFFF ); }
+
+private:
+    std::vector<unsigned char>& m_buffer;
+};
+
+//----------------------------------------------------------------
+
+  // Reads data written by snapshot_writer. Every read fails when there is not enough data left.
+class snapshot_reader
+{
+public:
+    snapshot_reader( const unsigned char* data, size_t size ) : m_data( data ), m_size( size ), m_position( 0 ) {}
+
+    bool read_byte( unsigned char& value )
+    {
+        if ( m_position + 1 > m_size )
+            return false;
+
+        value = m_data[m_position++];
+        return true;
+    }
+
+    bool read_count( size_t& value )
+    {
+        if ( m_position + 4 > m_size )
+            return false;
+
+        value = 0;
+        for ( size_t i = 0; i < 4; ++i )
+            value |= (size_t)m_data[m_position++] << ( i * 8 );
+        return true;
+    }
+
+      // Fails if the index is neither invalid nor less than states_count
+    bool read_index( size_t& index, size_t states_count )
+    {
+        if ( !read_count( index ) )
+            return false;
+
+        if ( index == 0xFFFFFFFF )
+            index = invalid_state_index;
+
+        return index == invalid_state_index || index < states_count;
+    }
+
+    size_t get_position() const { return m_position; }
+    size_t get_remaining() const { return m_size - m_position; }
+
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_position;
+};
+
+//----------------------------------------------------------------
+// State containers
+//----------------------------------------------------------------
+
+template<typename t_state_registry, typename t_state_id, typename t_state>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_container_single_impl<t_state_id, t_state>& impl )
+{
+    writer.write_index( impl.m_current_state ? registry.get_state_index( impl.m_current_state ) : invalid_state_index );
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_container_single_impl<t_state_id, t_state>& impl )
+{
+    size_t index;
+    if ( !reader.read_index( index, registry.get_states_count() ) )
+        return false;
+
+    impl.m_current_state = index != invalid_state_index ? &registry.get_state( index ) : 0;
+    return true;
+}
+
+//----------------------------------------------------------------
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_storage_policy>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_container_stacked_impl<t_state_id, t_state, t_storage_policy>& impl )
+{
+    writer.write_count( impl.m_current_states.size() );
+    for ( size_t i = 0; i < impl.m_current_states.size(); ++i )
+        writer.write_index( registry.get_state_index( impl.m_current_states[i] ) );
+}
+
+  // Checks the whole stack before changing it, so the stack is kept if the snapshot is invalid.
+  // A state may be in the stack only once, so snapshots with repeated states are invalid.
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_storage_policy>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_container_stacked_impl<t_state_id, t_state, t_storage_policy>& impl )
+{
+    size_t count;
+    if ( !reader.read_count( count ) || count > impl.m_current_states.max_size() || count * 4 > reader.get_remaining() )
+        return false;
+
+    scratch_vector<std::vector<size_t> > scratch;
+    std::vector<size_t>& indices = scratch.get();
+    for ( size_t i = 0; i < count; ++i )
+    {
+        size_t index;
+        if ( !reader.read_index( index, registry.get_states_count() ) || index == invalid_state_index )
+            return false;
+
+        if ( std::find( indices.begin(), indices.end(), index ) != indices.end() )
+            return false;
+
+        indices.push_back( index );
+    }
+
+    impl.m_position_index.erased( 0, impl.m_current_states.size() );
+    impl.m_current_states.clear();
+    impl.m_position_index.reserve_slots( registry.get_states_count() );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        impl.m_current_states.push_back( &registry.get_state( indices[i] ) );
+        impl.m_position_index.inserted( i, indices[i] );
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------
+// State manipulators
+//----------------------------------------------------------------
+
+  // Immediate manipulators have no state of their own
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_single_immediate_impl<t_state_id, t_state, t_manipulator_registry>& impl ) {}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_single_immediate_impl<t_state_id, t_state, t_manipulator_registry>& impl ) { return true; }
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_single_queued_impl_base<t_state_id, t_state, t_manipulator_registry>& impl )
+{
+    writer.write_index( impl.m_next_state ? registry.get_state_index( impl.m_next_state ) : invalid_state_index );
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_single_queued_impl_base<t_state_id, t_state, t_manipulator_registry>& impl )
+{
+    size_t index;
+    if ( !reader.read_index( index, registry.get_states_count() ) )
+        return false;
+
+    impl.m_next_state = index != invalid_state_index ? &registry.get_state( index ) : 0;
+    return true;
+}
+
+  // Combined manipulator derives from both of the above, so it needs its own overload
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_single_combined_impl<t_state_id, t_state, t_manipulator_registry>& impl )
+{
+    snapshot_save( writer, registry, static_cast<const state_manipulator_single_queued_impl_base<t_state_id, t_state, t_manipulator_registry>&>( impl ) );
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_single_combined_impl<t_state_id, t_state, t_manipulator_registry>& impl )
+{
+    return snapshot_restore( reader, registry, static_cast<state_manipulator_single_queued_impl_base<t_state_id, t_state, t_manipulator_registry>&>( impl ) );
+}
+
+//----------------------------------------------------------------
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl ) {}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl ) { return true; }
+
+  // Queued actions keep state IDs, which are stored as indices too. Actions with IDs which are not
+  // registered do nothing when they are applied, so they are not stored.
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl )
+{
+    typedef typename state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>::queued_action queued_action;
+
+    size_t count = 0;
+    for ( size_t i = 0; i < impl.m_queued_actions.size(); ++i )
+    {
+        const queued_action& action = impl.m_queued_actions[i];
+        if ( action.m_action == queued_action::pop || action.m_action == queued_action::remove_all || registry.find_state_index( action.m_state_id ) != invalid_state_index )
+            ++count;
+    }
+
+    writer.write_count( count );
+    for ( size_t i = 0; i < impl.m_queued_actions.size(); ++i )
+    {
+        const queued_action& action = impl.m_queued_actions[i];
+        if ( action.m_action == queued_action::pop || action.m_action == queued_action::remove_all )
+        {
+            writer.write_byte( (unsigned char)action.m_action );
+            writer.write_index( invalid_state_index );
+        }
+        else
+        {
+            const size_t index = registry.find_state_index( action.m_state_id );
+            if ( index == invalid_state_index )
+                continue;
+
+            writer.write_byte( (unsigned char)action.m_action );
+            writer.write_index( index );
+        }
+    }
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl )
+{
+    typedef typename state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>::queued_action queued_action;
+
+    size_t count;
+    if ( !reader.read_count( count ) || count > impl.m_queued_actions.max_size() || count * 5 > reader.get_remaining() )
+        return false;
+
+    snapshot_reader check = reader;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        unsigned char action;
+        size_t index;
+        if ( !check.read_byte( action ) || action > queued_action::remove_all || !check.read_index( index, registry.get_states_count() ) )
+            return false;
+
+        const bool has_state = action != queued_action::pop && action != queued_action::remove_all;
+        if ( has_state != ( index != invalid_state_index ) )
+            return false;
+    }
+
+    impl.m_queued_actions.clear();
+    for ( size_t i = 0; i < count; ++i )
+    {
+          // The check above has read the same data, so this never fails
+        unsigned char action = 0;
+        size_t index = invalid_state_index;
+        if ( !reader.read_byte( action ) || !reader.read_index( index, registry.get_states_count() ) )
+        {
+            impl.m_queued_actions.clear();
+            return false;
+        }
+
+        impl.m_queued_actions.push_back( queued_action( (typename queued_action::action_id)action, index != invalid_state_index ? registry.get_state( index ).id : t_state_id() ) );
+    }
+
+    return true;
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+void snapshot_save( snapshot_writer& writer, const t_state_registry& registry, const state_manipulator_stacked_combined_impl<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl )
+{
+    snapshot_save( writer, registry, static_cast<const state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>&>( impl ) );
+}
+
+template<typename t_state_registry, typename t_state_id, typename t_state, typename t_manipulator_registry, typename t_storage_policy>
+bool snapshot_restore( snapshot_reader& reader, t_state_registry& registry, state_manipulator_stacked_combined_impl<t_state_id, t_state, t_manipulator_registry, t_storage_policy>& impl )
+{
+    return snapshot_restore( reader, registry, static_cast<state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_manipulator_registry, t_storage_policy>&>( impl ) );
+}
+
+//----------------------------------------------------------------
+// Many machines
+//----------------------------------------------------------------
+
+  // Appends a header and snapshots of machines in range [first; last) to the buffer
+template<typename t_iterator>
+void save_snapshots( std::vector<unsigned char>& buffer, t_iterator first, t_iterator last )
+{
+    snapshot_writer writer( buffer );
+    writer.write_byte( 'F' );
+    writer.write_byte( 'S' );
+    writer.write_byte( 'B' );
+    writer.write_byte( 1 );
+    writer.write_count( std::distance( first, last ) );
+
+    for ( ; first != last; ++first )
+        first->save_snapshot( writer );
+}
+
+  // Restores machines in range [first; last) from a buffer written by save_snapshots() for the same
+  // number of machines. Returns false if the data is invalid, in which case some machines may have been
+  // restored, and others kept their state.
+template<typename t_iterator>
+bool restore_snapshots( const unsigned char* data, size_t size, t_iterator first, t_iterator last )
+{
+    snapshot_reader reader( data, size );
+    unsigned char header[4];
+    size_t count;
+    for ( size_t i = 0; i < 4; ++i )
+        if ( !reader.read_byte( header[i] ) )
+            return false;
+
+    if ( header[0] != 'F' || header[1] != 'S' || header[2] != 'B' || header[3] != 1 )
+        return false;
+
+    if ( !reader.read_count( count ) || count != (size_t)std::distance( first, last ) )
+        return false;
+
+    for ( ; first != last; ++first )
+        if ( !first->restore_snapshot( reader ) )
+            return false;
+
+    return reader.get_remaining() == 0;
+}
+
+//----------------------------------------------------------------
+}
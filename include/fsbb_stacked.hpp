@@ -4,6 +4,139 @@
 
 namespace fsbb
 {
+//----------------------------------------------------------------
+// Position indices
+//----------------------------------------------------------------
+
+/*
+    Finds states in the stack by scanning it.
+*/
+struct stacked_position_index_none
+{
+    static const bool uses_slots = false;
+
+    template<typename t_stack, typename t_state_id>
+    size_t find( const t_stack& stack, size_t slot, const t_state_id& id ) const
+    {
+        for ( size_t i = 0; i < stack.size(); ++i )
+            if ( stack[i]->id == id )
+                return i;
+
+        return invalid_state_index;
+    }
+
+    void reserve_slots( size_t count ) {}
+    void inserted( size_t position, size_t slot ) {}
+    void erased( size_t first, size_t last ) {}
+};
+
+/*
+    Keeps position in the stack of every registered state, indexed by its registry slot, so that
+    finding a state costs a registry lookup and an array read. Inserting or erasing a state updates
+    positions of states above it, which costs about the same as moving them in the stack.
+*/
+template<typename t_slots_vector>
+class stacked_position_index
+{
+public:
+    static const bool uses_slots = true;
+
+    template<typename t_stack, typename t_state_id>
+    size_t find( const t_stack& stack, size_t slot, const t_state_id& id ) const
+    {
+        return slot < m_positions.size() ? m_positions[slot] : invalid_state_index;
+    }
+
+      // Positions are kept for all registered states, so that pushing states does not grow the array one by one
+    void reserve_slots( size_t count )
+    {
+        if ( count > m_positions.size() )
+            m_positions.resize( count, invalid_state_index );
+    }
+
+    void inserted( size_t position, size_t slot )
+    {
+        if ( slot >= m_positions.size() )
+            m_positions.resize( slot + 1, invalid_state_index );
+
+        m_slots.insert( m_slots.begin() + position, slot );
+        for ( size_t i = position; i < m_slots.size(); ++i )
+            m_positions[m_slots[i]] = i;
+    }
+
+    void erased( size_t first, size_t last )
+    {
+        for ( size_t i = first; i < last; ++i )
+            m_positions[m_slots[i]] = invalid_state_index;
+
+        m_slots.erase( m_slots.begin() + first, m_slots.begin() + last );
+        for ( size_t i = first; i < m_slots.size(); ++i )
+            m_positions[m_slots[i]] = i;
+    }
+
+private:
+    std::vector<size_t> m_positions;
+    t_slots_vector m_slots;
+};
+
+//----------------------------------------------------------------
+// Storage policies
+//----------------------------------------------------------------
+
+/*
+    Stores the stack of states and the queue of actions in std::vector. Vectors keep their memory,
+    so after they grow to the largest size used, updates do not allocate memory.
+*/
+struct stacked_storage_dynamic
+{
+    template<typename T>
+    struct stack { typedef std::vector<T> type; };
+
+    template<typename T>
+    struct queue { typedef std::vector<T> type; };
+
+    typedef stacked_position_index_none position_index;
+};
+
+/*
+    Stores at most t_stack_capacity states in the stack and t_queue_capacity queued actions inside
+    the machine itself, so the machine never allocates memory. Pushing or inserting a state into a
+    full stack fails, and so does queueing an action when the queue is full.
+*/
+template<size_t t_stack_capacity, size_t t_queue_capacity>
+struct stacked_storage_fixed
+{
+    template<typename T>
+    struct stack { typedef fixed_vector<T, t_stack_capacity> type; };
+
+    template<typename T>
+    struct queue { typedef fixed_vector<T, t_queue_capacity> type; };
+
+    typedef stacked_position_index_none position_index;
+};
+
+/*
+    Stores the stack and the queue as t_storage_policy does, and also keeps the position of every
+    state in the stack, so that checking if a state is in the stack, and finding it for removal,
+    does not scan the stack. Best for deep stacks with frequent removals from the middle.
+    Lookups use the registry, so a registry with hashed or direct lookup should be used, too.
+
+    Positions are stored in std::vector even with stacked_storage_fixed, since the number of registered
+    states is not limited. The vector is allocated for all registered states on the first insertion of
+    a state, and again only after more states are registered, so it does not allocate in steady state.
+*/
+template<typename t_storage_policy = stacked_storage_dynamic>
+struct stacked_storage_indexed
+{
+    template<typename T>
+    struct stack { typedef typename t_storage_policy::template stack<T>::type type; };
+
+    template<typename T>
+    struct queue { typedef typename t_storage_policy::template queue<T>::type type; };
+
+    typedef stacked_position_index<typename t_storage_policy::template stack<size_t>::type> position_index;
+};
+
 //----------------------------------------------------------------
 // State containers ( impl; interface )
 //----------------------------------------------------------------
@@ -11,55 +144,59 @@ namespace fsbb
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 struct state_container_stacked_impl
 {
-    typedef std::vector<state_and_id<t_state_id, t_state>*> current_states_vector;
+    typedef typename t_storage_policy::template stack<state_and_id<t_state_id, t_state>*>::type current_states_vector;
+    typedef typename t_storage_policy::position_index position_index;
 
     current_states_vector m_current_states;
+    position_index m_position_index;
 };
 
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 class state_container_stacked_interface
 {
 public:
-    typedef state_container_stacked_impl<t_state_id, t_state> t_impl;
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_impl;
     typedef typename t_impl::current_states_vector current_states_vector;
 
     state_container_stacked_interface( t_impl& impl ) : m_impl( impl ) {}
 
     t_state_id get_top_state_id() const 
     { 
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_current_states;
         return !current_states.empty() ? current_states.back()->id : t_state_id(); 
     }
     t_state get_top_state() const
     { 
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_current_states;
         return !current_states.empty() ? current_states.back()->state : 0; 
     }
 
     template<typename t_functor>
     void for_all_states_from_bottom( t_functor& f )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_current_states;
 
         for( size_t i = 0; i < current_states.size(); ++i )
-            f( current_states[i].id, current_states[i].state );
+            f( current_states[i]->id, current_states[i]->state );
     }
 
     template<typename t_functor>
     void for_all_states_from_top( t_functor& f )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_current_states;
 
         for( int i = (int)current_states.size()-1; i >= 0; --i )
-            f( current_states[i].id, current_states[i].state );
+            f( current_states[i]->id, current_states[i]->state );
     }
 
     const current_states_vector& get_current_states() const { return m_impl.m_current_states; }
@@ -75,22 +212,24 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 struct state_manipulator_stacked_immediate_impl
 {
-    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
     state_manipulator_stacked_immediate_impl
         ( 
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
         : m_state_container_impl( state_container_impl ) 
         , m_state_registry( state_registry )
     {}
     
     t_state_container_impl& m_state_container_impl;
-    state_registry<t_state_id, t_state>& m_state_registry;
+    t_state_registry& m_state_registry;
 };
 
 template
@@ -98,12 +237,15 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 class state_manipulator_stacked_immediate_interface
 {
 public:
-    typedef state_manipulator_stacked_immediate_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_stacked_immediate_interface( t_impl& impl ) : m_impl( impl ) {}
 
@@ -115,30 +257,28 @@ public:
 
     bool push_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
 
         return insert_state( id, current_states.size(), ctx );
     }
 
     bool insert_state( t_state_id id, size_t position, context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
-        if ( current_states.begin() + position > current_states.end() )
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        if ( position > current_states.size() || current_states.size() >= current_states.max_size() )
             return false;
 
-        state_and_id<t_state_id, t_state>* new_state = m_impl.m_state_registry.find_state( id );
-        if ( new_state == 0 )
+        const size_t slot = m_impl.m_state_registry.find_state_index( id );
+        if ( slot == invalid_state_index )
             return false;
 
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector::iterator iter;
-        for( iter = current_states.begin(); iter != current_states.end(); ++iter )
-            if ( (*iter)->id == id )
-                break;
-
-        if ( iter != current_states.end() )
+        if ( m_impl.m_state_container_impl.m_position_index.find( current_states, slot, id ) != invalid_state_index )
             return false;
 
+        state_and_id<t_state_id, t_state>* new_state = &m_impl.m_state_registry.get_state( slot );
+        m_impl.m_state_container_impl.m_position_index.reserve_slots( m_impl.m_state_registry.get_states_count() );
         current_states.insert( current_states.begin() + position, new_state );
+        m_impl.m_state_container_impl.m_position_index.inserted( position, slot );
         t_on_enter_exit_policy::on_enter( *new_state, ctx );
 
         return true;
@@ -146,104 +286,162 @@ public:
 
     bool pop_state( context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
 
         if ( current_states.empty() )
             return false;
 
-        return remove_state( current_states.back()->id, ctx );
+        state_and_id<t_state_id, t_state>* removed_state = current_states.back();
+        current_states.pop_back();
+        m_impl.m_state_container_impl.m_position_index.erased( current_states.size(), current_states.size() + 1 );
+        t_on_enter_exit_policy::on_exit( *removed_state, ctx );
+
+        return true;
     }
 
     bool remove_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
 
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector::iterator iter;
-        for( iter = current_states.begin(); iter != current_states.end(); ++iter )
-            if ( (*iter)->id == id )
-                break;
-
-        if ( iter == current_states.end() )
+        const size_t position = get_state_position( id );
+        if ( position == invalid_state_index )
             return false;
 
-        state_and_id<t_state_id, t_state> removed_state = **iter;        
-        current_states.erase( iter );
-        t_on_enter_exit_policy::on_exit( removed_state, ctx );
+        state_and_id<t_state_id, t_state>* removed_state = current_states[position];
+        current_states.erase( current_states.begin() + position );
+        m_impl.m_state_container_impl.m_position_index.erased( position, position + 1 );
+        t_on_enter_exit_policy::on_exit( *removed_state, ctx );
 
         return true;        
     }
 
     bool remove_state_and_all_above( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
 
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector::iterator iter;
-        for( iter = current_states.begin(); iter != current_states.end(); ++iter )
-            if ( (*iter)->id == id )
-                break;
-
-        if ( iter == current_states.end() )
+        const size_t position = get_state_position( id );
+        if ( position == invalid_state_index )
             return false;
 
-        for( typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector::reverse_iterator riter = current_states.rbegin(); riter.base() != iter; ++riter )
-            t_on_enter_exit_policy::on_exit( *(*riter), ctx );
+        for( size_t i = current_states.size(); i-- > position; )
+            t_on_enter_exit_policy::on_exit( *current_states[i], ctx );
 
-        current_states.erase( iter, current_states.end() );
+        m_impl.m_state_container_impl.m_position_index.erased( position, current_states.size() );
+        current_states.erase( current_states.begin() + position, current_states.end() );
 
         return true;
     }
 
     void remove_all_states( context_holder<t_context> ctx = context_holder<t_context>() )
     {
-        typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+
+          // States present at the start are removed from the top down, even if on_exit adds or removes
+          // states. States added by on_exit stay, and states it already removed are skipped.
+        scratch_vector<typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector> scratch;
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector& states_to_remove = scratch.get();
+        for ( size_t i = 0; i < current_states.size(); ++i )
+            states_to_remove.push_back( current_states[i] );
+
+        for ( size_t i = states_to_remove.size(); i-- > 0; )
+        {
+            if ( !current_states.empty() && current_states.back() == states_to_remove[i] )
+                pop_state( ctx );
+            else
+                remove_state( states_to_remove[i]->id, ctx );
+        }
+    }
+
+      // Returns position of the state in the stack (0 is the bottom), or invalid_state_index if it is not in the stack
+    size_t get_state_position( t_state_id id ) const
+    {
+        typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::position_index& position_index = m_impl.m_state_container_impl.m_position_index;
 
-        std::vector<t_state_id> states_to_remove;
-        for ( typename state_container_stacked_impl<t_state_id, t_state>::current_states_vector::reverse_iterator iter = current_states.rbegin(); iter != current_states.rend(); ++iter )
-            states_to_remove.push_back( (*iter)->id );
+        const size_t slot = position_index.uses_slots ? m_impl.m_state_registry.find_state_index( id ) : invalid_state_index;
+        if ( position_index.uses_slots && slot == invalid_state_index )
+            return invalid_state_index;
 
-        for ( size_t i = 0; i < states_to_remove.size(); ++i )
-            remove_state( states_to_remove[i], ctx );
+        return position_index.find( m_impl.m_state_container_impl.m_current_states, slot, id );
     }
 
+    bool is_state_in_stack( t_state_id id ) const { return get_state_position( id ) != invalid_state_index; }
+
 protected:
     t_impl& m_impl;
 };
 
+//----------------------------------------------------------------
+
+  // Executes a single queued action using immediate interface. Shared by all queued stacked manipulators.
+template<typename t_immediate_interface, typename t_queued_action, typename t_context>
+void apply_queued_action( t_immediate_interface& immediate_interface, const t_queued_action& action, context_holder<t_context>& ctx )
+{
+    switch( action.m_action )
+    {
+        case t_queued_action::push:
+            immediate_interface.push_state( action.m_state_id, ctx );
+            break;
+
+        case t_queued_action::pop:
+            immediate_interface.pop_state( ctx );
+            break;
+
+        case t_queued_action::remove:
+            immediate_interface.remove_state( action.m_state_id, ctx );
+            break;
+
+        case t_queued_action::remove_and_above:
+            immediate_interface.remove_state_and_all_above( action.m_state_id, ctx );
+            break;
+
+        case t_queued_action::remove_all:
+            immediate_interface.remove_all_states( ctx );
+            break;
+    }
+}
+
 //----------------------------------------------------------------
 
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 struct state_manipulator_stacked_queued_impl_base
 {
-    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
     state_manipulator_stacked_queued_impl_base
         ( 
-            state_manipulator_stacked_immediate_impl<t_state_id, t_state>& immediate_impl,
+            state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy>& immediate_impl,
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
         : m_immediate_impl( immediate_impl )
         , m_state_container_impl( state_container_impl ) 
         , m_state_registry( state_registry )
+        , m_coalesce_queued_actions( false )
     {}
     
-    state_manipulator_stacked_immediate_impl<t_state_id, t_state>& m_immediate_impl;
+    state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy>& m_immediate_impl;
     t_state_container_impl& m_state_container_impl;
-    state_registry<t_state_id, t_state>& m_state_registry;
+    t_state_registry& m_state_registry;
 
     struct queued_action
     {
         enum action_id { push, pop, remove, remove_and_above, remove_all };
 
+        queued_action() : m_action(push), m_state_id() {}
         queued_action( action_id action, t_state_id state ) : m_action(action), m_state_id(state) {}        
         
         action_id m_action;
         t_state_id m_state_id;
     };
-    std::vector<queued_action> m_queued_actions;
+    typedef typename t_storage_policy::template queue<queued_action>::type queued_actions_vector;
+    queued_actions_vector m_queued_actions;
+
+    bool m_coalesce_queued_actions;
 };
 
 template
@@ -251,91 +449,219 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 class state_manipulator_stacked_queued_interface_base
 {
 public:
-    typedef state_manipulator_stacked_queued_impl_base<t_state_id, t_state> t_impl;
+    typedef state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_stacked_queued_interface_base(
-        state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>& immediate_interface,
+        state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>& immediate_interface,
         t_impl& impl 
     ) 
         : m_immediate_interface( immediate_interface )
         , m_impl( impl ) 
     {}
 
-    void queue_push_state( t_state_id id )
+    bool queue_push_state( t_state_id id )
     {
-        m_impl.m_queued_actions.push_back( typename t_impl::queued_action( t_impl::queued_action::push, id ) );
+        return queue_action( typename t_impl::queued_action( t_impl::queued_action::push, id ) );
     }
 
     // It would dangrous to allow this, since position can become invalid because of other queued actions
     // bool queue_insert_state( t_state_id id, size_t position )
 
-    void queue_pop_state()
+    bool queue_pop_state()
     {
-        m_impl.m_queued_actions.push_back( typename t_impl::queued_action( t_impl::queued_action::pop, t_state_id() ) );
+        return queue_action( typename t_impl::queued_action( t_impl::queued_action::pop, t_state_id() ) );
     }
 
-    void queue_remove_state( t_state_id id )
+    bool queue_remove_state( t_state_id id )
     {
-        m_impl.m_queued_actions.push_back( typename t_impl::queued_action( t_impl::queued_action::remove, id ) );
+        return queue_action( typename t_impl::queued_action( t_impl::queued_action::remove, id ) );
     }
 
-    void queue_remove_state_and_all_above( t_state_id id )
+    bool queue_remove_state_and_all_above( t_state_id id )
     {
-        m_impl.m_queued_actions.push_back( typename t_impl::queued_action( t_impl::queued_action::remove_and_above, id ) );
+        return queue_action( typename t_impl::queued_action( t_impl::queued_action::remove_and_above, id ) );
     }
 
-    void queue_remove_all_states()
+    bool queue_remove_all_states()
     {
-        m_impl.m_queued_actions.push_back( typename t_impl::queued_action( t_impl::queued_action::remove_all, t_state_id() ) );
+        return queue_action( typename t_impl::queued_action( t_impl::queued_action::remove_all, t_state_id() ) );
     }
 
+      // When coalescing is enabled, update does not replay queued actions one by one. Instead, it
+      // computes the stack they would produce, and only removes states which are not in it and
+      // adds states which are not in the current stack. States that would be removed and added
+      // back, or added and removed, get no enter/exit calls at all. Exits are called from the top
+      // down before enters, which are called from the bottom up.
+    void set_queue_coalescing( bool coalesce ) { m_impl.m_coalesce_queued_actions = coalesce; }
+    bool get_queue_coalescing() const { return m_impl.m_coalesce_queued_actions; }
+
     void update(context_holder<t_context> ctx)
     {
-        for ( typename std::vector<typename t_impl::queued_action>::iterator iter = m_impl.m_queued_actions.begin();
-              iter != m_impl.m_queued_actions.end();
-              ++iter )
+          // Actions queued by enter/exit functions during update are executed by the same update
+        if ( m_impl.m_coalesce_queued_actions )
+        {
+            for ( size_t first = 0; first < m_impl.m_queued_actions.size(); )
+            {
+                const size_t last = m_impl.m_queued_actions.size();
+                apply_coalesced_actions( first, last, ctx );
+                first = last;
+            }
+        }
+        else
         {
-            switch( iter->m_action )
+            for ( size_t i = 0; i < m_impl.m_queued_actions.size(); ++i )
+            {
+                const typename t_impl::queued_action action = m_impl.m_queued_actions[i];
+                apply_queued_action( m_immediate_interface, action, ctx );
+            }
+        }
+
+        m_impl.m_queued_actions.clear();
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+protected:
+      // Returns false if the queue has a fixed capacity, and it is full
+    bool queue_action( const typename t_impl::queued_action& action )
+    {
+        if ( m_impl.m_queued_actions.size() >= m_impl.m_queued_actions.max_size() )
+            return false;
+
+        m_impl.m_queued_actions.push_back( action );
+
+        return true;
+    }
+
+    typedef typename state_container_stacked_impl<t_state_id, t_state, t_storage_policy>::current_states_vector current_states_vector;
+
+    static typename current_states_vector::iterator find_state_in( current_states_vector& states, t_state_id id )
+    {
+        typename current_states_vector::iterator iter;
+        for( iter = states.begin(); iter != states.end(); ++iter )
+            if ( (*iter)->id == id )
+                break;
+
+        return iter;
+    }
+
+      // Executes queued actions [first; last) as a net change of the stack
+    void apply_coalesced_actions( size_t first, size_t last, context_holder<t_context>& ctx )
+    {
+        current_states_vector& current_states = m_impl.m_state_container_impl.m_current_states;
+
+          // Scratch stacks are not kept in every machine, see scratch_vector
+        scratch_vector<current_states_vector> final_scratch;
+        scratch_vector<current_states_vector> removed_scratch;
+        scratch_vector<typename t_storage_policy::template stack<std::pair<size_t, size_t> >::type> kept_scratch;
+        current_states_vector& final_states = final_scratch.get();
+        current_states_vector& removed_states = removed_scratch.get();
+
+          // Replay actions on a copy of the stack, following the same rules as immediate manipulator
+        for ( size_t i = 0; i < current_states.size(); ++i )
+            final_states.push_back( current_states[i] );
+
+        for ( size_t i = first; i < last; ++i )
+        {
+            const typename t_impl::queued_action& action = m_impl.m_queued_actions[i];
+            switch( action.m_action )
             {
                 case t_impl::queued_action::push:
-                    m_immediate_interface.push_state( iter->m_state_id, ctx );
+                {
+                    state_and_id<t_state_id, t_state>* new_state = m_impl.m_state_registry.find_state( action.m_state_id );
+                    if ( new_state != 0 && final_states.size() < final_states.max_size() && find_state_in( final_states, action.m_state_id ) == final_states.end() )
+                        final_states.push_back( new_state );
                     break;
+                }
 
                 case t_impl::queued_action::pop:
-                    m_immediate_interface.pop_state( ctx );
+                    if ( !final_states.empty() )
+                        final_states.pop_back();
                     break;
 
                 case t_impl::queued_action::remove:
-                    m_immediate_interface.remove_state( iter->m_state_id, ctx );
+                {
+                    typename current_states_vector::iterator iter = find_state_in( final_states, action.m_state_id );
+                    if ( iter != final_states.end() )
+                        final_states.erase( iter );
                     break;
+                }
 
                 case t_impl::queued_action::remove_and_above:
-                    m_immediate_interface.remove_state_and_all_above( iter->m_state_id, ctx );
+                    final_states.erase( find_state_in( final_states, action.m_state_id ), final_states.end() );
                     break;
 
                 case t_impl::queued_action::remove_all:
-                    m_immediate_interface.remove_all_states( ctx );
+                    final_states.clear();
                     break;
             }
         }
 
-        m_impl.m_queued_actions.clear();
-    }
+          // The largest set of current states which keep their relative order in the final stack is left
+          // untouched, all other current states are removed. This is the longest increasing subsequence
+          // of positions of current states in the final stack: for each current state, kept_states
+          // holds its position in the final stack and the length of the longest subsequence ending at it.
+        typename t_storage_policy::template stack<std::pair<size_t, size_t> >::type& kept_states = kept_scratch.get();
 
-    template<typename T = t_context>
-    typename std::enable_if<std::is_void<T>::value, void>::type update()
-    {
-        update(context_holder<void>());
+        size_t best = invalid_state_index;
+        for ( size_t i = 0; i < current_states.size(); ++i )
+        {
+            std::pair<size_t, size_t> kept( invalid_state_index, 0 );
+            for ( size_t j = 0; j < final_states.size(); ++j )
+                if ( final_states[j] == current_states[i] )
+                    kept.first = j;
+
+            if ( kept.first != invalid_state_index )
+            {
+                kept.second = 1;
+                for ( size_t j = 0; j < i; ++j )
+                    if ( kept_states[j].first < kept.first && kept_states[j].second + 1 > kept.second )
+                        kept.second = kept_states[j].second + 1;
+
+                if ( best == invalid_state_index || kept.second > kept_states[best].second )
+                    best = i;
+            }
+
+            kept_states.push_back( kept );
+        }
+
+        size_t length = best != invalid_state_index ? kept_states[best].second : 0;
+        size_t bound = final_states.size();
+        for ( size_t i = current_states.size(); i-- > 0; )
+        {
+            if ( length > 0 && kept_states[i].second == length && kept_states[i].first < bound )
+            {
+                bound = kept_states[i].first;
+                --length;
+            }
+            else
+                removed_states.push_back( current_states[i] );
+        }
+
+        for ( size_t i = 0; i < removed_states.size(); ++i )
+            m_immediate_interface.remove_state( removed_states[i]->id, ctx );
+
+        for ( size_t i = 0; i < final_states.size(); ++i )
+        {
+            if ( find_state_in( current_states, final_states[i]->id ) == current_states.end() )
+                m_immediate_interface.insert_state( final_states[i]->id, i < current_states.size() ? i : current_states.size(), ctx );
+        }
     }
 
-protected:
     t_impl& m_impl;
-    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>& m_immediate_interface;
+    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>& m_immediate_interface;
 };
 
 //----------------------------------------------------------------
@@ -343,21 +669,23 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
-struct state_manipulator_stacked_queued_impl : public state_manipulator_stacked_queued_impl_base<t_state_id, t_state>
+struct state_manipulator_stacked_queued_impl : public state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_state_registry, t_storage_policy>
 {
-    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
     state_manipulator_stacked_queued_impl
         (
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
-        : state_manipulator_stacked_queued_impl_base<t_state_id, t_state>( m_immediate_impl, state_container_impl, state_registry )
+        : state_manipulator_stacked_queued_impl_base<t_state_id, t_state, t_state_registry, t_storage_policy>( m_immediate_impl, state_container_impl, state_registry )
         , m_immediate_impl( state_container_impl, state_registry )
     {}
 
-    state_manipulator_stacked_immediate_impl<t_state_id, t_state> m_immediate_impl;
+    state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy> m_immediate_impl;
 };
 
 template
@@ -365,20 +693,23 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
-class state_manipulator_stacked_queued_interface : public state_manipulator_stacked_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context>
+class state_manipulator_stacked_queued_interface : public state_manipulator_stacked_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>
 {
 public:
-    typedef state_manipulator_stacked_queued_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_stacked_queued_impl<t_state_id, t_state, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_stacked_queued_interface( t_impl& impl ) 
-        : state_manipulator_stacked_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context>( m_immediate_interface, impl )
+        : state_manipulator_stacked_queued_interface_base<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>( m_immediate_interface, impl )
         , m_immediate_interface( impl.m_immediate_impl )
     {}
 
 protected:
-    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context> m_immediate_interface;
+    state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy> m_immediate_interface;
 };
 
 //----------------------------------------------------------------
@@ -386,20 +717,22 @@ protected:
 template
 <
     typename t_state_id,
-    typename t_state
+    typename t_state,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 struct state_manipulator_stacked_combined_impl : 
-    public state_manipulator_stacked_immediate_impl<t_state_id, t_state>,
-    public state_manipulator_stacked_queued_impl<t_state_id, t_state>
+    public state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy>,
+    public state_manipulator_stacked_queued_impl<t_state_id, t_state, t_state_registry, t_storage_policy>
 {
-    typedef state_container_stacked_impl<t_state_id, t_state> t_state_container_impl;
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
     state_manipulator_stacked_combined_impl
         ( 
             t_state_container_impl& state_container_impl, 
-            state_registry<t_state_id, t_state>& state_registry
+            t_state_registry& state_registry
         ) 
-        : state_manipulator_stacked_immediate_impl<t_state_id, t_state>( state_container_impl, state_registry )
-        , state_manipulator_stacked_queued_impl<t_state_id, t_state>( state_container_impl, state_registry )
+        : state_manipulator_stacked_immediate_impl<t_state_id, t_state, t_state_registry, t_storage_policy>( state_container_impl, state_registry )
+        , state_manipulator_stacked_queued_impl<t_state_id, t_state, t_state_registry, t_storage_policy>( state_container_impl, state_registry )
     {}
 };
 
@@ -408,18 +741,21 @@ template
     typename t_state_id,
     typename t_state,
     typename t_on_enter_exit_policy = enter_exit_policy_default,
-    typename t_context = void
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
 >
 class state_manipulator_stacked_combined_interface :
-    public state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>,
-    public state_manipulator_stacked_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>
+    public state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>,
+    public state_manipulator_stacked_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>
 {
 public:
-    typedef state_manipulator_stacked_combined_impl<t_state_id, t_state> t_impl;
+    typedef state_manipulator_stacked_combined_impl<t_state_id, t_state, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
 
     state_manipulator_stacked_combined_interface( t_impl& impl ) 
-        : state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>( impl )
-        , state_manipulator_stacked_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context>( impl )
+        : state_manipulator_stacked_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>( impl )
+        , state_manipulator_stacked_queued_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry, t_storage_policy>( impl )
     {}
 };
 //----------------------------------------------------------------
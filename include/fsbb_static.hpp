@@ -0,0 +1,237 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+#include <tuple>
+
+/*
+    Building blocks for machines whose states are fully known at compile time.
+
+    States are given as a list of types, and the registry stores one object of each type by value,
+    so there is no lookup and no pointer chasing. A state is identified by its type (for transitions
+    known at compile time) or by its index in the list (for transitions chosen at runtime).
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+template<typename t_state, typename... t_states>
+struct static_state_index;
+
+template<typename t_state, typename... t_rest>
+struct static_state_index<t_state, t_state, t_rest...>
+{
+    static const size_t value = 0;
+};
+
+template<typename t_state, typename t_first, typename... t_rest>
+struct static_state_index<t_state, t_first, t_rest...>
+{
+    static const size_t value = 1 + static_state_index<t_state, t_rest...>::value;
+};
+
+//----------------------------------------------------------------
+// Registry
+//----------------------------------------------------------------
+
+template<typename... t_states>
+class static_state_registry
+{
+public:
+    typedef std::tuple<t_states...> states_tuple;
+
+    static const size_t states_count = sizeof...( t_states );
+
+    template<typename t_state>
+    struct index_of
+    {
+        static const size_t value = static_state_index<t_state, t_states...>::value;
+    };
+
+    template<typename t_state>
+    t_state& get_state() { return std::get<index_of<t_state>::value>( m_states ); }
+
+    states_tuple& get_states() { return m_states; }
+
+protected:
+    states_tuple m_states;
+};
+
+//----------------------------------------------------------------
+
+  // Calls enter/exit policy for a state which index is known only at runtime. Compiles to a chain of
+  // comparisons (or a jump table) with inlined policy calls.
+template<typename t_states_tuple, size_t t_index, size_t t_count>
+struct static_state_dispatch
+{
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_enter( t_states_tuple& states, size_t index, context_holder<t_context>& ctx )
+    {
+        if ( index == t_index )
+            t_on_enter_exit_policy::on_enter( std::get<t_index>( states ), ctx );
+        else
+            static_state_dispatch<t_states_tuple, t_index + 1, t_count>::template on_enter<t_on_enter_exit_policy>( states, index, ctx );
+    }
+
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_exit( t_states_tuple& states, size_t index, context_holder<t_context>& ctx )
+    {
+        if ( index == t_index )
+            t_on_enter_exit_policy::on_exit( std::get<t_index>( states ), ctx );
+        else
+            static_state_dispatch<t_states_tuple, t_index + 1, t_count>::template on_exit<t_on_enter_exit_policy>( states, index, ctx );
+    }
+};
+
+template<typename t_states_tuple, size_t t_count>
+struct static_state_dispatch<t_states_tuple, t_count, t_count>
+{
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_enter( t_states_tuple& states, size_t index, context_holder<t_context>& ctx ) {}
+
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_exit( t_states_tuple& states, size_t index, context_holder<t_context>& ctx ) {}
+};
+
+//----------------------------------------------------------------
+// Enter/Exit policies
+//----------------------------------------------------------------
+
+struct enter_exit_policy_static_default
+{
+    template<typename t_state, typename t_context>
+    static void on_enter( t_state& state, context_holder<t_context>& ctx ) {}
+
+    template<typename t_state, typename t_context>
+    static void on_exit( t_state& state, context_holder<t_context>& ctx ) {}
+};
+
+//----------------------------------------------------------------
+
+struct enter_exit_policy_static_notify
+{
+    template<typename t_state, typename t_context>
+    static void on_enter( t_state& state, context_holder<t_context>& ctx ) { state.on_enter( ctx.m_context ); }
+
+    template<typename t_state>
+    static void on_enter( t_state& state, context_holder<void>& ctx ) { state.on_enter(); }
+
+    template<typename t_state, typename t_context>
+    static void on_exit( t_state& state, context_holder<t_context>& ctx ) { state.on_exit( ctx.m_context ); }
+
+    template<typename t_state>
+    static void on_exit( t_state& state, context_holder<void>& ctx ) { state.on_exit(); }
+};
+
+//----------------------------------------------------------------
+// State containers ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_registry
+>
+struct state_container_static_impl
+{
+    state_container_static_impl() : m_current_state( invalid_state_index ) {}
+
+    size_t m_current_state;
+};
+
+template
+<
+    typename t_state_registry
+>
+class state_container_static_interface
+{
+public:
+    typedef state_container_static_impl<t_state_registry> t_impl;
+
+    state_container_static_interface( t_impl& impl ) : m_impl( impl ) {}
+
+    size_t get_current_state_id() const { return m_impl.m_current_state; }
+
+    template<typename t_state>
+    bool is_current_state() const { return m_impl.m_current_state == t_state_registry::template index_of<t_state>::value; }
+
+protected:
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_registry
+>
+struct state_manipulator_static_immediate_impl
+{
+    typedef state_container_static_impl<t_state_registry> t_state_container_impl;
+    state_manipulator_static_immediate_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : m_state_container_impl( state_container_impl )
+        , m_state_registry( state_registry )
+    {}
+
+    t_state_container_impl& m_state_container_impl;
+    t_state_registry& m_state_registry;
+};
+
+template
+<
+    typename t_state_registry,
+    typename t_on_enter_exit_policy = enter_exit_policy_static_notify,
+    typename t_context = void
+>
+class state_manipulator_static_immediate_interface
+{
+public:
+    typedef state_manipulator_static_immediate_impl<t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+    typedef typename t_state_registry::states_tuple states_tuple;
+
+    state_manipulator_static_immediate_interface( t_impl& impl ) : m_impl( impl ) {}
+
+      // Changes state to the one known at compile time. Only the exit of the current state needs dispatching.
+    template<typename t_new_state>
+    void change_state_immediate( context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        const size_t new_index = t_state_registry::template index_of<t_new_state>::value;
+        states_tuple& states = m_impl.m_state_registry.get_states();
+        size_t& current_state = m_impl.m_state_container_impl.m_current_state;
+
+        static_state_dispatch<states_tuple, 0, t_state_registry::states_count>::template on_exit<t_on_enter_exit_policy>( states, current_state, ctx );
+
+        current_state = new_index;
+
+        t_on_enter_exit_policy::on_enter( std::get<t_state_registry::template index_of<t_new_state>::value>( states ), ctx );
+    }
+
+    bool change_state_immediate( size_t index, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        if ( index >= t_state_registry::states_count )
+            return false;
+
+        states_tuple& states = m_impl.m_state_registry.get_states();
+        size_t& current_state = m_impl.m_state_container_impl.m_current_state;
+
+        static_state_dispatch<states_tuple, 0, t_state_registry::states_count>::template on_exit<t_on_enter_exit_policy>( states, current_state, ctx );
+
+        current_state = index;
+
+        static_state_dispatch<states_tuple, 0, t_state_registry::states_count>::template on_enter<t_on_enter_exit_policy>( states, current_state, ctx );
+
+        return true;
+    }
+
+protected:
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+}
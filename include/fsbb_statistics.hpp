@@ -0,0 +1,225 @@
+#pragma once
+
+#include "fsbb_trace.hpp"
+#include <memory>
+#include <mutex>
+
+/*
+    Per-state statistics of single-state and stacked machines, collected through the traced manipulators
+    with trace_policy_statistics:
+    - how many times every state was entered;
+    - cumulative and maximum time between entering a state and exiting it ("dwell time");
+    - how many times the current (top) state changed from one state to another, as a dense matrix
+      indexed by registry slots. A call which replaces the current state counts as one transition, so
+      several changes applied by one update() count as a transition from the state before it to the
+      state after it.
+
+    Statistics are written by the thread which updates the machine, and can be read from any thread by
+    take_snapshot(), which copies counters without stopping the writer, and optionally resets them.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+struct state_statistics_snapshot
+{
+    std::vector<unsigned long long> m_enters;
+    std::vector<unsigned long long> m_total_time;
+    std::vector<unsigned long long> m_max_time;
+
+      // States count x states count, row is the state before a transition
+    std::vector<unsigned long long> m_transitions;
+
+    size_t get_states_count() const { return m_enters.size(); }
+    unsigned long long get_transitions( size_t from, size_t to ) const { return m_transitions[from * m_enters.size() + to]; }
+};
+
+//----------------------------------------------------------------
+
+class state_statistics : public trace_sink
+{
+public:
+    typedef std::atomic<unsigned long long> counter;
+
+    state_statistics() : m_states_count( 0 ) {}
+
+      // Grows counters when states were registered since the last call. Called by the writer.
+    void resize( size_t states_count )
+    {
+        if ( states_count <= m_states_count )
+            return;
+
+        std::unique_ptr<counter[]> enters( new counter[states_count] );
+        std::unique_ptr<counter[]> total_time( new counter[states_count] );
+        std::unique_ptr<counter[]> max_time( new counter[states_count] );
+        std::unique_ptr<counter[]> transitions( new counter[states_count * states_count] );
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        for ( size_t i = 0; i < states_count; ++i )
+        {
+            enters[i].store( i < m_states_count ? m_enters[i].load( std::memory_order_relaxed ) : 0, std::memory_order_relaxed );
+            total_time[i].store( i < m_states_count ? m_total_time[i].load( std::memory_order_relaxed ) : 0, std::memory_order_relaxed );
+            max_time[i].store( i < m_states_count ? m_max_time[i].load( std::memory_order_relaxed ) : 0, std::memory_order_relaxed );
+
+            for ( size_t j = 0; j < states_count; ++j )
+            {
+                const bool old = i < m_states_count && j < m_states_count;
+                transitions[i * states_count + j].store( old ? m_transitions[i * m_states_count + j].load( std::memory_order_relaxed ) : 0, std::memory_order_relaxed );
+            }
+        }
+
+        m_entered_at.resize( states_count, 0 );
+        m_enters.swap( enters );
+        m_total_time.swap( total_time );
+        m_max_time.swap( max_time );
+        m_transitions.swap( transitions );
+        m_states_count = states_count;
+    }
+
+    void on_enter( size_t state, unsigned long long time )
+    {
+        if ( state >= m_states_count )
+            return;
+
+        m_entered_at[state] = time;
+        m_enters[state].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void on_exit( size_t state, unsigned long long time )
+    {
+        if ( state >= m_states_count )
+            return;
+
+        const unsigned long long dwell_time = time - m_entered_at[state];
+        m_total_time[state].fetch_add( dwell_time, std::memory_order_relaxed );
+
+        unsigned long long max_time = m_max_time[state].load( std::memory_order_relaxed );
+        while ( dwell_time > max_time && !m_max_time[state].compare_exchange_weak( max_time, dwell_time, std::memory_order_relaxed ) )
+            ;
+    }
+
+    void on_transition( size_t from, size_t to )
+    {
+        if ( from < m_states_count && to < m_states_count )
+            m_transitions[from * m_states_count + to].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+      // Called by enter_exit_policy_traced
+    void record_callback( trace_operation operation, const void* state, unsigned long long start, unsigned long long end )
+    {
+        if ( operation == trace_enter )
+            on_enter( get_state_index( state ), end );
+        else if ( operation == trace_exit )
+            on_exit( get_state_index( state ), start );
+    }
+
+      // Copies counters into the snapshot, reusing its memory. With reset, counters are atomically
+      // exchanged with zeroes, so no event is lost or counted twice between snapshots.
+      // Time spent in states which are still entered is counted when they are exited.
+    void take_snapshot( state_statistics_snapshot& snapshot, bool reset = false )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        const size_t states_count = m_states_count;
+        snapshot.m_enters.resize( states_count );
+        snapshot.m_total_time.resize( states_count );
+        snapshot.m_max_time.resize( states_count );
+        snapshot.m_transitions.resize( states_count * states_count );
+
+        for ( size_t i = 0; i < states_count; ++i )
+        {
+            snapshot.m_enters[i] = take( m_enters[i], reset );
+            snapshot.m_total_time[i] = take( m_total_time[i], reset );
+            snapshot.m_max_time[i] = take( m_max_time[i], reset );
+        }
+
+        for ( size_t i = 0; i < states_count * states_count; ++i )
+            snapshot.m_transitions[i] = take( m_transitions[i], reset );
+    }
+
+      // Statistics of the machine which is being called in this thread, if it collects them
+    static state_statistics*& current()
+    {
+        static thread_local state_statistics* statistics = 0;
+        return statistics;
+    }
+
+private:
+    static unsigned long long take( counter& value, bool reset )
+    {
+          // Most transitions never happen, so zero counters are not exchanged
+        const unsigned long long result = value.load( std::memory_order_relaxed );
+        return reset && result != 0 ? value.exchange( 0, std::memory_order_relaxed ) : result;
+    }
+
+      // Guards counter arrays, which are replaced when they grow, from readers
+    std::mutex m_mutex;
+
+    size_t m_states_count;
+    std::unique_ptr<counter[]> m_enters;
+    std::unique_ptr<counter[]> m_total_time;
+    std::unique_ptr<counter[]> m_max_time;
+    std::unique_ptr<counter[]> m_transitions;
+
+      // Written and read only by the writer
+    std::vector<unsigned long long> m_entered_at;
+};
+
+//----------------------------------------------------------------
+// Trace policies
+//----------------------------------------------------------------
+
+  // Collects state_statistics. Time is measured in ticks of t_clock, i.e. in nanoseconds with trace_clock_steady.
+template<typename t_clock = trace_clock_steady>
+struct trace_policy_statistics
+{
+    template<typename t_on_enter_exit_policy>
+    struct enter_exit_policy { typedef enter_exit_policy_traced<t_on_enter_exit_policy, t_clock, state_statistics> type; };
+
+    typedef state_statistics buffer;
+
+    template<typename t_state_id, typename t_state_registry>
+    static void set_registry( buffer& b, const t_state_registry& registry ) { b.template set_registry<t_state_id>( registry ); }
+
+      // Makes statistics current for callbacks while a call of the machine lasts, and counts the
+      // transition if the call changed the current state
+    class scope
+    {
+    public:
+        template<typename t_machine>
+        scope( buffer& b, const t_machine& machine )
+            : m_statistics( b )
+            , m_previous( state_statistics::current() )
+        {
+            m_statistics.resize( machine.get_trace_states_count() );
+            m_top_state = machine.get_trace_top_state();
+            state_statistics::current() = &m_statistics;
+        }
+
+        ~scope() { state_statistics::current() = m_previous; }
+
+        template<typename t_machine, typename t_state_id>
+        void record( trace_operation operation, const t_machine& machine, const t_state_id& id, bool result )
+        {
+            record( operation, machine, result );
+        }
+
+        template<typename t_machine>
+        void record( trace_operation operation, const t_machine& machine, bool result )
+        {
+            const size_t top_state = machine.get_trace_top_state();
+            if ( top_state != m_top_state )
+                m_statistics.on_transition( m_top_state, top_state );
+        }
+
+    private:
+        state_statistics& m_statistics;
+        state_statistics* m_previous;
+        size_t m_top_state;
+    };
+};
+
+//----------------------------------------------------------------
+}
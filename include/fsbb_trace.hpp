@@ -0,0 +1,696 @@
+#pragma once
+
+#include "fsbb_single.hpp"
+#include "fsbb_stacked.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+/*
+    Opt-in tracing of single-state and stacked machines.
+
+    A traced manipulator records every call (push_state, queue_remove_state, update...) and every
+    enter/exit callback into a fixed-size ring buffer of the machine: when it was made, how long it
+    took, the state, the stack depth after the call and its result. The last entries can be read
+    at any time, e.g. when the machine ends up with an unexpected stack, and exported to Chrome trace
+    JSON, which can be opened in chrome://tracing or Perfetto. Callbacks are shown nested in calls.
+
+    With trace_policy_none, the traced manipulator works as the plain combined manipulator: nothing is
+    recorded, no time is taken and there is no buffer, so tracing can be switched off in release builds
+    by changing a single template argument.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+enum trace_operation
+{
+    trace_enter,
+    trace_exit,
+    trace_replace_top_state,
+    trace_push_state,
+    trace_insert_state,
+    trace_pop_state,
+    trace_remove_state,
+    trace_remove_state_and_all_above,
+    trace_remove_all_states,
+    trace_queue_push_state,
+    trace_queue_pop_state,
+    trace_queue_remove_state,
+    trace_queue_remove_state_and_all_above,
+    trace_queue_remove_all_states,
+    trace_update,
+    trace_change_state,
+    trace_queue_change_state
+};
+
+inline const char* get_trace_operation_name( trace_operation operation )
+{
+    static const char* names[] =
+    {
+        "on_enter", "on_exit",
+        "replace_top_state", "push_state", "insert_state", "pop_state", "remove_state", "remove_state_and_all_above", "remove_all_states",
+        "queue_push_state", "queue_pop_state", "queue_remove_state", "queue_remove_state_and_all_above", "queue_remove_all_states",
+        "update", "change_state", "queue_change_state"
+    };
+
+    return names[operation];
+}
+
+struct trace_entry
+{
+    unsigned long long m_timestamp;     // in nanoseconds, or in ticks of the trace clock
+    unsigned long long m_duration;
+    size_t m_state;                     // registry slot, or invalid_state_index if the operation has no state
+    size_t m_depth;                     // stack depth after the operation, or invalid_state_index for callbacks
+    trace_operation m_operation;
+    bool m_result;
+};
+
+  // Time in nanoseconds of std::chrono::steady_clock
+struct trace_clock_steady
+{
+    static unsigned long long now()
+    {
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+};
+
+  // Logical time: a counter incremented on every reading. Keeps the order and nesting of entries
+  // without reading a clock, which can cost more than a call of the machine on some platforms.
+struct trace_clock_sequence
+{
+    static unsigned long long now()
+    {
+        static thread_local unsigned long long counter = 0;
+        return ++counter;
+    }
+};
+
+//----------------------------------------------------------------
+
+  // Gives registry slots of states to enter/exit policies, which only see registry entries. A slot
+  // is computed from the address of the entry, so no state ID is looked up.
+class trace_sink
+{
+public:
+    typedef size_t ( *get_state_index_function )( const void* registry, const void* state );
+
+    trace_sink() : m_registry( 0 ), m_get_state_index( 0 ) {}
+
+    void set_registry( const void* registry, get_state_index_function get_state_index )
+    {
+        m_registry = registry;
+        m_get_state_index = get_state_index;
+    }
+
+    size_t get_state_index( const void* state ) const { return m_get_state_index( m_registry, state ); }
+
+    template<typename t_state_id, typename t_state_registry>
+    void set_registry( const t_state_registry& registry ) { set_registry( &registry, &get_registry_state_index<t_state_id, t_state_registry> ); }
+
+private:
+    template<typename t_state_id, typename t_state_registry>
+    static size_t get_registry_state_index( const void* registry, const void* state )
+    {
+        typedef typename std::remove_reference<decltype( std::declval<t_state_registry&>().get_state( 0 ) )>::type entry;
+        return static_cast<const t_state_registry*>( registry )->get_state_index( static_cast<const entry*>( state ) );
+    }
+
+    const void* m_registry;
+    get_state_index_function m_get_state_index;
+};
+
+//----------------------------------------------------------------
+
+/*
+    Ring buffer of trace entries, written by the thread which updates the machine.
+
+    Readers on other threads do not block the writer: get_entries() copies entries and then drops
+    those which the writer could have overwritten while they were copied, as a sequence lock does.
+    The writer rewrites the slot of entry N before it publishes N + 1 written entries, so an entry
+    is dropped as soon as the writer could have started to rewrite its slot, and readers never keep
+    a half-written entry.
+*/
+class trace_ring_buffer_base : public trace_sink
+{
+public:
+    trace_ring_buffer_base( trace_entry* entries, size_t capacity )
+        : m_entries( entries )
+        , m_capacity( capacity )
+        , m_written( 0 )
+        , m_callbacks_count( 0 )
+        , m_last_callback_state( invalid_state_index )
+    {}
+
+    void record( trace_operation operation, size_t state, size_t depth, bool result, unsigned long long start, unsigned long long end )
+    {
+        const size_t written = m_written.load( std::memory_order_relaxed );
+
+          // Pairs with the fence in get_entries(): a reader which sees any part of this entry also sees
+          // at least "written" entries, so it drops the old entry in the same slot
+        std::atomic_thread_fence( std::memory_order_release );
+
+        trace_entry& entry = m_entries[written % m_capacity];
+        entry.m_timestamp = start;
+        entry.m_duration = end - start;
+        entry.m_state = state;
+        entry.m_depth = depth;
+        entry.m_operation = operation;
+        entry.m_result = result;
+
+        m_written.store( written + 1, std::memory_order_release );
+    }
+
+      // Called by enter_exit_policy_traced with the registry entry of the state
+    void record_callback( trace_operation operation, const void* state, unsigned long long start, unsigned long long end )
+    {
+        m_last_callback_state = get_state_index( state );
+        ++m_callbacks_count;
+        record( operation, m_last_callback_state, invalid_state_index, true, start, end );
+    }
+
+      // Used by the scope, only in the writer's thread
+    size_t get_callbacks_count() const { return m_callbacks_count; }
+    size_t get_last_callback_state() const { return m_last_callback_state; }
+
+      // Appends recorded entries to the vector, from the oldest one
+    void get_entries( std::vector<trace_entry>& entries ) const
+    {
+        const size_t written = m_written.load( std::memory_order_acquire );
+        const size_t first = written > m_capacity ? written - m_capacity : 0;
+
+        const size_t offset = entries.size();
+        for ( size_t i = first; i < written; ++i )
+            entries.push_back( m_entries[i % m_capacity] );
+
+          // Entry i is being rewritten, or was rewritten, once the writer has published i + capacity entries,
+          // so the entries [first; first + overwritten - capacity] may be torn
+        std::atomic_thread_fence( std::memory_order_acquire );
+        const size_t overwritten = m_written.load( std::memory_order_relaxed ) - first;
+        if ( overwritten >= m_capacity )
+            entries.erase( entries.begin() + offset, entries.begin() + offset + std::min( overwritten - m_capacity + 1, written - first ) );
+    }
+
+      // Number of entries recorded since the machine was created, including overwritten ones
+    size_t get_written_count() const { return m_written.load( std::memory_order_acquire ); }
+
+    void clear() { m_written.store( 0, std::memory_order_release ); }
+
+      // Buffer of the machine which is being called in this thread, if it is traced
+    static trace_ring_buffer_base*& current()
+    {
+        static thread_local trace_ring_buffer_base* buffer = 0;
+        return buffer;
+    }
+
+private:
+    trace_entry* m_entries;
+    size_t m_capacity;
+    std::atomic<size_t> m_written;
+
+    size_t m_callbacks_count;
+    size_t m_last_callback_state;
+};
+
+template<size_t t_capacity>
+class trace_ring_buffer : public trace_ring_buffer_base
+{
+public:
+    trace_ring_buffer() : trace_ring_buffer_base( m_storage, t_capacity ) {}
+
+private:
+    trace_entry m_storage[t_capacity];
+};
+
+//----------------------------------------------------------------
+
+  // Writes trace entries as a Chrome trace JSON object. Entries of a machine are shown as a single
+  // thread with the given id, so traces of several machines can be told apart. State IDs are written with operator<<.
+template<typename t_state_registry>
+void write_chrome_trace( std::ostream& out, const std::vector<trace_entry>& entries, t_state_registry& registry, size_t thread_id = 0 )
+{
+    out << "{\"traceEvents\":[";
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        const trace_entry& entry = entries[i];
+
+        out << ( i > 0 ? ",\n" : "\n" );
+        out << "{\"name\":\"" << get_trace_operation_name( entry.m_operation ) << "\",\"cat\":\"fsbb\",\"ph\":\"X\"";
+        out << ",\"ts\":" << entry.m_timestamp / 1000 << "." << entry.m_timestamp / 100 % 10 << entry.m_timestamp / 10 % 10 << entry.m_timestamp % 10;
+        out << ",\"dur\":" << entry.m_duration / 1000 << "." << entry.m_duration / 100 % 10 << entry.m_duration / 10 % 10 << entry.m_duration % 10;
+        out << ",\"pid\":0,\"tid\":" << thread_id << ",\"args\":{\"result\":" << ( entry.m_result ? "true" : "false" );
+
+        if ( entry.m_state != invalid_state_index && entry.m_state < registry.get_states_count() )
+        {
+            std::ostringstream text;
+            text << registry.get_state( entry.m_state ).id;
+            const std::string id = text.str();
+
+            out << ",\"state\":\"";
+            for ( size_t c = 0; c < id.size(); ++c )
+            {
+                const unsigned char ch = (unsigned char)id[c];
+                if ( ch == '"' || ch == '\\' )
+                    out << '\\' << (char)ch;
+                else if ( ch < 0x20 )
+                    out << "\\u00" << "0123456789abcdef"[ch >> 4] << "0123456789abcdef"[ch & 15];
+                else
+                    out << (char)ch;
+            }
+            out << '"';
+        }
+
+        if ( entry.m_depth != invalid_state_index )
+            out << ",\"depth\":" << entry.m_depth;
+
+        out << "}}";
+    }
+    out << "\n]}\n";
+}
+
+//----------------------------------------------------------------
+// Enter/Exit policies
+//----------------------------------------------------------------
+
+  // Calls another policy, and records the call and its duration into the buffer of the machine being called
+template<typename t_on_enter_exit_policy, typename t_clock = trace_clock_steady, typename t_buffer = trace_ring_buffer_base>
+struct enter_exit_policy_traced
+{
+    template<typename t_state_id, typename t_state, typename t_context>
+    static void on_enter( state_and_id<t_state_id, t_state>& state, context_holder<t_context>& ctx )
+    {
+        const unsigned long long start = t_clock::now();
+        t_on_enter_exit_policy::on_enter( state, ctx );
+        record( trace_enter, state, start );
+    }
+
+    template<typename t_state_id, typename t_state, typename t_context>
+    static void on_exit( state_and_id<t_state_id, t_state>& state, context_holder<t_context>& ctx )
+    {
+        const unsigned long long start = t_clock::now();
+        t_on_enter_exit_policy::on_exit( state, ctx );
+        record( trace_exit, state, start );
+    }
+
+private:
+    template<typename t_state_id, typename t_state>
+    static void record( trace_operation operation, const state_and_id<t_state_id, t_state>& state, unsigned long long start )
+    {
+        t_buffer* buffer = t_buffer::current();
+        if ( buffer )
+            buffer->record_callback( operation, &state, start, t_clock::now() );
+    }
+};
+
+//----------------------------------------------------------------
+// Trace policies
+//----------------------------------------------------------------
+
+/*
+    A trace policy provides:
+    - enter_exit_policy<t_policy>::type, the enter/exit policy which wraps the one of the machine;
+    - buffer, the data stored in the machine;
+    - set_registry( buffer, registry ), called when the machine is created;
+    - scope, which lasts for a call of the machine: it is constructed with the buffer and the machine
+      before the call, and its record() method is called after it. The machine provides
+      get_trace_state( id ), get_trace_top_state(), get_trace_depth() and get_trace_states_count(),
+      and the scope only calls those it needs.
+*/
+
+struct trace_policy_none
+{
+    template<typename t_on_enter_exit_policy>
+    struct enter_exit_policy { typedef t_on_enter_exit_policy type; };
+
+    struct buffer {};
+
+    template<typename t_state_id, typename t_state_registry>
+    static void set_registry( buffer& b, const t_state_registry& registry ) {}
+
+    class scope
+    {
+    public:
+        template<typename t_machine>
+        scope( buffer& b, const t_machine& machine ) {}
+
+        template<typename t_machine, typename t_state_id>
+        void record( trace_operation operation, const t_machine& machine, const t_state_id& id, bool result ) {}
+
+        template<typename t_machine>
+        void record( trace_operation operation, const t_machine& machine, bool result ) {}
+    };
+};
+
+template<size_t t_capacity = 1024, typename t_clock = trace_clock_steady>
+struct trace_policy_ring_buffer
+{
+    template<typename t_on_enter_exit_policy>
+    struct enter_exit_policy { typedef enter_exit_policy_traced<t_on_enter_exit_policy, t_clock> type; };
+
+    typedef trace_ring_buffer<t_capacity> buffer;
+
+    template<typename t_state_id, typename t_state_registry>
+    static void set_registry( buffer& b, const t_state_registry& registry ) { b.template set_registry<t_state_id>( registry ); }
+
+      // Makes the buffer current for callbacks while a call of the machine lasts.
+      // A successful immediate call which names a state ends with a callback of this state (the
+      // enter of a pushed state, the exit of a removed one), so its slot is taken from the callback.
+      // Queued and failed calls have no such callback, and look the state up in the registry.
+    class scope
+    {
+    public:
+        template<typename t_machine>
+        scope( buffer& b, const t_machine& machine )
+            : m_buffer( b )
+            , m_previous( trace_ring_buffer_base::current() )
+            , m_start( t_clock::now() )
+            , m_callbacks_count( b.get_callbacks_count() )
+        {
+            trace_ring_buffer_base::current() = &m_buffer;
+        }
+
+        ~scope() { trace_ring_buffer_base::current() = m_previous; }
+
+        template<typename t_machine, typename t_state_id>
+        void record( trace_operation operation, const t_machine& machine, const t_state_id& id, bool result )
+        {
+            const size_t state = result && m_buffer.get_callbacks_count() != m_callbacks_count ? m_buffer.get_last_callback_state() : machine.get_trace_state( id );
+            m_buffer.record( operation, state, machine.get_trace_depth(), result, m_start, t_clock::now() );
+        }
+
+        template<typename t_machine>
+        void record( trace_operation operation, const t_machine& machine, bool result )
+        {
+            m_buffer.record( operation, invalid_state_index, machine.get_trace_depth(), result, m_start, t_clock::now() );
+        }
+
+    private:
+        trace_ring_buffer_base& m_buffer;
+        trace_ring_buffer_base* m_previous;
+        unsigned long long m_start;
+        size_t m_callbacks_count;
+    };
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_single_traced_impl : public state_manipulator_single_combined_impl<t_state_id, t_state, t_state_registry>
+{
+    typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_single_traced_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_single_combined_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+        , m_traced_container_impl( state_container_impl )
+        , m_traced_registry( state_registry )
+    {
+        t_trace_policy::template set_registry<t_state_id>( m_trace, state_registry );
+    }
+
+      // Combined impl has these references in both of its bases
+    t_state_container_impl& m_traced_container_impl;
+    t_state_registry& m_traced_registry;
+    typename t_trace_policy::buffer m_trace;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_single_traced_interface :
+    public state_manipulator_single_combined_interface<t_state_id, t_state, typename t_trace_policy::template enter_exit_policy<t_on_enter_exit_policy>::type, t_context, t_state_registry>
+{
+public:
+    typedef state_manipulator_single_combined_interface<t_state_id, t_state, typename t_trace_policy::template enter_exit_policy<t_on_enter_exit_policy>::type, t_context, t_state_registry> t_combined_interface;
+    typedef state_manipulator_single_traced_impl<t_state_id, t_state, t_trace_policy, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+    typedef typename t_trace_policy::scope trace_scope;
+
+    state_manipulator_single_traced_interface( t_impl& impl )
+        : t_combined_interface( impl )
+        , m_traced_impl( impl )
+    {}
+
+    bool change_state_immediate( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::change_state_immediate( id, ctx );
+        scope.record( trace_change_state, *this, id, result );
+        return result;
+    }
+
+    bool queue_change_state( t_state_id id )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_change_state( id );
+        scope.record( trace_queue_change_state, *this, id, result );
+        return result;
+    }
+
+    void update( context_holder<t_context> ctx )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        t_combined_interface::update( ctx );
+        scope.record( trace_update, *this, true );
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+    const typename t_trace_policy::buffer& get_trace() const { return m_traced_impl.m_trace; }
+    typename t_trace_policy::buffer& get_trace() { return m_traced_impl.m_trace; }
+
+    void export_chrome_trace( std::ostream& out, size_t thread_id = 0 ) const
+    {
+        std::vector<trace_entry> entries;
+        m_traced_impl.m_trace.get_entries( entries );
+        write_chrome_trace( out, entries, m_traced_impl.m_traced_registry, thread_id );
+    }
+
+      // Used by trace policies
+    size_t get_trace_state( const t_state_id& id ) const { return m_traced_impl.m_traced_registry.find_state_index( id ); }
+    size_t get_trace_top_state() const
+    {
+        const state_and_id<t_state_id, t_state>* current_state = m_traced_impl.m_traced_container_impl.m_current_state;
+        return current_state ? m_traced_impl.m_traced_registry.get_state_index( current_state ) : invalid_state_index;
+    }
+    size_t get_trace_depth() const { return m_traced_impl.m_traced_container_impl.m_current_state ? 1 : 0; }
+    size_t get_trace_states_count() const { return m_traced_impl.m_traced_registry.get_states_count(); }
+
+protected:
+    t_impl& m_traced_impl;
+};
+
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
+>
+struct state_manipulator_stacked_traced_impl : public state_manipulator_stacked_combined_impl<t_state_id, t_state, t_state_registry, t_storage_policy>
+{
+    typedef state_container_stacked_impl<t_state_id, t_state, t_storage_policy> t_state_container_impl;
+    state_manipulator_stacked_traced_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_stacked_combined_impl<t_state_id, t_state, t_state_registry, t_storage_policy>( state_container_impl, state_registry )
+        , m_traced_container_impl( state_container_impl )
+        , m_traced_registry( state_registry )
+    {
+        t_trace_policy::template set_registry<t_state_id>( m_trace, state_registry );
+    }
+
+      // Combined impl has these references in both of its bases
+    t_state_container_impl& m_traced_container_impl;
+    t_state_registry& m_traced_registry;
+    typename t_trace_policy::buffer m_trace;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_trace_policy = trace_policy_ring_buffer<>,
+    typename t_state_registry = state_registry<t_state_id, t_state>,
+    typename t_storage_policy = stacked_storage_dynamic
+>
+class state_manipulator_stacked_traced_interface :
+    public state_manipulator_stacked_combined_interface<t_state_id, t_state, typename t_trace_policy::template enter_exit_policy<t_on_enter_exit_policy>::type, t_context, t_state_registry, t_storage_policy>
+{
+public:
+    typedef state_manipulator_stacked_combined_interface<t_state_id, t_state, typename t_trace_policy::template enter_exit_policy<t_on_enter_exit_policy>::type, t_context, t_state_registry, t_storage_policy> t_combined_interface;
+    typedef state_manipulator_stacked_traced_impl<t_state_id, t_state, t_trace_policy, t_state_registry, t_storage_policy> t_impl;
+    typedef t_state_registry t_registry;
+    typedef typename t_trace_policy::scope trace_scope;
+
+    state_manipulator_stacked_traced_interface( t_impl& impl )
+        : t_combined_interface( impl )
+        , m_traced_impl( impl )
+    {}
+
+    bool replace_top_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::replace_top_state( id, ctx );
+        scope.record( trace_replace_top_state, *this, id, result );
+        return result;
+    }
+
+    bool push_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::push_state( id, ctx );
+        scope.record( trace_push_state, *this, id, result );
+        return result;
+    }
+
+    bool insert_state( t_state_id id, size_t position, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::insert_state( id, position, ctx );
+        scope.record( trace_insert_state, *this, id, result );
+        return result;
+    }
+
+    bool pop_state( context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::pop_state( ctx );
+        scope.record( trace_pop_state, *this, result );
+        return result;
+    }
+
+    bool remove_state( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::remove_state( id, ctx );
+        scope.record( trace_remove_state, *this, id, result );
+        return result;
+    }
+
+    bool remove_state_and_all_above( t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::remove_state_and_all_above( id, ctx );
+        scope.record( trace_remove_state_and_all_above, *this, id, result );
+        return result;
+    }
+
+    void remove_all_states( context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        t_combined_interface::remove_all_states( ctx );
+        scope.record( trace_remove_all_states, *this, true );
+    }
+
+    bool queue_push_state( t_state_id id )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_push_state( id );
+        scope.record( trace_queue_push_state, *this, id, result );
+        return result;
+    }
+
+    bool queue_pop_state()
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_pop_state();
+        scope.record( trace_queue_pop_state, *this, result );
+        return result;
+    }
+
+    bool queue_remove_state( t_state_id id )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_remove_state( id );
+        scope.record( trace_queue_remove_state, *this, id, result );
+        return result;
+    }
+
+    bool queue_remove_state_and_all_above( t_state_id id )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_remove_state_and_all_above( id );
+        scope.record( trace_queue_remove_state_and_all_above, *this, id, result );
+        return result;
+    }
+
+    bool queue_remove_all_states()
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        const bool result = t_combined_interface::queue_remove_all_states();
+        scope.record( trace_queue_remove_all_states, *this, result );
+        return result;
+    }
+
+    void update( context_holder<t_context> ctx )
+    {
+        trace_scope scope( m_traced_impl.m_trace, *this );
+        t_combined_interface::update( ctx );
+        scope.record( trace_update, *this, true );
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update(context_holder<void>());
+    }
+
+    const typename t_trace_policy::buffer& get_trace() const { return m_traced_impl.m_trace; }
+    typename t_trace_policy::buffer& get_trace() { return m_traced_impl.m_trace; }
+
+    void export_chrome_trace( std::ostream& out, size_t thread_id = 0 ) const
+    {
+        std::vector<trace_entry> entries;
+        m_traced_impl.m_trace.get_entries( entries );
+        write_chrome_trace( out, entries, m_traced_impl.m_traced_registry, thread_id );
+    }
+
+      // Used by trace policies
+    size_t get_trace_state( const t_state_id& id ) const { return m_traced_impl.m_traced_registry.find_state_index( id ); }
+    size_t get_trace_top_state() const
+    {
+        const typename t_impl::t_state_container_impl::current_states_vector& current_states = m_traced_impl.m_traced_container_impl.m_current_states;
+        return !current_states.empty() ? m_traced_impl.m_traced_registry.get_state_index( current_states[current_states.size() - 1] ) : invalid_state_index;
+    }
+    size_t get_trace_depth() const { return m_traced_impl.m_traced_container_impl.m_current_states.size(); }
+    size_t get_trace_states_count() const { return m_traced_impl.m_traced_registry.get_states_count(); }
+
+protected:
+    t_impl& m_traced_impl;
+};
+
+//----------------------------------------------------------------
+}
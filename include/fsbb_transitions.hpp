@@ -0,0 +1,207 @@
+#pragma once
+
+#include "fsbb_single.hpp"
+
+/*
+    Event-driven single-state manipulator.
+
+    Instead of changing states directly, the user registers transition rules "in state S, event E
+    leads to state T", optionally with a guard, and then dispatches events. Rules are compiled into
+    a dense table indexed by (state index, event index), so dispatching an event costs an event
+    lookup, a table read and guard calls, regardless of the number of rules.
+
+    Rules can be added at any time (for example, when loading machine definitions from resources).
+    The table is rebuilt on the next dispatch after rules, events or states were added.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+  // Guards take the context by reference, so a value context is not copied for every guard call
+template<typename t_context>
+struct transition_guard
+{
+    typedef std::function<bool( typename std::add_lvalue_reference<t_context>::type )> type;
+
+    static bool check( const type& guard, context_holder<t_context>& ctx ) { return !guard || guard( ctx.m_context ); }
+};
+
+template<>
+struct transition_guard<void>
+{
+    typedef std::function<bool()> type;
+
+    static bool check( const type& guard, context_holder<void>& ctx ) { return !guard || guard(); }
+};
+
+//----------------------------------------------------------------
+// State manipulators ( impl; interface )
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_event_id,
+    typename t_context = void,
+    typename t_event_lookup_policy = registry_lookup_linear,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+struct state_manipulator_single_transition_impl : public state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>
+{
+    typedef state_container_single_impl<t_state_id, t_state> t_state_container_impl;
+    state_manipulator_single_transition_impl
+        (
+            t_state_container_impl& state_container_impl,
+            t_state_registry& state_registry
+        )
+        : state_manipulator_single_immediate_impl<t_state_id, t_state, t_state_registry>( state_container_impl, state_registry )
+        , m_table_states_count( 0 )
+        , m_table_dirty( false )
+    {}
+
+    struct event
+    {
+        t_event_id id;
+    };
+
+    struct rule
+    {
+        size_t source;
+        size_t event;
+        size_t target;
+        typename transition_guard<t_context>::type guard;
+        size_t next;
+    };
+
+    std::vector<event> m_events;
+    typename t_event_lookup_policy::template index<t_event_id> m_events_index;
+
+    std::vector<rule> m_rules;
+
+      // m_table[state * events count + event] is the first rule for this pair, the rest are chained through rule::next
+    std::vector<size_t> m_table;
+    size_t m_table_states_count;
+    bool m_table_dirty;
+};
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_event_id,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_event_lookup_policy = registry_lookup_linear,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class state_manipulator_single_transition_interface :
+    public state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>
+{
+public:
+    typedef state_manipulator_single_transition_impl<t_state_id, t_state, t_event_id, t_context, t_event_lookup_policy, t_state_registry> t_impl;
+    typedef t_state_registry t_registry;
+    typedef typename transition_guard<t_context>::type guard_type;
+
+    state_manipulator_single_transition_interface( t_impl& impl )
+        : state_manipulator_single_immediate_interface<t_state_id, t_state, t_on_enter_exit_policy, t_context, t_state_registry>( impl )
+        , m_impl( impl )
+    {}
+
+      // Adds a rule: when "event" is dispatched in state "source", and guard (if any) returns true,
+      // the machine changes state to "target". Rules for the same state and event are checked in
+      // order of addition. Both states must be already registered, otherwise returns false.
+    bool add_transition( t_state_id source, t_event_id event, t_state_id target, guard_type guard = guard_type() )
+    {
+        const size_t source_index = m_impl.m_state_registry.find_state_index( source );
+        const size_t target_index = m_impl.m_state_registry.find_state_index( target );
+        if ( source_index == invalid_state_index || target_index == invalid_state_index )
+            return false;
+
+        size_t event_index = m_impl.m_events_index.find( event, m_impl.m_events );
+        if ( event_index == invalid_state_index )
+        {
+            if ( !m_impl.m_events_index.insert( event, m_impl.m_events.size() ) )
+                return false;
+
+            typename t_impl::event e;
+            e.id = event;
+            m_impl.m_events.push_back( e );
+            event_index = m_impl.m_events.size() - 1;
+        }
+
+        typename t_impl::rule r;
+        r.source = source_index;
+        r.event = event_index;
+        r.target = target_index;
+        r.guard = guard;
+        r.next = invalid_state_index;
+        m_impl.m_rules.push_back( r );
+
+        m_impl.m_table_dirty = true;
+
+        return true;
+    }
+
+      // Executes the first matching rule for the current state and the event.
+      // Returns false if there is no current state, or no rule matched.
+    bool dispatch( t_event_id event, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        state_and_id<t_state_id, t_state> *& current_state = m_impl.m_state_container_impl.m_current_state;
+        if ( current_state == 0 )
+            return false;
+
+        const size_t event_index = m_impl.m_events_index.find( event, m_impl.m_events );
+        if ( event_index == invalid_state_index )
+            return false;
+
+        if ( m_impl.m_table_dirty || m_impl.m_table_states_count != m_impl.m_state_registry.get_states_count() )
+            rebuild_table();
+
+        const size_t state_index = m_impl.m_state_registry.get_state_index( current_state );
+        for ( size_t r = m_impl.m_table[state_index * m_impl.m_events.size() + event_index]; r != invalid_state_index; r = m_impl.m_rules[r].next )
+        {
+            const typename t_impl::rule& rule = m_impl.m_rules[r];
+            if ( !transition_guard<t_context>::check( rule.guard, ctx ) )
+                continue;
+
+            t_on_enter_exit_policy::on_exit( *current_state, ctx );
+            current_state = &m_impl.m_state_registry.get_state( rule.target );
+            t_on_enter_exit_policy::on_enter( *current_state, ctx );
+
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t get_events_count() const { return m_impl.m_events.size(); }
+    size_t get_transitions_count() const { return m_impl.m_rules.size(); }
+
+protected:
+    void rebuild_table()
+    {
+        const size_t states_count = m_impl.m_state_registry.get_states_count();
+        const size_t events_count = m_impl.m_events.size();
+
+        m_impl.m_table.assign( states_count * events_count, invalid_state_index );
+
+          // Walking rules backwards and prepending each to its chain keeps rules in order of addition
+        for ( size_t i = m_impl.m_rules.size(); i-- > 0; )
+        {
+            typename t_impl::rule& rule = m_impl.m_rules[i];
+            size_t& first = m_impl.m_table[rule.source * events_count + rule.event];
+            rule.next = first;
+            first = i;
+        }
+
+        m_impl.m_table_states_count = states_count;
+        m_impl.m_table_dirty = false;
+    }
+
+    t_impl& m_impl;
+};
+
+//----------------------------------------------------------------
+}
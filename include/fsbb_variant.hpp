@@ -0,0 +1,77 @@
+#pragma once
+
+#include "fsbb_static.hpp"
+#include <variant>
+
+/*
+    Enter/exit policies for states stored by value as std::variant of concrete state types (requires C++17).
+
+    With enter_exit_policy_notify, states are usually pointers to a base class with virtual on_enter/on_exit,
+    so every call is a pointer chase and an indirect call. When t_state is std::variant<idle, walk, run>, each
+    state object is stored inline in the registry, and enter/exit calls dispatch on the index of the variant
+    to direct (and inlinable) calls of on_enter/on_exit of the concrete type.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+  // Calls enter/exit policy for the alternative which is held by the variant. Like static_state_dispatch,
+  // compiles to a chain of comparisons (or a jump table) instead of std::visit machinery.
+template<typename t_variant, size_t t_index, size_t t_count>
+struct variant_state_dispatch
+{
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_enter( t_variant& state, context_holder<t_context>& ctx )
+    {
+        if ( state.index() == t_index )
+            t_on_enter_exit_policy::on_enter( *std::get_if<t_index>( &state ), ctx );
+        else
+            variant_state_dispatch<t_variant, t_index + 1, t_count>::template on_enter<t_on_enter_exit_policy>( state, ctx );
+    }
+
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_exit( t_variant& state, context_holder<t_context>& ctx )
+    {
+        if ( state.index() == t_index )
+            t_on_enter_exit_policy::on_exit( *std::get_if<t_index>( &state ), ctx );
+        else
+            variant_state_dispatch<t_variant, t_index + 1, t_count>::template on_exit<t_on_enter_exit_policy>( state, ctx );
+    }
+};
+
+template<typename t_variant, size_t t_count>
+struct variant_state_dispatch<t_variant, t_count, t_count>
+{
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_enter( t_variant& state, context_holder<t_context>& ctx ) {}
+
+    template<typename t_on_enter_exit_policy, typename t_context>
+    static void on_exit( t_variant& state, context_holder<t_context>& ctx ) {}
+};
+
+//----------------------------------------------------------------
+// Enter/Exit policies
+//----------------------------------------------------------------
+
+  // Calls on_enter/on_exit of the concrete state held by std::variant state
+template<typename t_state_policy = enter_exit_policy_static_notify>
+struct enter_exit_policy_variant
+{
+    template<typename t_state_id, typename... t_states, typename t_context>
+    static void on_enter( state_and_id<t_state_id, std::variant<t_states...> >& state, context_holder<t_context>& ctx )
+    {
+        variant_state_dispatch<std::variant<t_states...>, 0, sizeof...( t_states )>::template on_enter<t_state_policy>( state.state, ctx );
+    }
+
+    template<typename t_state_id, typename... t_states, typename t_context>
+    static void on_exit( state_and_id<t_state_id, std::variant<t_states...> >& state, context_holder<t_context>& ctx )
+    {
+        variant_state_dispatch<std::variant<t_states...>, 0, sizeof...( t_states )>::template on_exit<t_state_policy>( state.state, ctx );
+    }
+};
+
+typedef enter_exit_policy_variant<> enter_exit_policy_variant_notify;
+
+//----------------------------------------------------------------
+}
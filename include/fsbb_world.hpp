@@ -0,0 +1,224 @@
+#pragma once
+
+#include "fsbb_common.hpp"
+#include <stdint.h>
+
+/*
+    A "world" of many single-state machines that share one registry.
+
+    Instead of one fsm object per entity, the world stores the current and the next state of every
+    instance as registry indices in dense arrays, and applies all queued changes of state in a single
+    update() call. Instances are identified by the index returned from create_instance().
+
+    Since the world keeps indices rather than pointers, registering new states never invalidates it.
+*/
+
+namespace fsbb
+{
+//----------------------------------------------------------------
+
+template
+<
+    typename t_state_id,
+    typename t_state,
+    typename t_on_enter_exit_policy = enter_exit_policy_default,
+    typename t_context = void,
+    typename t_state_registry = state_registry<t_state_id, t_state>
+>
+class fsm_single_world : public t_state_registry
+{
+public:
+    typedef t_state_registry t_registry;
+
+    size_t create_instance()
+    {
+        m_current_states.push_back( invalid_state_index );
+        m_next_states.push_back( invalid_state_index );
+        return m_current_states.size() - 1;
+    }
+
+    void reserve_instances( size_t count )
+    {
+        m_current_states.reserve( count );
+        m_next_states.reserve( count );
+        m_pending.reserve( count );
+    }
+
+    size_t get_instances_count() const { return m_current_states.size(); }
+
+    size_t get_current_state_index( size_t instance ) const { return m_current_states[instance]; }
+
+    t_state_id get_current_state_id( size_t instance )
+    {
+        const size_t index = m_current_states[instance];
+        return index != invalid_state_index ? this->get_state( index ).id : t_state_id();
+    }
+
+    const t_state get_current_state( size_t instance )
+    {
+        const size_t index = m_current_states[instance];
+        return index != invalid_state_index ? this->get_state( index ).state : 0;
+    }
+
+    bool change_state_immediate( size_t instance, t_state_id id, context_holder<t_context> ctx = context_holder<t_context>() )
+    {
+        const size_t new_state = this->find_state_index( id );
+        if ( new_state == invalid_state_index )
+            return false;
+
+        change_state_by_index( instance, new_state, ctx );
+
+        return true;
+    }
+
+      // As with single-state queued manipulator, only the last queued change of state is executed
+    bool queue_change_state( size_t instance, t_state_id id )
+    {
+        const size_t new_state = this->find_state_index( id );
+        if ( new_state == invalid_state_index )
+            return false;
+
+        queue_change_state_by_index( instance, new_state );
+
+        return true;
+    }
+
+      // Queues transitions of all instances for the event along a batch_transition_table, see fsbb_batch.hpp.
+      // Instances without a transition from their current state are not changed. Returns the number of queued changes.
+    template<typename t_transition_table>
+    size_t queue_dispatch( t_transition_table& table, const typename t_transition_table::event_id& event )
+    {
+        return queue_dispatch( table, 0, m_current_states.size(), event );
+    }
+
+      // The same for "count" instances listed in "instances"
+    template<typename t_transition_table>
+    size_t queue_dispatch( t_transition_table& table, const size_t* instances, size_t count, const typename t_transition_table::event_id& event )
+    {
+        const size_t event_index = table.find_event_index( event );
+        if ( event_index == invalid_state_index || m_current_states.empty() )
+            return 0;
+
+        table.prepare( this->get_states_count() );
+        return table.find_targets( &m_current_states[0], instances, count, 0, event_index,
+            [this]( size_t instance, size_t target ) { queue_change_state_by_index( instance, target ); } );
+    }
+
+      // Queues transitions of every instance for its own event, events[i] for instance i
+    template<typename t_transition_table>
+    size_t queue_dispatch( t_transition_table& table, const typename t_transition_table::event_id* events )
+    {
+        if ( m_current_states.empty() )
+            return 0;
+
+        table.prepare( this->get_states_count() );
+        const uint32_t* event_indices = table.find_event_indices( events, m_current_states.size() );
+        return table.find_targets( &m_current_states[0], 0, m_current_states.size(), event_indices, 0,
+            [this]( size_t instance, size_t target ) { queue_change_state_by_index( instance, target ); } );
+    }
+
+    void update( context_holder<t_context> ctx )
+    {
+        for ( size_t i = 0; i < m_pending.size(); ++i )
+        {
+            const size_t instance = m_pending[i];
+            const size_t next_state = m_next_states[instance];
+            m_next_states[instance] = invalid_state_index;
+
+            change_state_by_index( instance, next_state, ctx );
+        }
+
+        m_pending.clear();
+    }
+
+    template<typename T = t_context>
+    typename std::enable_if<std::is_void<T>::value, void>::type update()
+    {
+        update( context_holder<void>() );
+    }
+
+      // Binary snapshot of current and queued states of all instances, see fsbb_snapshot.hpp
+    template<typename t_snapshot_writer>
+    void save_snapshot( t_snapshot_writer& writer ) const
+    {
+        writer.write_count( m_current_states.size() );
+        for ( size_t i = 0; i < m_current_states.size(); ++i )
+            writer.write_index( m_current_states[i] );
+
+        writer.write_count( m_pending.size() );
+        for ( size_t i = 0; i < m_pending.size(); ++i )
+        {
+            writer.write_count( m_pending[i] );
+            writer.write_index( m_next_states[m_pending[i]] );
+        }
+    }
+
+      // Replaces all instances, without calling enter/exit functions. If the snapshot is invalid,
+      // returns false and keeps no instances.
+    template<typename t_snapshot_reader>
+    bool restore_snapshot( t_snapshot_reader& reader )
+    {
+        size_t count;
+        if ( !reader.read_count( count ) || count * 4 > reader.get_remaining() )
+            return false;
+
+        m_current_states.resize( count );
+        m_next_states.assign( count, invalid_state_index );
+        m_pending.clear();
+
+        bool valid = true;
+        for ( size_t i = 0; i < count && valid; ++i )
+            valid = reader.read_index( m_current_states[i], this->get_states_count() );
+
+        size_t pending = 0;
+        valid = valid && reader.read_count( pending ) && pending <= count;
+        for ( size_t i = 0; i < pending && valid; ++i )
+        {
+            size_t instance, next_state;
+            valid = reader.read_count( instance ) && instance < count && m_next_states[instance] == invalid_state_index
+                && reader.read_index( next_state, this->get_states_count() ) && next_state != invalid_state_index;
+
+            if ( valid )
+            {
+                m_next_states[instance] = next_state;
+                m_pending.push_back( instance );
+            }
+        }
+
+        if ( !valid )
+        {
+            m_current_states.clear();
+            m_next_states.clear();
+            m_pending.clear();
+        }
+
+        return valid;
+    }
+
+protected:
+    void queue_change_state_by_index( size_t instance, size_t new_state )
+    {
+        if ( m_next_states[instance] == invalid_state_index )
+            m_pending.push_back( instance );
+
+        m_next_states[instance] = new_state;
+    }
+
+    void change_state_by_index( size_t instance, size_t new_state, context_holder<t_context>& ctx )
+    {
+        size_t& current_state = m_current_states[instance];
+        if ( current_state != invalid_state_index )
+            t_on_enter_exit_policy::on_exit( this->get_state( current_state ), ctx );
+
+        current_state = new_state;
+
+        t_on_enter_exit_policy::on_enter( this->get_state( current_state ), ctx );
+    }
+
+    std::vector<size_t> m_current_states;
+    std::vector<size_t> m_next_states;
+    std::vector<size_t> m_pending;
+};
+
+//----------------------------------------------------------------
+}
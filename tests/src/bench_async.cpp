@@ -0,0 +1,102 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+
+using namespace fsbb;
+
+/*
+    Overhead of the asynchronous manipulator (C++20), compared with the combined one: transitions
+    between states with plain enter/exit functions, and with an on_enter coroutine which suspends
+    for one frame, so every transition is advanced by two updates.
+*/
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+#if __cplusplus >= 202002L
+
+static const size_t TRANSITIONS = 1 << 18;
+static const size_t STATES = 8;
+
+class plain_state
+{
+public:
+    void on_enter( async_executor& executor ) { ++m_counter; }
+    void on_exit( async_executor& executor ) { --m_counter; }
+
+    size_t m_counter = 0;
+};
+
+class suspending_state
+{
+public:
+    async_task on_enter( async_executor& executor )
+    {
+        ++m_counter;
+        co_await executor.schedule();
+    }
+
+    void on_exit( async_executor& executor ) { --m_counter; }
+
+    size_t m_counter = 0;
+};
+
+template<typename t_state>
+static void bench_async_states( const char* variant )
+{
+    std::vector<t_state> states( STATES );
+    fsm_single_async<int, t_state*, async_executor&, state_registry<int, t_state*, registry_lookup_direct> > machine;
+    for ( size_t i = 0; i < STATES; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+    async_executor executor;
+
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+    {
+        machine.change_state( (int)( i % STATES ) );
+        machine.update( executor );
+        if ( executor.run() != 0 )
+            machine.update( executor );
+    }
+    report( "async", variant, STATES, sample.stop( TRANSITIONS ) );
+
+    do_not_optimize( states[0].m_counter );
+}
+
+static void bench_combined()
+{
+    std::vector<plain_state> states( STATES );
+    async_executor executor;
+    fsm_single_combined_enter_exit<int, plain_state*, async_executor&, state_registry<int, plain_state*, registry_lookup_direct> > machine;
+    for ( size_t i = 0; i < STATES; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+    {
+        machine.queue_change_state( (int)( i % STATES ) );
+        machine.update( executor );
+    }
+    report( "async", "fsm_single_combined_enter_exit, plain", STATES, sample.stop( TRANSITIONS ) );
+
+    do_not_optimize( states[0].m_counter );
+}
+
+void bench_async()
+{
+    bench_combined();
+    bench_async_states<plain_state>( "fsm_single_async, plain" );
+    bench_async_states<suspending_state>( "fsm_single_async, suspending on_enter" );
+}
+
+#else
+
+  // fsm_single_async requires C++20
+void bench_async() {}
+
+#endif
+
+//----------------------------------------------------------------
+}
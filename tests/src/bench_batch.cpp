@@ -0,0 +1,129 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t INSTANCES = 50000;
+static const size_t FRAMES = 20;
+static const int STATES = 8;
+
+  // A quarter of the instances is calm or alarmed, and changes state on both events of every frame.
+  // The rest are in states which have no transitions for these events. No instance is fleeing, so
+  // the panic event only measures the cost of finding targets.
+enum { calm_state = 0, alarmed_state = 1, fleeing_state = STATES };
+enum { alarm_event = 1, calm_event = 2, panic_event = 3 };
+
+class crowd_state
+{
+public:
+    crowd_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+static std::vector<int> make_initial_states()
+{
+    std::vector<int> initial( INSTANCES );
+    srand( 42 );
+    for ( size_t i = 0; i < INSTANCES; ++i )
+        initial[i] = rand() % STATES;
+
+    return initial;
+}
+
+//----------------------------------------------------------------
+
+static void bench_individual( crowd_state* states )
+{
+    const std::vector<int> initial = make_initial_states();
+
+    typedef fsm_single_transition_enter_exit<int, crowd_state*, int, int> machine;
+    std::vector<machine> machines( INSTANCES );
+    for ( size_t i = 0; i < INSTANCES; ++i )
+    {
+        for ( int j = 0; j < STATES; ++j )
+            machines[i].register_state( j, &states[j] );
+
+        machines[i].add_transition( calm_state, alarm_event, alarmed_state );
+        machines[i].add_transition( alarmed_state, calm_event, calm_state );
+        machines[i].change_state_immediate( initial[i], 1 );
+    }
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            machines[i].dispatch( alarm_event, 1 );
+
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            machines[i].dispatch( calm_event, 1 );
+    }
+    const measurement result = sample.stop( INSTANCES * FRAMES * 2 );
+
+    report( "batch", "fsm_single_transition_enter_exit per-machine dispatch", INSTANCES, result );
+}
+
+static void bench_world_batch( crowd_state* states, bool vectorized )
+{
+    const std::vector<int> initial = make_initial_states();
+
+    fsm_single_world_enter_exit<int, crowd_state*, int> world;
+    for ( int j = 0; j <= STATES; ++j )
+        world.register_state( j, &states[j] );
+
+    world.reserve_instances( INSTANCES );
+    for ( size_t i = 0; i < INSTANCES; ++i )
+        world.change_state_immediate( world.create_instance(), initial[i], 1 );
+
+    batch_transition_table<int> table;
+    table.add_transition( world, calm_state, alarm_event, alarmed_state );
+    table.add_transition( world, alarmed_state, calm_event, calm_state );
+    table.add_transition( world, fleeing_state, panic_event, calm_state );
+    table.set_vectorized( vectorized );
+    if ( vectorized && !table.is_vectorized() )
+        return;
+
+    const char* variant = vectorized ? "fsm_single_world queue_dispatch avx2" : "fsm_single_world queue_dispatch scalar";
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        world.queue_dispatch( table, alarm_event );
+        world.update( 1 );
+
+        world.queue_dispatch( table, calm_event );
+        world.update( 1 );
+    }
+    const measurement result = sample.stop( INSTANCES * FRAMES * 2 );
+    report( "batch", variant, INSTANCES, result );
+
+    size_t queued = 0;
+    measure no_changes;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+        queued += world.queue_dispatch( table, panic_event );
+    const measurement no_changes_result = no_changes.stop( INSTANCES * FRAMES );
+
+    do_not_optimize( queued );
+    report( "batch", vectorized ? "fsm_single_world queue_dispatch avx2, no changes" : "fsm_single_world queue_dispatch scalar, no changes", INSTANCES, no_changes_result );
+}
+
+void bench_batch()
+{
+    std::vector<crowd_state> states( STATES + 1 );
+
+    bench_individual( &states[0] );
+    bench_world_batch( &states[0], false );
+    bench_world_batch( &states[0], true );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,127 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+  // State types named by codegen_locomotion.fsm
+template<int t_id>
+struct recorded_state
+{
+    void on_enter( size_t& callbacks ) { callbacks += t_id; }
+    void on_exit( size_t& callbacks ) { callbacks -= t_id - 1; }
+};
+
+#include "codegen_locomotion.hpp"
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t OPS = 1 << 22;
+
+class runtime_state
+{
+public:
+    runtime_state( int id ) : m_id( id ) {}
+
+    void on_enter( size_t& callbacks ) { callbacks += m_id; }
+    void on_exit( size_t& callbacks ) { callbacks -= m_id - 1; }
+
+private:
+    size_t m_id;
+};
+
+struct graph_recorded_policy
+{
+    static void on_enter( graph_state& state, context_holder<size_t&>& ctx ) { ctx.m_context += state.id; }
+    static void on_exit( graph_state& state, context_holder<size_t&>& ctx ) { ctx.m_context -= state.id - 1; }
+};
+
+  // Random, but reproducible, order of queries
+static std::vector<int> make_queries( int first, int count )
+{
+    std::vector<int> queries( 4096 );
+    srand( 42 );
+    for ( size_t i = 0; i < queries.size(); ++i )
+        queries[i] = first + rand() % count;
+
+    return queries;
+}
+
+template<typename t_machine>
+static void bench_change_state( const char* variant, t_machine& machine )
+{
+    const std::vector<int> queries = make_queries( 1, 4 );
+
+    size_t callbacks = 0;
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        machine.change_state_immediate( queries[i & ( queries.size() - 1 )], callbacks );
+    const measurement result = sample.stop( OPS );
+
+    do_not_optimize( callbacks );
+    report( "codegen", variant, 4, result );
+}
+
+template<typename t_machine>
+static void bench_dispatch( const char* variant, t_machine& machine )
+{
+    const std::vector<int> queries = make_queries( 1, 5 );
+
+    size_t callbacks = 0;
+    machine.change_state_immediate( locomotion_states::idle, callbacks );
+
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        machine.dispatch( queries[i & ( queries.size() - 1 )], callbacks );
+    const measurement result = sample.stop( OPS );
+
+    do_not_optimize( callbacks );
+    report( "codegen", variant, 4, result );
+}
+
+void bench_codegen()
+{
+    locomotion_fsm<size_t&> generated;
+
+    fsm_single_combined_enter_exit<int, runtime_state*, size_t&> runtime;
+    std::vector<runtime_state> states;
+    for ( int i = 1; i <= 4; ++i )
+        states.push_back( runtime_state( i ) );
+    for ( int i = 1; i <= 4; ++i )
+        runtime.register_state( i, &states[i - 1] );
+
+      // The same transitions as codegen_locomotion.fsm
+    state_graph_builder builder;
+    const char* state_names[] = { "idle", "walk", "run", "jump" };
+    for ( int i = 1; i <= 4; ++i )
+        builder.add_state( i, state_names[i - 1] );
+    const char* event_names[] = { "move", "sprint", "stop", "jump", "land" };
+    for ( int i = 1; i <= 5; ++i )
+        builder.add_event( i, event_names[i - 1] );
+    for ( int state = 1; state <= 4; ++state )
+    {
+        for ( int event = 1; event <= 5; ++event )
+        {
+            const int target = locomotion_manipulator_interface<>::get_transition_target( state, event );
+            if ( target != 0 )
+                builder.add_transition( state, event, target );
+        }
+    }
+
+    std::vector<unsigned char> blob;
+    builder.build( blob );
+
+    fsm_single_graph<graph_recorded_policy, size_t&> graph;
+    graph.attach( &blob[0], blob.size() );
+
+    bench_change_state( "generated change_state_immediate", generated );
+    bench_change_state( "fsm_single_combined_enter_exit change_state_immediate", runtime );
+    bench_dispatch( "generated dispatch", generated );
+    bench_dispatch( "fsm_single_graph dispatch", graph );
+}
+
+//----------------------------------------------------------------
+}
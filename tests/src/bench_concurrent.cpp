@@ -0,0 +1,117 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t ACTIONS_PER_PRODUCER = 1 << 18;
+
+class screen_state
+{
+public:
+    void on_enter() {}
+    void on_exit() {}
+};
+
+//----------------------------------------------------------------
+
+  // Baseline: non-concurrent machine, with queue_* and update() serialized by a mutex
+static void bench_mutex( size_t producers_count )
+{
+    fsm_stacked_combined_enter_exit<int, screen_state*> machine;
+    screen_state states[2];
+    machine.register_state( 0, &states[0] );
+    machine.register_state( 1, &states[1] );
+
+    std::mutex lock;
+    std::atomic<size_t> finished( 0 );
+    std::vector<std::thread> producers;
+
+    measure sample;
+    for ( size_t p = 0; p < producers_count; ++p )
+    {
+        producers.push_back( std::thread( [&]{
+            for ( size_t i = 0; i < ACTIONS_PER_PRODUCER; i += 2 )
+            {
+                std::lock_guard<std::mutex> guard( lock );
+                machine.queue_push_state( 1 );
+                machine.queue_remove_state( 1 );
+            }
+            ++finished;
+        } ) );
+    }
+
+    while ( finished != producers_count )
+    {
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            machine.update();
+        }
+        std::this_thread::yield();
+    }
+
+    for ( size_t p = 0; p < producers.size(); ++p )
+        producers[p].join();
+    machine.update();
+
+    const measurement result = sample.stop( ACTIONS_PER_PRODUCER * producers_count );
+    report( "concurrent_queue", "mutex + fsm_stacked_combined", producers_count, result );
+}
+
+static void bench_ring( size_t producers_count )
+{
+    fsm_stacked_concurrent_enter_exit<int, screen_state*, void, 4096> machine;
+    screen_state states[2];
+    machine.register_state( 0, &states[0] );
+    machine.register_state( 1, &states[1] );
+
+    std::atomic<size_t> finished( 0 );
+    std::vector<std::thread> producers;
+
+    measure sample;
+    for ( size_t p = 0; p < producers_count; ++p )
+    {
+        producers.push_back( std::thread( [&]{
+            for ( size_t i = 0; i < ACTIONS_PER_PRODUCER; i += 2 )
+            {
+                while ( !machine.queue_push_state( 1 ) ) std::this_thread::yield();
+                while ( !machine.queue_remove_state( 1 ) ) std::this_thread::yield();
+            }
+            ++finished;
+        } ) );
+    }
+
+    while ( finished != producers_count )
+    {
+        machine.update();
+        std::this_thread::yield();
+    }
+
+    for ( size_t p = 0; p < producers.size(); ++p )
+        producers[p].join();
+    machine.update();
+
+    const measurement result = sample.stop( ACTIONS_PER_PRODUCER * producers_count );
+    report( "concurrent_queue", "fsm_stacked_concurrent", producers_count, result );
+}
+
+void bench_concurrent()
+{
+    const size_t producers[] = { 1, 2, 4 };
+
+    for ( size_t i = 0; i < sizeof( producers ) / sizeof( producers[0] ); ++i )
+    {
+        bench_mutex( producers[i] );
+        bench_ring( producers[i] );
+    }
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,79 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <stdio.h>
+#include <string.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t FRAMES = 1 << 16;
+static const size_t DEPTH = 8;
+
+static size_t g_context_copies = 0;
+
+  // A heavyweight context, which counts its copies
+struct big_context
+{
+    big_context() { memset( m_data, 0, sizeof( m_data ) ); }
+    big_context( const big_context& other ) { memcpy( m_data, other.m_data, sizeof( m_data ) ); ++g_context_copies; }
+
+    size_t m_data[256 / sizeof( size_t )];
+};
+
+class context_state
+{
+public:
+    context_state() : m_sum( 0 ) {}
+
+    void on_enter( const big_context& ctx ) { m_sum += ctx.m_data[0]; }
+    void on_exit( const big_context& ctx ) { m_sum += ctx.m_data[1]; }
+
+    size_t m_sum;
+};
+
+//----------------------------------------------------------------
+
+  // A frame queues pushes of all states, applies them in one update, and removes them all
+template<typename t_context>
+static void bench_context_passing( const char* context_name )
+{
+    context_state states[DEPTH];
+    fsm_stacked_combined_enter_exit<int, context_state*, t_context, state_registry<int, context_state*, registry_lookup_direct> > machine;
+    for ( size_t i = 0; i < DEPTH; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+    big_context ctx;
+    g_context_copies = 0;
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < DEPTH; ++i )
+            machine.queue_push_state( (int)i );
+
+        machine.update( ctx );
+        machine.remove_all_states( ctx );
+    }
+    const measurement result = sample.stop( FRAMES );
+
+    char variant[64];
+    snprintf( variant, sizeof( variant ), "%s, %.1f copies/op", context_name, (double)g_context_copies / FRAMES );
+    report( "context passing", variant, DEPTH, result );
+
+    size_t sum = 0;
+    for ( size_t i = 0; i < DEPTH; ++i )
+        sum += states[i].m_sum;
+    do_not_optimize( sum );
+}
+
+void bench_context()
+{
+    bench_context_passing<big_context>( "big_context" );
+    bench_context_passing<big_context&>( "big_context&" );
+}
+
+//----------------------------------------------------------------
+}
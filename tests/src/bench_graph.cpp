@@ -0,0 +1,127 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t STATES = 4096;
+static const size_t EVENTS = 4;
+static const size_t LOADS = 16;
+static const size_t OPS = 1 << 20;
+
+static graph_id get_target( size_t state, size_t event ) { return (graph_id)( ( state * 7 + event + 1 ) % STATES ); }
+
+typedef fsm
+<
+    graph_id,
+    graph_id,
+    state_container_single_interface<graph_id, graph_id>,
+    state_manipulator_single_transition_interface<graph_id, graph_id, graph_id, enter_exit_policy_default, void, registry_lookup_direct, state_registry<graph_id, graph_id, registry_lookup_hashed<> > >
+> rules_machine;
+
+  // Loading registers every state and every transition rule, and builds the table on the first dispatch
+static void bench_rules()
+{
+    measurement load_result;
+    {
+        std::vector<rules_machine*> machines( LOADS );
+
+        measure sample;
+        for ( size_t m = 0; m < LOADS; ++m )
+        {
+            machines[m] = new rules_machine();
+            rules_machine& machine = *machines[m];
+            machine.reserve( STATES );
+            for ( size_t i = 0; i < STATES; ++i )
+                machine.register_state( (graph_id)i, (graph_id)i );
+            for ( size_t i = 0; i < STATES; ++i )
+                for ( size_t e = 0; e < EVENTS; ++e )
+                    machine.add_transition( (graph_id)i, (graph_id)e, get_target( i, e ) );
+
+            machine.change_state_immediate( 0 );
+            machine.dispatch( 0 );
+        }
+        load_result = sample.stop( LOADS );
+
+        for ( size_t m = 0; m < LOADS; ++m )
+            delete machines[m];
+    }
+
+    rules_machine machine;
+    for ( size_t i = 0; i < STATES; ++i )
+        machine.register_state( (graph_id)i, (graph_id)i );
+    for ( size_t i = 0; i < STATES; ++i )
+        for ( size_t e = 0; e < EVENTS; ++e )
+            machine.add_transition( (graph_id)i, (graph_id)e, get_target( i, e ) );
+    machine.change_state_immediate( 0 );
+
+    bool dispatched = true;
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        dispatched = machine.dispatch( (graph_id)( i % EVENTS ) ) && dispatched;
+    const measurement dispatch_result = sample.stop( OPS );
+
+    report( "graph", "transition rules, load", STATES, load_result );
+    report( "graph", "transition rules, dispatch", STATES, dispatch_result );
+    do_not_optimize( dispatched );
+}
+
+  // Loading attaches the machine to a blob which is already in memory, as with a mapped file
+static void bench_blob()
+{
+    state_graph_builder builder;
+    for ( size_t i = 0; i < STATES; ++i )
+        builder.add_state( (graph_id)i );
+    for ( size_t e = 0; e < EVENTS; ++e )
+        builder.add_event( (graph_id)e );
+    for ( size_t i = 0; i < STATES; ++i )
+        for ( size_t e = 0; e < EVENTS; ++e )
+            builder.add_transition( (graph_id)i, (graph_id)e, get_target( i, e ) );
+
+    std::vector<unsigned char> blob;
+    builder.build( blob );
+
+    measurement load_result;
+    {
+        std::vector<fsm_single_graph<>*> machines( LOADS );
+
+        measure sample;
+        for ( size_t m = 0; m < LOADS; ++m )
+        {
+            machines[m] = new fsm_single_graph<>();
+            machines[m]->attach( &blob[0], blob.size() );
+            machines[m]->change_state_immediate( 0 );
+            machines[m]->dispatch( 0 );
+        }
+        load_result = sample.stop( LOADS );
+
+        for ( size_t m = 0; m < LOADS; ++m )
+            delete machines[m];
+    }
+
+    fsm_single_graph<> machine;
+    machine.attach( &blob[0], blob.size() );
+    machine.change_state_immediate( 0 );
+
+    bool dispatched = true;
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        dispatched = machine.dispatch( (graph_id)( i % EVENTS ) ) && dispatched;
+    const measurement dispatch_result = sample.stop( OPS );
+
+    report( "graph", "fsm_single_graph, load", STATES, load_result );
+    report( "graph", "fsm_single_graph, dispatch", STATES, dispatch_result );
+    do_not_optimize( dispatched );
+}
+
+void bench_graph()
+{
+    bench_rules();
+    bench_blob();
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,74 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t TRANSITIONS = 1 << 20;
+
+class nested_state
+{
+public:
+    void on_enter( size_t& callbacks ) { ++callbacks; }
+    void on_exit( size_t& callbacks ) { ++callbacks; }
+};
+
+  // A tree with "branching" children per state and "depth" levels. Transitions go between random leaves.
+static void bench_tree( size_t branching, size_t depth )
+{
+    fsm_hierarchical_immediate_enter_exit<int, nested_state*, size_t&, state_registry<int, nested_state*, registry_lookup_direct> > machine;
+
+    size_t states_count = 0;
+    size_t level_size = 1;
+    for ( size_t level = 0; level < depth; ++level )
+    {
+        level_size *= branching;
+        states_count += level_size;
+    }
+
+    std::vector<nested_state> states( states_count );
+    for ( size_t i = 0; i < states_count; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+      // States are numbered level by level, children of state i are branching * ( i + 1 ) + j
+    for ( size_t i = 0; branching * ( i + 1 ) < states_count; ++i )
+        for ( size_t j = 0; j < branching; ++j )
+            machine.set_parent( (int)( branching * ( i + 1 ) + j ), (int)i );
+
+    const size_t leaves = level_size;
+    std::vector<int> queries( 4096 );
+    srand( 42 );
+    for ( size_t i = 0; i < queries.size(); ++i )
+        queries[i] = (int)( states_count - leaves + rand() % leaves );
+
+    size_t callbacks = 0;
+    for ( size_t i = 0; i < queries.size(); ++i )
+        machine.change_state_immediate( queries[i], callbacks );
+
+    callbacks = 0;
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+        machine.change_state_immediate( queries[i & ( queries.size() - 1 )], callbacks );
+    const measurement result = sample.stop( TRANSITIONS );
+
+    char variant[64];
+    snprintf( variant, sizeof( variant ), "branching %u, %.2f calls/op", (unsigned)branching, (double)callbacks / TRANSITIONS );
+    report( "hierarchical", variant, depth, result );
+}
+
+void bench_hierarchical()
+{
+    bench_tree( 4, 1 );
+    bench_tree( 4, 3 );
+    bench_tree( 4, 5 );
+    bench_tree( 2, 8 );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,86 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t FRAMES = 100000;
+
+class named_state
+{
+public:
+    void on_enter( size_t& callbacks ) { ++callbacks; }
+    void on_exit( size_t& callbacks ) { ++callbacks; }
+};
+
+  // Data-driven names, longer than the small string buffer, as they are usually loaded from files
+static std::string get_state_name( size_t i )
+{
+    char name[64];
+    snprintf( name, sizeof( name ), "characters/player/locomotion/state_%u", (unsigned)i );
+    return name;
+}
+
+//----------------------------------------------------------------
+
+  // Every frame a few states are pushed through the queue and removed by id, as gameplay scripts do it
+template<typename t_state_id, typename t_state_registry>
+static void bench_ids( const char* variant, size_t states_count, const std::vector<t_state_id>& ids )
+{
+    std::vector<named_state> states( states_count );
+
+    fsm_stacked_combined_enter_exit<t_state_id, named_state*, size_t&, t_state_registry> m;
+    m.reserve( states_count );
+    for ( size_t i = 0; i < states_count; ++i )
+        m.register_state( ids[i], &states[i] );
+
+    size_t callbacks = 0;
+    m.push_state( ids[0], callbacks );
+
+    const size_t STEPS = 4;
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 1; i <= STEPS; ++i )
+            m.queue_push_state( ids[( frame * 7 + i * 13 ) % ( states_count - 1 ) + 1] );
+        m.update( callbacks );
+
+        while ( m.get_current_states().size() > 1 )
+            m.remove_state( m.get_top_state_id(), callbacks );
+    }
+    const measurement result = sample.stop( FRAMES );
+
+    do_not_optimize( callbacks );
+    report( "interned_ids", variant, states_count, result );
+}
+
+void bench_interned()
+{
+    const size_t sizes[] = { 16, 256 };
+
+    for ( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+    {
+        std::vector<std::string> names;
+        std::vector<interned_id> ids;
+        for ( size_t j = 0; j < sizes[i]; ++j )
+        {
+            names.push_back( get_state_name( j ) );
+            ids.push_back( intern( names.back() ) );
+        }
+
+        bench_ids<std::string, state_registry<std::string, named_state*> >( "string linear frame", sizes[i], names );
+        bench_ids<std::string, state_registry<std::string, named_state*, registry_lookup_hashed<> > >( "string hashed frame", sizes[i], names );
+        bench_ids<interned_id, state_registry<interned_id, named_state*> >( "interned linear frame", sizes[i], ids );
+        bench_ids<interned_id, state_registry<interned_id, named_state*, registry_lookup_hashed<> > >( "interned hashed frame", sizes[i], ids );
+        bench_ids<interned_id, state_registry<interned_id, named_state*, registry_lookup_direct> >( "interned direct frame", sizes[i], ids );
+    }
+}
+
+//----------------------------------------------------------------
+}
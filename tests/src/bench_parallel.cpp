@@ -0,0 +1,73 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include "fsbb_parallel.hpp"
+#include <thread>
+#include <vector>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t MACHINES = 200000;
+static const size_t FRAMES = 10;
+static const size_t CHUNK_SIZE = 1024;
+
+struct worker_context
+{
+    worker_context() : enters( 0 ) {}
+
+    size_t enters;
+    char padding[64];
+};
+
+class actor_state
+{
+public:
+    void on_enter( worker_context& ctx ) { ++ctx.enters; }
+    void on_exit( worker_context& ctx ) {}
+};
+
+typedef fsm_single_queued_enter_exit<int, actor_state*, worker_context&> actor_machine;
+
+//----------------------------------------------------------------
+
+static void bench_threads( std::vector<actor_machine>& machines, size_t threads_count )
+{
+    parallel_update_pool pool( threads_count );
+    std::vector<worker_context> contexts( pool.get_workers_count() );
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < machines.size(); ++i )
+            machines[i].queue_change_state( (int)( ( i + frame ) & 3 ) );
+
+        update_parallel( pool, machines.begin(), machines.end(), contexts, CHUNK_SIZE );
+    }
+    const measurement result = sample.stop( machines.size() * FRAMES );
+
+    do_not_optimize( contexts[0].enters );
+    report( "parallel_update", "threads", threads_count, result );
+}
+
+void bench_parallel()
+{
+    actor_state states[4];
+    std::vector<actor_machine> machines( MACHINES );
+    for ( size_t i = 0; i < machines.size(); ++i )
+    {
+        for ( int j = 0; j < 4; ++j )
+            machines[i].register_state( j, &states[j] );
+    }
+
+    const size_t max_threads = std::thread::hardware_concurrency() != 0 ? std::thread::hardware_concurrency() : 1;
+    for ( size_t threads = 1; threads < max_threads; threads *= 2 )
+        bench_threads( machines, threads );
+
+    bench_threads( machines, max_threads );
+}
+
+//----------------------------------------------------------------
+}
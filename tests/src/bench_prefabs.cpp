@@ -0,0 +1,420 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+/*
+    Transition, lookup and queued update costs of every pre-fabricated machine.
+
+    Single-state machines are measured with different numbers of registered states (which affects
+    lookup cost), and stacked-state machines with different stack depths. Each of them is measured
+    with int, enum and std::string state ids, and with raw pointer, shared_ptr and value states.
+    One operation is one change of state, one push or pop, or one queued action.
+*/
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t OPS = 1 << 16;
+static const size_t WARMUP_OPS = 1 << 10;
+static const size_t QUERIES = 4096;
+
+class bench_state
+{
+public:
+    bench_state() : m_counter( 0 ) {}
+
+    void on_enter( size_t& callbacks ) { ++callbacks; ++m_counter; }
+    void on_exit( size_t& callbacks ) { ++callbacks; --m_counter; }
+
+      // Lets enter/exit policies call the state the same way whether it is stored by pointer or by value
+    bench_state* operator->() { return this; }
+
+    int m_counter;
+};
+
+enum bench_state_id {};
+
+template<int t_index>
+class static_bench_state : public bench_state
+{
+};
+
+//----------------------------------------------------------------
+// Id and state types
+//----------------------------------------------------------------
+
+template<typename t_id>
+struct id_traits;
+
+template<>
+struct id_traits<int>
+{
+    static const char* name() { return "int"; }
+    static int make( size_t i ) { return (int)i; }
+};
+
+template<>
+struct id_traits<bench_state_id>
+{
+    static const char* name() { return "enum"; }
+    static bench_state_id make( size_t i ) { return (bench_state_id)i; }
+};
+
+template<>
+struct id_traits<std::string>
+{
+    static const char* name() { return "string"; }
+    static std::string make( size_t i )
+    {
+        char buffer[32];
+        snprintf( buffer, sizeof( buffer ), "state_%u", (unsigned)i );
+        return buffer;
+    }
+};
+
+template<typename t_state>
+struct state_traits;
+
+template<>
+struct state_traits<bench_state*>
+{
+    static const char* name() { return "ptr"; }
+    static bench_state* make( bench_state& storage ) { return &storage; }
+};
+
+template<>
+struct state_traits<std::shared_ptr<bench_state> >
+{
+    static const char* name() { return "shared_ptr"; }
+    static std::shared_ptr<bench_state> make( bench_state& storage ) { return std::make_shared<bench_state>(); }
+};
+
+template<>
+struct state_traits<bench_state>
+{
+    static const char* name() { return "value"; }
+    static bench_state make( bench_state& storage ) { return bench_state(); }
+};
+
+//----------------------------------------------------------------
+
+  // Ids, states and a random, but reproducible, sequence of states to switch to
+template<typename t_id, typename t_state>
+struct bench_setup
+{
+    typedef t_id id_type;
+    typedef t_state state_type;
+
+    bench_setup( size_t states_count ) : storage( states_count ), queries( QUERIES )
+    {
+        for ( size_t i = 0; i < states_count; ++i )
+        {
+            ids.push_back( id_traits<t_id>::make( i ) );
+            states.push_back( state_traits<t_state>::make( storage[i] ) );
+        }
+
+        srand( 42 );
+        for ( size_t i = 0; i < QUERIES; ++i )
+            queries[i] = rand() % states_count;
+    }
+
+    template<typename t_machine>
+    void register_states( t_machine& machine )
+    {
+        for ( size_t i = 0; i < ids.size(); ++i )
+            machine.register_state( ids[i], states[i] );
+    }
+
+    const t_id& query( size_t i ) const { return ids[queries[i & ( QUERIES - 1 )]]; }
+
+    std::vector<bench_state> storage;
+    std::vector<t_id> ids;
+    std::vector<t_state> states;
+    std::vector<size_t> queries;
+};
+
+//----------------------------------------------------------------
+
+template<typename t_setup, typename t_body>
+static void run_ops( const char* prefab, const t_setup& setup, size_t param, t_body body )
+{
+    for ( size_t i = 0; i < WARMUP_OPS; ++i )
+        body( i );
+
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        body( i );
+    const measurement result = sample.stop( OPS );
+
+    char variant[128];
+    snprintf( variant, sizeof( variant ), "%s %s %s", prefab, id_traits<typename t_setup::id_type>::name(), state_traits<typename t_setup::state_type>::name() );
+    report( "prefabs", variant, param, result );
+}
+
+//----------------------------------------------------------------
+// Single-state machines, param is the number of registered states
+//----------------------------------------------------------------
+
+template<typename t_id, typename t_state>
+static void bench_single( size_t states_count )
+{
+    bench_setup<t_id, t_state> s( states_count );
+    size_t callbacks = 0;
+
+    {
+        fsm_single_immediate<t_id, t_state> machine;
+        s.register_states( machine );
+        run_ops( "fsm_single_immediate", s, states_count, [&]( size_t i ) {
+            machine.change_state_immediate( s.query( i ) );
+        } );
+    }
+    {
+        fsm_single_immediate_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_single_immediate_enter_exit", s, states_count, [&]( size_t i ) {
+            machine.change_state_immediate( s.query( i ), callbacks );
+        } );
+    }
+    {
+        fsm_single_queued_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_single_queued_enter_exit", s, states_count, [&]( size_t i ) {
+            machine.queue_change_state( s.query( i ) );
+            machine.update( callbacks );
+        } );
+    }
+    {
+        fsm_single_combined_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_single_combined_enter_exit", s, states_count, [&]( size_t i ) {
+            if ( i & 1 )
+            {
+                machine.queue_change_state( s.query( i ) );
+                machine.update( callbacks );
+            }
+            else
+                machine.change_state_immediate( s.query( i ), callbacks );
+        } );
+    }
+    {
+          // States have no parents, so this measures the cost of hierarchy bookkeeping
+        fsm_hierarchical_combined_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_hierarchical_combined_enter_exit", s, states_count, [&]( size_t i ) {
+            if ( i & 1 )
+            {
+                machine.queue_change_state( s.query( i ) );
+                machine.update( callbacks );
+            }
+            else
+                machine.change_state_immediate( s.query( i ), callbacks );
+        } );
+    }
+    {
+          // Every state has a rule for the "next" event, which leads to a random state
+        enum event { next };
+        fsm_single_transition_enter_exit<t_id, t_state, event, size_t&> machine;
+        s.register_states( machine );
+        for ( size_t i = 0; i < states_count; ++i )
+            machine.add_transition( s.ids[i], next, s.query( i ) );
+
+        machine.change_state_immediate( s.ids[0], callbacks );
+        run_ops( "fsm_single_transition_enter_exit", s, states_count, [&]( size_t i ) {
+            machine.dispatch( next, callbacks );
+        } );
+    }
+    {
+        const size_t instances = 1024;
+        fsm_single_world_enter_exit<t_id, t_state, size_t&> world;
+        s.register_states( world );
+        for ( size_t i = 0; i < instances; ++i )
+            world.create_instance();
+
+        run_ops( "fsm_single_world_enter_exit", s, states_count, [&]( size_t i ) {
+            world.queue_change_state( i & ( instances - 1 ), s.query( i ) );
+            if ( ( i & ( instances - 1 ) ) == instances - 1 )
+                world.update( callbacks );
+        } );
+    }
+
+    do_not_optimize( callbacks );
+}
+
+//----------------------------------------------------------------
+// Stacked-state machines, param is the stack depth
+//----------------------------------------------------------------
+
+static const size_t STACKED_STATES = 64;
+
+  // Op i is a push while the stack is growing to depth, and a pop while it shrinks back to empty.
+  // Queued version returns true for the last op of each half, after which the machine is updated.
+template<typename t_machine, typename t_setup>
+static void push_or_pop_immediate( t_machine& machine, t_setup& s, size_t depth, size_t i, size_t& callbacks )
+{
+    const size_t step = i % ( depth * 2 );
+    if ( step < depth )
+        machine.push_state( s.ids[step], callbacks );
+    else
+        machine.pop_state( callbacks );
+}
+
+template<typename t_machine, typename t_setup>
+static bool push_or_pop_queued( t_machine& machine, t_setup& s, size_t depth, size_t i )
+{
+    const size_t step = i % ( depth * 2 );
+    if ( step < depth )
+        machine.queue_push_state( s.ids[step] );
+    else
+        machine.queue_pop_state();
+
+    return step == depth - 1 || step == depth * 2 - 1;
+}
+
+template<typename t_id, typename t_state>
+static void bench_stacked( size_t depth )
+{
+    bench_setup<t_id, t_state> s( STACKED_STATES );
+    size_t callbacks = 0;
+
+    {
+        fsm_stacked_immediate<t_id, t_state> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_immediate", s, depth, [&]( size_t i ) {
+            const size_t step = i % ( depth * 2 );
+            if ( step < depth )
+                machine.push_state( s.ids[step] );
+            else
+                machine.pop_state();
+        } );
+    }
+    {
+        fsm_stacked_immediate_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_immediate_enter_exit", s, depth, [&]( size_t i ) {
+            push_or_pop_immediate( machine, s, depth, i, callbacks );
+        } );
+    }
+    {
+        fsm_stacked_queued_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_queued_enter_exit", s, depth, [&]( size_t i ) {
+            if ( push_or_pop_queued( machine, s, depth, i ) )
+                machine.update( callbacks );
+        } );
+    }
+    {
+        fsm_stacked_combined_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_combined_enter_exit", s, depth, [&]( size_t i ) {
+              // Immediate pushes, queued pops
+            if ( ( i / depth ) % 2 == 0 )
+                push_or_pop_immediate( machine, s, depth, i, callbacks );
+            else if ( push_or_pop_queued( machine, s, depth, i ) )
+                machine.update( callbacks );
+        } );
+    }
+    {
+        fsm_stacked_fixed_combined_enter_exit<t_id, t_state, STACKED_STATES, STACKED_STATES, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_fixed_combined_enter_exit", s, depth, [&]( size_t i ) {
+              // Immediate pushes, queued pops
+            if ( ( i / depth ) % 2 == 0 )
+                push_or_pop_immediate( machine, s, depth, i, callbacks );
+            else if ( push_or_pop_queued( machine, s, depth, i ) )
+                machine.update( callbacks );
+        } );
+    }
+    {
+        fsm_stacked_indexed_combined_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_indexed_combined_enter_exit", s, depth, [&]( size_t i ) {
+              // Immediate pushes, queued pops
+            if ( ( i / depth ) % 2 == 0 )
+                push_or_pop_immediate( machine, s, depth, i, callbacks );
+            else if ( push_or_pop_queued( machine, s, depth, i ) )
+                machine.update( callbacks );
+        } );
+    }
+    {
+        fsm_stacked_concurrent_enter_exit<t_id, t_state, size_t&> machine;
+        s.register_states( machine );
+        run_ops( "fsm_stacked_concurrent_enter_exit", s, depth, [&]( size_t i ) {
+            if ( push_or_pop_queued( machine, s, depth, i ) )
+                machine.update( callbacks );
+        } );
+    }
+
+    do_not_optimize( callbacks );
+}
+
+//----------------------------------------------------------------
+// Static machines, param is the number of states. Ids are always indices, and states are values.
+//----------------------------------------------------------------
+
+template<typename t_machine>
+static void bench_static( size_t states_count )
+{
+    t_machine machine;
+    size_t callbacks = 0;
+
+    std::vector<size_t> queries( QUERIES );
+    srand( 42 );
+    for ( size_t i = 0; i < QUERIES; ++i )
+        queries[i] = rand() % states_count;
+
+    for ( size_t i = 0; i < WARMUP_OPS; ++i )
+        machine.change_state_immediate( queries[i & ( QUERIES - 1 )], callbacks );
+
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        machine.change_state_immediate( queries[i & ( QUERIES - 1 )], callbacks );
+    const measurement result = sample.stop( OPS );
+
+    do_not_optimize( callbacks );
+    report( "prefabs", "fsm_static_single_immediate_enter_exit index value", states_count, result );
+}
+
+//----------------------------------------------------------------
+
+template<typename t_id, typename t_state>
+static void bench_types()
+{
+    const size_t states_counts[] = { 4, 32, 256 };
+    for ( size_t i = 0; i < sizeof( states_counts ) / sizeof( states_counts[0] ); ++i )
+        bench_single<t_id, t_state>( states_counts[i] );
+
+    const size_t depths[] = { 1, 8, 32 };
+    for ( size_t i = 0; i < sizeof( depths ) / sizeof( depths[0] ); ++i )
+        bench_stacked<t_id, t_state>( depths[i] );
+}
+
+template<typename t_id>
+static void bench_state_types()
+{
+    bench_types<t_id, bench_state*>();
+    bench_types<t_id, std::shared_ptr<bench_state> >();
+    bench_types<t_id, bench_state>();
+}
+
+void bench_prefabs()
+{
+    bench_state_types<int>();
+    bench_state_types<bench_state_id>();
+    bench_state_types<std::string>();
+
+    bench_static<fsm_static_single_immediate_enter_exit<size_t&,
+        static_bench_state<0>, static_bench_state<1>, static_bench_state<2>, static_bench_state<3> > >( 4 );
+    bench_static<fsm_static_single_immediate_enter_exit<size_t&,
+        static_bench_state<0>, static_bench_state<1>, static_bench_state<2>, static_bench_state<3>,
+        static_bench_state<4>, static_bench_state<5>, static_bench_state<6>, static_bench_state<7> > >( 8 );
+}
+
+//----------------------------------------------------------------
+}
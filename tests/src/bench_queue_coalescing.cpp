@@ -0,0 +1,109 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <stdio.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t FRAMES = 100000;
+
+  // A UI screen which "loads" and "unloads" its assets when placed onto or removed from the stack
+class screen_state
+{
+public:
+    screen_state() : m_assets( 0 ) {}
+
+    void on_enter( size_t& callbacks ) { ++callbacks; load_assets(); }
+    void on_exit( size_t& callbacks ) { ++callbacks; m_assets = 0; }
+
+    void load_assets()
+    {
+        for ( int i = 0; i < 200; ++i )
+            m_assets = m_assets * 31 + i;
+        do_not_optimize( m_assets );
+    }
+
+    size_t m_assets;
+};
+
+enum screen { main_menu, options, loading, hud, pause, dialog, screens_count };
+
+typedef fsm_stacked_queued_enter_exit<int, screen_state*, size_t&> machine;
+
+//----------------------------------------------------------------
+
+  // Traces of actions queued during a single frame, as typical UI code does it
+
+  // Player quickly opens and closes a dialog: nothing changes in the end
+static void trace_dialog_flicker( machine& m, size_t frame )
+{
+    m.queue_push_state( dialog );
+    m.queue_pop_state();
+}
+
+  // Game goes back to main menu through a loading screen, which is replaced in the same frame
+static void trace_return_to_menu( machine& m, size_t frame )
+{
+    m.queue_remove_all_states();
+    m.queue_push_state( loading );
+    m.queue_remove_state( loading );
+    m.queue_push_state( frame % 2 == 0 ? main_menu : hud );
+}
+
+  // Several systems react to the same event and each one rebuilds the stack
+static void trace_rebuild( machine& m, size_t frame )
+{
+    m.queue_remove_all_states();
+    m.queue_push_state( hud );
+    m.queue_push_state( pause );
+    m.queue_remove_state_and_all_above( pause );
+    m.queue_push_state( frame % 2 == 0 ? options : pause );
+}
+
+//----------------------------------------------------------------
+
+template<typename t_trace>
+static void bench_trace( const char* variant, t_trace trace, bool coalesce )
+{
+    screen_state states[screens_count];
+
+    machine m;
+    for ( int i = 0; i < screens_count; ++i )
+        m.register_state( i, &states[i] );
+
+    m.set_queue_coalescing( coalesce );
+
+    size_t callbacks = 0;
+    m.queue_push_state( hud );
+    m.update( callbacks );
+    callbacks = 0;
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        trace( m, frame );
+        m.update( callbacks );
+    }
+    const measurement result = sample.stop( FRAMES );
+
+      // Size parameter of the report is the number of enter/exit calls per frame
+    char name[64];
+    snprintf( name, sizeof( name ), "%s %s", variant, coalesce ? "coalesced" : "exact" );
+    report( "queue_coalescing", name, ( callbacks + FRAMES / 2 ) / FRAMES, result );
+}
+
+void bench_queue_coalescing()
+{
+    bench_trace( "dialog_flicker", trace_dialog_flicker, false );
+    bench_trace( "dialog_flicker", trace_dialog_flicker, true );
+    bench_trace( "return_to_menu", trace_return_to_menu, false );
+    bench_trace( "return_to_menu", trace_return_to_menu, true );
+    bench_trace( "rebuild", trace_rebuild, false );
+    bench_trace( "rebuild", trace_rebuild, true );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,134 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t ENTITIES = 10000;
+static const size_t FRAMES = 20;
+
+  // Every entity has movement, weapon and emote machines with this many states each
+static const size_t REGIONS = 3;
+static const size_t REGION_STATES = 4;
+
+class entity_state
+{
+public:
+    entity_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+//----------------------------------------------------------------
+
+static void bench_separate( entity_state* states )
+{
+    typedef fsm_single_combined_enter_exit<int, entity_state*, int, state_registry<int, entity_state*, registry_lookup_direct> > machine;
+
+    measure setup;
+    std::vector<machine> machines( ENTITIES * REGIONS );
+    for ( size_t i = 0; i < machines.size(); ++i )
+    {
+        const size_t region = i % REGIONS;
+        machines[i].reserve( REGION_STATES );
+        for ( size_t j = 0; j < REGION_STATES; ++j )
+            machines[i].register_state( (int)( region * REGION_STATES + j ), &states[region * REGION_STATES + j] );
+    }
+    report( "regions", "separate machines, setup", ENTITIES, setup.stop( ENTITIES ) );
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < machines.size(); ++i )
+            machines[i].queue_change_state( (int)( ( i % REGIONS ) * REGION_STATES + ( i + frame ) % REGION_STATES ) );
+
+        for ( size_t i = 0; i < machines.size(); ++i )
+            machines[i].update( 1 );
+    }
+    report( "regions", "separate machines, update", ENTITIES, sample.stop( ENTITIES * FRAMES ) );
+}
+
+static void bench_regions( entity_state* states )
+{
+    typedef fsm_regions_combined_enter_exit<int, entity_state*, int, state_registry<int, entity_state*, registry_lookup_direct> > machine;
+
+    measure setup;
+    std::vector<machine> machines( ENTITIES );
+    for ( size_t i = 0; i < machines.size(); ++i )
+    {
+        machines[i].reserve( REGIONS * REGION_STATES );
+        for ( size_t j = 0; j < REGIONS * REGION_STATES; ++j )
+            machines[i].register_state( (int)j, &states[j] );
+
+        machines[i].reserve_regions( REGIONS );
+        for ( size_t region = 0; region < REGIONS; ++region )
+            machines[i].add_region();
+    }
+    report( "regions", "fsm_regions_combined_enter_exit, setup", ENTITIES, setup.stop( ENTITIES ) );
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < machines.size(); ++i )
+        {
+            for ( size_t region = 0; region < REGIONS; ++region )
+                machines[i].queue_change_state( region, (int)( region * REGION_STATES + ( i * REGIONS + region + frame ) % REGION_STATES ) );
+        }
+
+        for ( size_t i = 0; i < machines.size(); ++i )
+            machines[i].update( 1 );
+    }
+    report( "regions", "fsm_regions_combined_enter_exit, update", ENTITIES, sample.stop( ENTITIES * FRAMES ) );
+}
+
+static void bench_regions_immediate( entity_state* states )
+{
+    typedef fsm_regions_immediate_enter_exit<int, entity_state*, int, state_registry<int, entity_state*, registry_lookup_direct> > machine;
+
+    std::vector<machine> machines( ENTITIES );
+    for ( size_t i = 0; i < machines.size(); ++i )
+    {
+        machines[i].reserve( REGIONS * REGION_STATES );
+        for ( size_t j = 0; j < REGIONS * REGION_STATES; ++j )
+            machines[i].register_state( (int)j, &states[j] );
+
+        machines[i].reserve_regions( REGIONS );
+        for ( size_t region = 0; region < REGIONS; ++region )
+            machines[i].add_region();
+    }
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < machines.size(); ++i )
+        {
+            for ( size_t region = 0; region < REGIONS; ++region )
+                machines[i].change_state_immediate( region, (int)( region * REGION_STATES + ( i * REGIONS + region + frame ) % REGION_STATES ), 1 );
+        }
+    }
+    report( "regions", "fsm_regions_immediate_enter_exit, change", ENTITIES, sample.stop( ENTITIES * FRAMES ) );
+}
+
+void bench_regions()
+{
+    entity_state states[REGIONS * REGION_STATES];
+
+    bench_separate( states );
+    bench_regions( states );
+    bench_regions_immediate( states );
+
+    int total = 0;
+    for ( size_t i = 0; i < REGIONS * REGION_STATES; ++i )
+        total += states[i].m_counter;
+    do_not_optimize( total );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,51 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_common.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t LOOKUPS = 1 << 22;
+
+template<typename t_lookup_policy>
+static void bench_lookup( const char* variant, size_t states_count )
+{
+    state_registry<int, int, t_lookup_policy> registry;
+    for ( size_t i = 0; i < states_count; ++i )
+        registry.register_state( (int)i, (int)i );
+
+      // Random, but reproducible, order of queries
+    std::vector<int> queries( 4096 );
+    srand( 42 );
+    for ( size_t i = 0; i < queries.size(); ++i )
+        queries[i] = rand() % (int)states_count;
+
+    int sum = 0;
+    measure sample;
+    for ( size_t i = 0; i < LOOKUPS; ++i )
+        sum += registry.find_state( queries[i & ( queries.size() - 1 )] )->state;
+    const measurement result = sample.stop( LOOKUPS );
+
+    do_not_optimize( sum );
+    report( "registry_lookup", variant, states_count, result );
+}
+
+void bench_registry_lookup()
+{
+    const size_t sizes[] = { 8, 64, 512, 4096 };
+
+    for ( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+    {
+        bench_lookup<registry_lookup_linear>( "linear", sizes[i] );
+        bench_lookup<registry_lookup_hashed<> >( "hashed", sizes[i] );
+        bench_lookup<registry_lookup_direct>( "direct", sizes[i] );
+        bench_lookup<registry_lookup_sorted>( "sorted", sizes[i] );
+    }
+}
+
+//----------------------------------------------------------------
+}
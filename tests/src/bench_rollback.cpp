@@ -0,0 +1,147 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t MACHINES = 10000;
+static const size_t STATES = 8;
+static const size_t DEPTH = 4;
+static const size_t FRAMES = 64;
+static const size_t WINDOW = 8;
+
+class rollback_state
+{
+public:
+    rollback_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+static rollback_state g_states[STATES];
+
+template<typename t_machine>
+static void setup( std::vector<t_machine>& machines )
+{
+    for ( size_t m = 0; m < machines.size(); ++m )
+    {
+        for ( size_t i = 0; i < STATES; ++i )
+            machines[m].register_state( (int)i, &g_states[i] );
+        for ( size_t i = 0; i < DEPTH; ++i )
+            machines[m].push_state( (int)i, 1 );
+    }
+}
+
+  // One frame: every "every"-th machine replaces its top state through the queue
+template<typename t_machine>
+static void simulate( std::vector<t_machine>& machines, size_t frame, size_t every )
+{
+    for ( size_t m = frame % every; m < machines.size(); m += every )
+    {
+        machines[m].queue_pop_state();
+        machines[m].queue_push_state( (int)( DEPTH - 1 + ( frame + m ) % ( STATES - DEPTH + 1 ) ) );
+        machines[m].update( 1 );
+    }
+}
+
+  // Plain machines are checkpointed by saving all of them into a ring of WINDOW snapshot buffers
+static void bench_snapshots( size_t every )
+{
+    std::vector<fsm_stacked_combined_enter_exit<int, rollback_state*, int> > machines( MACHINES );
+    setup( machines );
+
+    for ( size_t frame = 0; frame < every; ++frame )
+        simulate( machines, frame, every );
+
+    measure simulate_sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+        simulate( machines, frame, every );
+    const measurement simulate_result = simulate_sample.stop( FRAMES );
+
+    std::vector<unsigned char> buffers[WINDOW];
+    for ( size_t i = 0; i < WINDOW; ++i )
+        save_snapshots( buffers[i], machines.begin(), machines.end() );
+
+    measure frame_sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        simulate( machines, frame, every );
+
+        std::vector<unsigned char>& buffer = buffers[frame % WINDOW];
+        buffer.clear();
+        save_snapshots( buffer, machines.begin(), machines.end() );
+    }
+    const measurement frame_result = frame_sample.stop( FRAMES );
+
+    measure rewind_sample;
+    const unsigned char* data = &buffers[( FRAMES - WINDOW ) % WINDOW][0];
+    const bool restored = restore_snapshots( data, buffers[( FRAMES - WINDOW ) % WINDOW].size(), machines.begin(), machines.end() );
+    const measurement rewind_result = rewind_sample.stop( 1 );
+
+    char variant[128];
+    sprintf( variant, "fsm_stacked_combined_enter_exit, 1 of %d changes, frame", (int)every );
+    report( "rollback", variant, MACHINES, simulate_result );
+    sprintf( variant, "snapshot of all machines, 1 of %d changes, frame", (int)every );
+    report( "rollback", variant, MACHINES, frame_result );
+    sprintf( variant, "snapshot of all machines, 1 of %d changes, rewind %d frames", (int)every, (int)WINDOW );
+    report( "rollback", variant, MACHINES, rewind_result );
+    do_not_optimize( restored );
+}
+
+  // Rollback machines share a clock, so a checkpoint is one call for all of them
+static void bench_rollback( size_t every )
+{
+    rollback_clock clock;
+    std::vector<fsm_stacked_rollback_enter_exit<int, rollback_state*, int, WINDOW + 1> > machines( MACHINES );
+    for ( size_t m = 0; m < MACHINES; ++m )
+        machines[m].set_rollback_clock( clock );
+    setup( machines );
+
+      // Warm up saved frames, so that their memory is allocated
+    for ( size_t frame = 1; frame <= WINDOW + 1; ++frame )
+    {
+        clock.checkpoint( frame );
+        for ( size_t m = 0; m < MACHINES; ++m )
+            machines[m].queue_pop_state(), machines[m].queue_push_state( (int)( DEPTH - 1 ) ), machines[m].update( 1 );
+    }
+
+    size_t frame = WINDOW + 1;
+    measure frame_sample;
+    for ( size_t i = 0; i < FRAMES; ++i )
+    {
+        simulate( machines, i, every );
+        clock.checkpoint( ++frame );
+    }
+    const measurement frame_result = frame_sample.stop( FRAMES );
+
+    bool restored = true;
+    measure rewind_sample;
+    for ( size_t m = 0; m < MACHINES; ++m )
+        restored = machines[m].rewind( frame - WINDOW ) && restored;
+    clock.rewind( frame - WINDOW );
+    const measurement rewind_result = rewind_sample.stop( 1 );
+
+    char variant[128];
+    sprintf( variant, "fsm_stacked_rollback_enter_exit, 1 of %d changes, frame", (int)every );
+    report( "rollback", variant, MACHINES, frame_result );
+    sprintf( variant, "fsm_stacked_rollback_enter_exit, 1 of %d changes, rewind %d frames", (int)every, (int)WINDOW );
+    report( "rollback", variant, MACHINES, rewind_result );
+    do_not_optimize( restored );
+}
+
+void bench_rollback()
+{
+    bench_snapshots( 1 );
+    bench_rollback( 1 );
+    bench_snapshots( 10 );
+    bench_rollback( 10 );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,117 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <stdio.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t MACHINES = 1024;
+static const size_t FRAMES = 1000;
+
+class shared_state
+{
+public:
+    void on_enter( size_t& callbacks ) { ++callbacks; }
+    void on_exit( size_t& callbacks ) { ++callbacks; }
+};
+
+typedef state_registry<int, shared_state*> own_registry;
+typedef state_registry_shared<int, shared_state*> shared_registry;
+
+typedef fsm_single_combined_enter_exit<int, shared_state*, size_t&, own_registry> own_machine;
+typedef fsm_single_combined_enter_exit<int, shared_state*, size_t&, shared_registry> shared_machine;
+
+static void setup( own_machine& machine, std::vector<shared_state>& states, own_registry& )
+{
+    machine.reserve( states.size() );
+    for ( size_t i = 0; i < states.size(); ++i )
+        machine.register_state( (int)i, &states[i] );
+}
+
+static void setup( shared_machine& machine, std::vector<shared_state>&, own_registry& shared )
+{
+    machine.attach( shared );
+}
+
+  // Memory which an instance allocates for its states
+static size_t get_heap_bytes( const own_machine&, size_t states_count ) { return states_count * sizeof( state_and_id<int, shared_state*> ); }
+static size_t get_heap_bytes( const shared_machine&, size_t ) { return 0; }
+
+//----------------------------------------------------------------
+
+  // Cost of spawning a machine and entering its first state, as entities are spawned during a frame
+template<typename t_machine>
+static void bench_spawn( const char* name, size_t states_count )
+{
+    std::vector<shared_state> states( states_count );
+    own_registry shared;
+    for ( size_t i = 0; i < states_count; ++i )
+        shared.register_state( (int)i, &states[i] );
+
+    size_t callbacks = 0;
+    measure sample;
+    for ( size_t i = 0; i < MACHINES * 16; ++i )
+    {
+        t_machine machine;
+        setup( machine, states, shared );
+        machine.change_state_immediate( (int)( i % states_count ), callbacks );
+        do_not_optimize( machine );
+    }
+    const measurement result = sample.stop( MACHINES * 16 );
+
+    const t_machine machine;
+    char variant[128];
+    snprintf( variant, sizeof( variant ), "%s spawn, %u+%u bytes/instance", name, (unsigned)sizeof( t_machine ), (unsigned)get_heap_bytes( machine, states_count ) );
+
+    do_not_optimize( callbacks );
+    report( "shared_registry", variant, states_count, result );
+}
+
+  // Cost of changing states of many machines, which all refer to the same states or own copies of them
+template<typename t_machine>
+static void bench_frame( const char* name, size_t states_count )
+{
+    std::vector<shared_state> states( states_count );
+    own_registry shared;
+    for ( size_t i = 0; i < states_count; ++i )
+        shared.register_state( (int)i, &states[i] );
+
+    std::vector<t_machine> machines( MACHINES );
+    for ( size_t i = 0; i < MACHINES; ++i )
+        setup( machines[i], states, shared );
+
+    size_t callbacks = 0;
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < MACHINES; ++i )
+            machines[i].change_state_immediate( (int)( ( frame * 7 + i * 13 ) % states_count ), callbacks );
+    }
+    const measurement result = sample.stop( FRAMES * MACHINES );
+
+    char variant[128];
+    snprintf( variant, sizeof( variant ), "%s change_state_immediate", name );
+
+    do_not_optimize( callbacks );
+    report( "shared_registry", variant, states_count, result );
+}
+
+void bench_shared_registry()
+{
+    const size_t sizes[] = { 8, 64 };
+
+    for ( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+    {
+        bench_spawn<own_machine>( "own registry", sizes[i] );
+        bench_spawn<shared_machine>( "shared registry", sizes[i] );
+        bench_frame<own_machine>( "own registry", sizes[i] );
+        bench_frame<shared_machine>( "shared registry", sizes[i] );
+    }
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,76 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t MACHINES = 10000;
+static const size_t STATES = 16;
+static const size_t DEPTH = 4;
+
+class snapshot_state
+{
+public:
+    void on_enter( int ctx ) {}
+    void on_exit( int ctx ) {}
+};
+
+  // Saves and restores all machines into one buffer, which keeps its memory between rounds
+template<typename t_machine>
+static void bench_machines( const char* variant, std::vector<t_machine>& machines )
+{
+    std::vector<unsigned char> buffer;
+    save_snapshots( buffer, machines.begin(), machines.end() );
+
+    const size_t rounds = 20;
+
+    measure save_sample;
+    for ( size_t i = 0; i < rounds; ++i )
+    {
+        buffer.clear();
+        save_snapshots( buffer, machines.begin(), machines.end() );
+    }
+    const measurement save_result = save_sample.stop( rounds * MACHINES );
+
+    bool restored = true;
+    measure restore_sample;
+    for ( size_t i = 0; i < rounds; ++i )
+        restored = restore_snapshots( &buffer[0], buffer.size(), machines.begin(), machines.end() ) && restored;
+    const measurement restore_result = restore_sample.stop( rounds * MACHINES );
+
+    report( "snapshot", ( std::string( variant ) + ", save" ).c_str(), buffer.size() / MACHINES, save_result );
+    report( "snapshot", ( std::string( variant ) + ", restore" ).c_str(), buffer.size() / MACHINES, restore_result );
+    do_not_optimize( restored );
+}
+
+void bench_snapshot()
+{
+    typedef state_registry<int, snapshot_state*, registry_lookup_direct> registry;
+    static snapshot_state states[STATES];
+
+      // Machines are not copyable, so vectors are sized up front
+    std::vector<fsm_single_combined_enter_exit<int, snapshot_state*, int, registry> > singles( MACHINES );
+    std::vector<fsm_stacked_combined_enter_exit<int, snapshot_state*, int, registry> > stacked( MACHINES );
+    for ( size_t m = 0; m < MACHINES; ++m )
+    {
+        for ( size_t i = 0; i < STATES; ++i )
+        {
+            singles[m].register_state( (int)i, &states[i] );
+            stacked[m].register_state( (int)i, &states[i] );
+        }
+
+        singles[m].change_state_immediate( (int)( m % STATES ), 1 );
+        for ( size_t i = 0; i < DEPTH; ++i )
+            stacked[m].push_state( (int)( ( m + i ) % STATES ), 1 );
+        stacked[m].queue_pop_state();
+    }
+
+    bench_machines( "fsm_single_combined_enter_exit", singles );
+    bench_machines( "fsm_stacked_combined_enter_exit", stacked );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,69 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t OPS = 1 << 20;
+
+class layer_state
+{
+public:
+    void on_enter( size_t& callbacks ) { ++callbacks; }
+    void on_exit( size_t& callbacks ) { ++callbacks; }
+};
+
+  // A stack of layers is filled to depth, then some layer is checked and removed and pushed back on every op
+template<typename t_machine>
+static void bench_layers( const char* variant, size_t depth )
+{
+    std::vector<layer_state> states( depth );
+
+    t_machine machine;
+    size_t callbacks = 0;
+    for ( size_t i = 0; i < depth; ++i )
+    {
+        machine.register_state( (int)i, &states[i] );
+        machine.push_state( (int)i, callbacks );
+    }
+
+    std::vector<int> queries( 4096 );
+    srand( 42 );
+    for ( size_t i = 0; i < queries.size(); ++i )
+        queries[i] = rand() % (int)depth;
+
+    size_t found = 0;
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+    {
+        const int id = queries[i & ( queries.size() - 1 )];
+        found += machine.is_state_in_stack( id );
+        machine.remove_state( id, callbacks );
+        machine.push_state( id, callbacks );
+    }
+    const measurement result = sample.stop( OPS );
+
+    do_not_optimize( found );
+    do_not_optimize( callbacks );
+    report( "stacked_index", variant, depth, result );
+}
+
+void bench_stacked_index()
+{
+    typedef state_registry<int, layer_state*, registry_lookup_hashed<> > hashed_registry;
+
+    const size_t depths[] = { 8, 32, 64 };
+    for ( size_t i = 0; i < sizeof( depths ) / sizeof( depths[0] ); ++i )
+    {
+        bench_layers<fsm_stacked_combined_enter_exit<int, layer_state*, size_t&, hashed_registry> >( "scan", depths[i] );
+        bench_layers<fsm_stacked_indexed_combined_enter_exit<int, layer_state*, size_t&> >( "indexed", depths[i] );
+    }
+}
+
+//----------------------------------------------------------------
+}
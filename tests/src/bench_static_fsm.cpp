@@ -0,0 +1,112 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t TRANSITIONS = 1 << 24;
+
+struct counters
+{
+    counters() : enters( 0 ), exits( 0 ) {}
+
+    size_t enters;
+    size_t exits;
+};
+
+class base_state
+{
+public:
+    virtual ~base_state() {}
+    virtual void on_enter( counters& c ) = 0;
+    virtual void on_exit( counters& c ) = 0;
+};
+
+class virtual_state : public base_state
+{
+public:
+    virtual void on_enter( counters& c ) { ++c.enters; }
+    virtual void on_exit( counters& c ) { ++c.exits; }
+};
+
+template<int t_id>
+class concrete_state
+{
+public:
+    void on_enter( counters& c ) { ++c.enters; }
+    void on_exit( counters& c ) { ++c.exits; }
+};
+
+//----------------------------------------------------------------
+
+static void bench_runtime()
+{
+    fsm_single_immediate_enter_exit<int, base_state*, counters&> machine;
+    virtual_state states[4];
+    for ( int i = 0; i < 4; ++i )
+        machine.register_state( i, &states[i] );
+
+    counters c;
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; i += 4 )
+    {
+        machine.change_state_immediate( 0, c );
+        machine.change_state_immediate( 1, c );
+        machine.change_state_immediate( 2, c );
+        machine.change_state_immediate( 3, c );
+    }
+    const measurement result = sample.stop( TRANSITIONS );
+
+    do_not_optimize( c );
+    report( "static_fsm", "fsm_single_immediate_enter_exit", 4, result );
+}
+
+static void bench_static()
+{
+    fsm_static_single_immediate_enter_exit<counters&, concrete_state<0>, concrete_state<1>, concrete_state<2>, concrete_state<3> > machine;
+
+    counters c;
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; i += 4 )
+    {
+        machine.change_state_immediate<concrete_state<0> >( c );
+        machine.change_state_immediate<concrete_state<1> >( c );
+        machine.change_state_immediate<concrete_state<2> >( c );
+        machine.change_state_immediate<concrete_state<3> >( c );
+        do_not_optimize( c );
+    }
+    const measurement result = sample.stop( TRANSITIONS );
+
+    do_not_optimize( c );
+    report( "static_fsm", "static, by type", 4, result );
+}
+
+static void bench_static_by_index()
+{
+    fsm_static_single_immediate_enter_exit<counters&, concrete_state<0>, concrete_state<1>, concrete_state<2>, concrete_state<3> > machine;
+
+    counters c;
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+    {
+        machine.change_state_immediate( i & 3, c );
+        do_not_optimize( c );
+    }
+    const measurement result = sample.stop( TRANSITIONS );
+
+    do_not_optimize( c );
+    report( "static_fsm", "static, by index", 4, result );
+}
+
+void bench_static_fsm()
+{
+    bench_runtime();
+    bench_static();
+    bench_static_by_index();
+}
+
+//----------------------------------------------------------------
+}
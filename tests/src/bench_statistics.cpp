@@ -0,0 +1,78 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t OPS = 1 << 20;
+static const size_t STATES = 64;
+
+class profiled_state
+{
+public:
+    profiled_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+  // Every op changes the state of a single-state machine
+template<typename t_machine>
+static void bench_changes( const char* variant )
+{
+    profiled_state states[STATES];
+    t_machine machine;
+    for ( size_t i = 0; i < STATES; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+        machine.change_state_immediate( (int)( i * 7 % STATES ), 1 );
+    const measurement result = sample.stop( OPS );
+
+    report( "statistics", variant, STATES, result );
+    do_not_optimize( states[0].m_counter );
+}
+
+  // Polling cost: a snapshot with reset of STATES counters and STATES x STATES transitions
+static void bench_take_snapshot()
+{
+    typedef state_registry<int, profiled_state*, registry_lookup_direct> registry;
+
+    profiled_state states[STATES];
+    fsm_single_traced_enter_exit<int, profiled_state*, int, trace_policy_statistics<>, registry> machine;
+    for ( size_t i = 0; i < STATES; ++i )
+        machine.register_state( (int)i, &states[i] );
+    machine.change_state_immediate( 0, 1 );
+
+    state_statistics_snapshot snapshot;
+    const size_t snapshots = 1024;
+
+    measure sample;
+    for ( size_t i = 0; i < snapshots; ++i )
+        machine.get_trace().take_snapshot( snapshot, true );
+    const measurement result = sample.stop( snapshots );
+
+    report( "statistics", "take_snapshot with reset", STATES, result );
+    do_not_optimize( snapshot.m_enters[0] );
+}
+
+void bench_statistics()
+{
+    typedef state_registry<int, profiled_state*, registry_lookup_direct> registry;
+
+    bench_changes<fsm_single_combined_enter_exit<int, profiled_state*, int, registry> >( "fsm_single_combined_enter_exit" );
+    bench_changes<fsm_single_traced_enter_exit<int, profiled_state*, int, trace_policy_none, registry> >( "trace_policy_none" );
+    bench_changes<fsm_single_traced_enter_exit<int, profiled_state*, int, trace_policy_statistics<>, registry> >( "trace_policy_statistics, steady clock" );
+    bench_changes<fsm_single_traced_enter_exit<int, profiled_state*, int, trace_policy_statistics<trace_clock_sequence>, registry> >( "trace_policy_statistics, sequence" );
+
+    bench_take_snapshot();
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,58 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t OPS = 1 << 20;
+static const size_t DEPTH = 8;
+
+class traced_state
+{
+public:
+    traced_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+  // Every op pushes a state and queues its removal, applied by an update every DEPTH ops
+template<typename t_machine>
+static void bench_tracing( const char* variant )
+{
+    traced_state states[DEPTH];
+    t_machine machine;
+    for ( size_t i = 0; i < DEPTH; ++i )
+        machine.register_state( (int)i, &states[i] );
+
+    measure sample;
+    for ( size_t i = 0; i < OPS; ++i )
+    {
+        machine.push_state( (int)( i % DEPTH ), 1 );
+        machine.queue_remove_state( (int)( i % DEPTH ) );
+        if ( i % DEPTH == DEPTH - 1 )
+            machine.update( 1 );
+    }
+    const measurement result = sample.stop( OPS );
+
+    report( "tracing", variant, DEPTH, result );
+    do_not_optimize( states[0].m_counter );
+}
+
+void bench_trace()
+{
+    typedef state_registry<int, traced_state*, registry_lookup_direct> registry;
+
+    bench_tracing<fsm_stacked_combined_enter_exit<int, traced_state*, int, registry> >( "fsm_stacked_combined_enter_exit" );
+    bench_tracing<fsm_stacked_traced_enter_exit<int, traced_state*, int, trace_policy_none, registry> >( "trace_policy_none" );
+    bench_tracing<fsm_stacked_traced_enter_exit<int, traced_state*, int, trace_policy_ring_buffer<>, registry> >( "trace_policy_ring_buffer, steady clock" );
+    bench_tracing<fsm_stacked_traced_enter_exit<int, traced_state*, int, trace_policy_ring_buffer<1024, trace_clock_sequence>, registry> >( "trace_policy_ring_buffer, sequence" );
+}
+
+//----------------------------------------------------------------
+}
@@ -0,0 +1,149 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <memory>
+#include <vector>
+#include <stdlib.h>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t TRANSITIONS = 1 << 22;
+static const size_t STATES = 8;
+
+  // The same four kinds of states, as a class hierarchy with virtual functions and as plain types for std::variant
+class base_state
+{
+public:
+    virtual ~base_state() {}
+
+    virtual void on_enter( size_t& ctx ) = 0;
+    virtual void on_exit( size_t& ctx ) = 0;
+};
+
+template<size_t t_kind>
+class kind_state
+{
+public:
+    void on_enter( size_t& ctx ) { ctx += t_kind; }
+    void on_exit( size_t& ctx ) { ctx ^= t_kind; }
+};
+
+template<size_t t_kind>
+class virtual_kind_state : public base_state
+{
+public:
+    virtual void on_enter( size_t& ctx ) { ctx += t_kind; }
+    virtual void on_exit( size_t& ctx ) { ctx ^= t_kind; }
+};
+
+static base_state* create_virtual_state( size_t kind )
+{
+    switch ( kind )
+    {
+    case 0: return new virtual_kind_state<1>();
+    case 1: return new virtual_kind_state<2>();
+    case 2: return new virtual_kind_state<3>();
+    default: return new virtual_kind_state<4>();
+    }
+}
+
+typedef std::variant<kind_state<1>, kind_state<2>, kind_state<3>, kind_state<4> > variant_state;
+
+static variant_state create_variant_state( size_t kind )
+{
+    switch ( kind )
+    {
+    case 0: return kind_state<1>();
+    case 1: return kind_state<2>();
+    case 2: return kind_state<3>();
+    default: return kind_state<4>();
+    }
+}
+
+//----------------------------------------------------------------
+
+template<typename t_machine>
+static void run_transitions( t_machine& machine, const std::vector<int>& queries, const char* variant )
+{
+    size_t ctx = 0;
+    for ( size_t i = 0; i < queries.size(); ++i )
+        machine.change_state_immediate( queries[i], ctx );
+
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+        machine.change_state_immediate( queries[i & ( queries.size() - 1 )], ctx );
+    const measurement result = sample.stop( TRANSITIONS );
+
+    do_not_optimize( ctx );
+    report( "variant states", variant, STATES, result );
+}
+
+  // Each push is followed by a pop, so every removal goes through on_exit of a stacked state
+template<typename t_machine>
+static void run_push_pop( t_machine& machine, const std::vector<int>& queries, const char* variant )
+{
+    size_t ctx = 0;
+    measure sample;
+    for ( size_t i = 0; i < TRANSITIONS; ++i )
+    {
+        machine.push_state( queries[i & ( queries.size() - 1 )], ctx );
+        machine.pop_state( ctx );
+    }
+    const measurement result = sample.stop( TRANSITIONS );
+
+    do_not_optimize( ctx );
+    report( "variant stacked push/pop", variant, STATES, result );
+}
+
+void bench_variant()
+{
+    std::vector<int> queries( 4096 );
+    srand( 42 );
+    for ( size_t i = 0; i < queries.size(); ++i )
+        queries[i] = rand() % STATES;
+
+    {
+        std::vector<std::unique_ptr<base_state> > states;
+        fsm_single_immediate_enter_exit<int, base_state*, size_t&, state_registry<int, base_state*, registry_lookup_direct> > machine;
+        for ( size_t i = 0; i < STATES; ++i )
+        {
+            states.emplace_back( create_virtual_state( i % 4 ) );
+            machine.register_state( (int)i, states.back().get() );
+        }
+        run_transitions( machine, queries, "base_state*" );
+    }
+    {
+        fsm_single_immediate_enter_exit<int, std::shared_ptr<base_state>, size_t&, state_registry<int, std::shared_ptr<base_state>, registry_lookup_direct> > machine;
+        for ( size_t i = 0; i < STATES; ++i )
+            machine.register_state( (int)i, std::shared_ptr<base_state>( create_virtual_state( i % 4 ) ) );
+        run_transitions( machine, queries, "shared_ptr<base_state>" );
+    }
+    {
+        fsm_single_variant_combined_enter_exit<int, variant_state, size_t&, state_registry<int, variant_state, registry_lookup_direct> > machine;
+        for ( size_t i = 0; i < STATES; ++i )
+            machine.register_state( (int)i, create_variant_state( i % 4 ) );
+        run_transitions( machine, queries, "std::variant" );
+    }
+    {
+        std::vector<std::unique_ptr<base_state> > states;
+        fsm_stacked_combined_enter_exit<int, base_state*, size_t&, state_registry<int, base_state*, registry_lookup_direct> > machine;
+        for ( size_t i = 0; i < STATES; ++i )
+        {
+            states.emplace_back( create_virtual_state( i % 4 ) );
+            machine.register_state( (int)i, states.back().get() );
+        }
+        run_push_pop( machine, queries, "base_state*" );
+    }
+    {
+        fsm_stacked_variant_combined_enter_exit<int, variant_state, size_t&, state_registry<int, variant_state, registry_lookup_direct> > machine;
+        for ( size_t i = 0; i < STATES; ++i )
+            machine.register_state( (int)i, create_variant_state( i % 4 ) );
+        run_push_pop( machine, queries, "std::variant" );
+    }
+}
+
+//----------------------------------------------------------------
+}
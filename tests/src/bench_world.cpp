@@ -0,0 +1,85 @@
+#include "fsbb_bench.hpp"
+#include "fsbb_prefabs.hpp"
+#include <vector>
+
+using namespace fsbb;
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+static const size_t INSTANCES = 100000;
+static const size_t FRAMES = 20;
+
+class npc_state
+{
+public:
+    npc_state() : m_counter( 0 ) {}
+
+    void on_enter( int ctx ) { m_counter += ctx; }
+    void on_exit( int ctx ) { m_counter -= ctx; }
+
+    int m_counter;
+};
+
+//----------------------------------------------------------------
+
+static void bench_individual( npc_state* states, size_t states_count )
+{
+    typedef fsm_single_queued_enter_exit<int, npc_state*, int> machine;
+    std::vector<machine> machines( INSTANCES );
+    for ( size_t i = 0; i < INSTANCES; ++i )
+    {
+        for ( size_t j = 0; j < states_count; ++j )
+            machines[i].register_state( (int)j, &states[j] );
+    }
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            machines[i].queue_change_state( (int)( ( i + frame ) % states_count ) );
+
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            machines[i].update( 1 );
+    }
+    const measurement result = sample.stop( INSTANCES * FRAMES );
+
+    report( "world", "fsm_single_queued_enter_exit", INSTANCES, result );
+}
+
+static void bench_world( npc_state* states, size_t states_count )
+{
+    fsm_single_world_enter_exit<int, npc_state*, int> world;
+    for ( size_t j = 0; j < states_count; ++j )
+        world.register_state( (int)j, &states[j] );
+
+    world.reserve_instances( INSTANCES );
+    for ( size_t i = 0; i < INSTANCES; ++i )
+        world.create_instance();
+
+    measure sample;
+    for ( size_t frame = 0; frame < FRAMES; ++frame )
+    {
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            world.queue_change_state( i, (int)( ( i + frame ) % states_count ) );
+
+        world.update( 1 );
+    }
+    const measurement result = sample.stop( INSTANCES * FRAMES );
+
+    report( "world", "fsm_single_world_enter_exit", INSTANCES, result );
+}
+
+void bench_world()
+{
+    npc_state states[8];
+
+    bench_individual( states, 8 );
+    bench_world( states, 8 );
+
+    do_not_optimize( states[0].m_counter );
+}
+
+//----------------------------------------------------------------
+}
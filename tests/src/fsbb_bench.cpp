@@ -0,0 +1,201 @@
+#include "fsbb_bench.hpp"
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+    Usage: fsbb_bench [--json <file>]
+
+    Prints results as a table, and optionally writes them as a JSON array of objects with fields
+    "group", "variant", "param", "ns_per_op", "allocations_per_op" and "cache_misses_per_op"
+    (null if not available), so that results of different releases can be compared.
+*/
+
+static std::atomic<size_t> g_allocations( 0 );
+
+void* operator new( size_t size )
+{
+    g_allocations.fetch_add( 1, std::memory_order_relaxed );
+    void* p = malloc( size != 0 ? size : 1 );
+    if ( p == 0 )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete( void* p ) noexcept { free( p ); }
+void operator delete( void* p, size_t ) noexcept { free( p ); }
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+size_t allocations_count()
+{
+    return g_allocations.load( std::memory_order_relaxed );
+}
+
+#if defined(__linux__)
+static int open_cache_misses_counter()
+{
+    perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof( attr );
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+long long cache_misses_count()
+{
+    static const int fd = open_cache_misses_counter();
+    if ( fd < 0 )
+        return -1;
+
+    long long count = 0;
+    if ( read( fd, &count, sizeof( count ) ) != sizeof( count ) )
+        return -1;
+
+    return count;
+}
+#else
+long long cache_misses_count()
+{
+    return -1;
+}
+#endif
+
+//----------------------------------------------------------------
+
+struct result_record
+{
+    std::string group;
+    std::string variant;
+    size_t param;
+    measurement result;
+};
+
+static std::vector<result_record> g_results;
+
+void report( const char* group, const char* variant, size_t param, const measurement& result )
+{
+    char cache_misses[32] = "-";
+    if ( result.cache_misses_per_op >= 0 )
+        snprintf( cache_misses, sizeof( cache_misses ), "%.3f", result.cache_misses_per_op );
+
+    printf( "%-24s %-56s %8u %12.2f ns/op %10.3f allocs/op %10s misses/op\n", group, variant, (unsigned)param, result.ns_per_op, result.allocations_per_op, cache_misses );
+    fflush( stdout );
+
+    result_record record;
+    record.group = group;
+    record.variant = variant;
+    record.param = param;
+    record.result = result;
+    g_results.push_back( record );
+}
+
+static void write_json_string( FILE* file, const std::string& s )
+{
+    fputc( '"', file );
+    for ( size_t i = 0; i < s.size(); ++i )
+    {
+        if ( s[i] == '"' || s[i] == '\\' )
+            fputc( '\\', file );
+        fputc( s[i], file );
+    }
+    fputc( '"', file );
+}
+
+static bool write_json( const char* path )
+{
+    FILE* file = fopen( path, "w" );
+    if ( file == 0 )
+        return false;
+
+    fprintf( file, "[\n" );
+    for ( size_t i = 0; i < g_results.size(); ++i )
+    {
+        const result_record& record = g_results[i];
+
+        fprintf( file, "  { \"group\": " );
+        write_json_string( file, record.group );
+        fprintf( file, ", \"variant\": " );
+        write_json_string( file, record.variant );
+        fprintf( file, ", \"param\": %u, \"ns_per_op\": %.3f, \"allocations_per_op\": %.3f, \"cache_misses_per_op\": ",
+            (unsigned)record.param, record.result.ns_per_op, record.result.allocations_per_op );
+
+        if ( record.result.cache_misses_per_op >= 0 )
+            fprintf( file, "%.3f }", record.result.cache_misses_per_op );
+        else
+            fprintf( file, "null }" );
+
+        fprintf( file, i + 1 < g_results.size() ? ",\n" : "\n" );
+    }
+    fprintf( file, "]\n" );
+
+    return fclose( file ) == 0;
+}
+
+//----------------------------------------------------------------
+}
+
+int main( int argc, char** argv )
+{
+    const char* json_path = 0;
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--json" ) == 0 && i + 1 < argc )
+            json_path = argv[++i];
+        else
+        {
+            fprintf( stderr, "Usage: %s [--json <file>]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    if ( fsbb_bench::cache_misses_count() < 0 )
+        printf( "Cache misses are not available on this system\n" );
+
+    fsbb_bench::bench_registry_lookup();
+    fsbb_bench::bench_static_fsm();
+    fsbb_bench::bench_world();
+    fsbb_bench::bench_batch();
+    fsbb_bench::bench_parallel();
+    fsbb_bench::bench_concurrent();
+    fsbb_bench::bench_queue_coalescing();
+    fsbb_bench::bench_stacked_index();
+    fsbb_bench::bench_hierarchical();
+    fsbb_bench::bench_regions();
+    fsbb_bench::bench_variant();
+    fsbb_bench::bench_async();
+    fsbb_bench::bench_context();
+    fsbb_bench::bench_trace();
+    fsbb_bench::bench_statistics();
+    fsbb_bench::bench_snapshot();
+    fsbb_bench::bench_graph();
+    fsbb_bench::bench_rollback();
+    fsbb_bench::bench_interned();
+    fsbb_bench::bench_codegen();
+    fsbb_bench::bench_shared_registry();
+    fsbb_bench::bench_prefabs();
+
+    if ( json_path != 0 && !fsbb_bench::write_json( json_path ) )
+    {
+        fprintf( stderr, "Could not write %s\n", json_path );
+        return 1;
+    }
+
+    return 0;
+}
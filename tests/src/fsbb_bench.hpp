@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace fsbb_bench
+{
+//----------------------------------------------------------------
+
+  // Keeps the compiler from optimizing away a value computed by a benchmark
+template<typename T>
+inline void do_not_optimize( const T& value )
+{
+#if defined(_MSC_VER)
+    static volatile const void* sink;
+    sink = &value;
+#else
+    asm volatile( "" : : "r,m"( value ) : "memory" );
+#endif
+}
+
+//----------------------------------------------------------------
+
+class timer
+{
+public:
+    timer() : m_start( std::chrono::steady_clock::now() ) {}
+
+    double elapsed_ns() const
+    {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - m_start ).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+  // Number of calls to global operator new since the start of the program
+size_t allocations_count();
+
+  // Number of hardware cache misses in the calling thread since the first call,
+  // or -1 if perf_event_open is not available (not Linux, or not permitted)
+long long cache_misses_count();
+
+//----------------------------------------------------------------
+
+struct measurement
+{
+    double ns_per_op;
+    double allocations_per_op;
+    double cache_misses_per_op;   // negative if cache misses are not available
+};
+
+  // Measures time, allocations and cache misses from construction to stop()
+class measure
+{
+public:
+    measure() : m_allocations( allocations_count() ), m_cache_misses( cache_misses_count() ) {}
+
+    measurement stop( size_t ops ) const
+    {
+        measurement result;
+        result.ns_per_op = m_timer.elapsed_ns() / ops;
+        result.allocations_per_op = (double)( allocations_count() - m_allocations ) / ops;
+
+        const long long cache_misses = cache_misses_count();
+        result.cache_misses_per_op = m_cache_misses >= 0 && cache_misses >= 0 ? (double)( cache_misses - m_cache_misses ) / ops : -1.0;
+
+        return result;
+    }
+
+private:
+    size_t m_allocations;
+    long long m_cache_misses;
+    timer m_timer;
+};
+
+//----------------------------------------------------------------
+
+  // Prints a single result line: benchmark group, variant, size parameter and costs of a single operation.
+  // Results are also written to the JSON file if one was given on the command line.
+void report( const char* group, const char* variant, size_t param, const measurement& result );
+
+//----------------------------------------------------------------
+// Benchmarks
+//----------------------------------------------------------------
+
+void bench_registry_lookup();
+void bench_static_fsm();
+void bench_world();
+void bench_batch();
+void bench_parallel();
+void bench_concurrent();
+void bench_queue_coalescing();
+void bench_stacked_index();
+void bench_hierarchical();
+void bench_regions();
+void bench_variant();
+void bench_async();
+void bench_context();
+void bench_trace();
+void bench_statistics();
+void bench_snapshot();
+void bench_graph();
+void bench_rollback();
+void bench_interned();
+void bench_codegen();
+void bench_shared_registry();
+void bench_prefabs();
+
+//----------------------------------------------------------------
+}
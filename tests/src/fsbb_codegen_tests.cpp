@@ -0,0 +1,199 @@
+#include "fsbb_prefabs.hpp"
+#include <vector>
+#include <functional>
+#include <assert.h>
+#include <stdlib.h>
+
+/*
+    Conformance of machines generated by fsbb_codegen with runtime machines built from the same
+    definitions: random sequences of calls must return the same results, leave the same states and
+    produce the same sequences of enter/exit calls.
+*/
+
+using namespace fsbb;
+
+  // Entered states are logged by their ids, exited ones by negated ids
+typedef std::vector<int> callback_log;
+
+  // Called after an exit function with the id of the exited state, so that it can change the stack
+  // of the machine which exited it. One hook is used by generated states, the other by runtime ones.
+typedef std::function<void( int )> exit_hook;
+exit_hook g_generated_exit_hook;
+exit_hook g_runtime_exit_hook;
+
+template<int t_id>
+struct recorded_state
+{
+    void on_enter( callback_log& log ) { log.push_back( t_id ); }
+
+    void on_exit( callback_log& log )
+    {
+        log.push_back( -t_id );
+        if ( g_generated_exit_hook )
+            g_generated_exit_hook( t_id );
+    }
+};
+
+class runtime_state
+{
+public:
+    runtime_state( int id ) : m_id( id ) {}
+
+    void on_enter( callback_log& log ) { log.push_back( m_id ); }
+
+    void on_exit( callback_log& log )
+    {
+        log.push_back( -m_id );
+        if ( g_runtime_exit_hook )
+            g_runtime_exit_hook( m_id );
+    }
+
+private:
+    int m_id;
+};
+
+  // States of a graph machine are logged by their ids too
+struct enter_exit_policy_graph_recorded
+{
+    static void on_enter( graph_state& state, context_holder<callback_log&>& ctx ) { ctx.m_context.push_back( (int)state.id ); }
+    static void on_exit( graph_state& state, context_holder<callback_log&>& ctx ) { ctx.m_context.push_back( -(int)state.id ); }
+};
+
+#include "codegen_locomotion.hpp"
+#include "codegen_screens.hpp"
+
+static const int STEPS = 10000;
+
+//----------------------------------------------------------------
+
+void test_single_conformance()
+{
+    callback_log generated_log, runtime_log;
+
+    locomotion_fsm<callback_log&> generated;
+    fsm_single_combined_enter_exit<int, runtime_state*, callback_log&> runtime;
+    for ( int i = 1; i <= 4; ++i )
+        runtime.register_state( i, new runtime_state( i ) );
+
+      // Ids 0 and 5 are not states
+    srand( 42 );
+    for ( int step = 0; step < STEPS; ++step )
+    {
+        const int id = rand() % 6;
+        switch ( rand() % 3 )
+        {
+        case 0: assert( generated.change_state_immediate( id, generated_log ) == runtime.change_state_immediate( id, runtime_log ) ); break;
+        case 1: assert( generated.queue_change_state( id ) == runtime.queue_change_state( id ) ); break;
+        case 2: generated.update( generated_log ); runtime.update( runtime_log ); break;
+        }
+
+        assert( generated.get_current_state_id() == runtime.get_current_state_id() );
+    }
+
+    assert( generated_log == runtime_log && generated_log.size() > STEPS / 4 );
+}
+
+void test_dispatch_conformance( const char* blob_path )
+{
+    callback_log generated_log, runtime_log;
+
+    state_graph_file file;
+    assert( file.open( blob_path ) );
+
+    locomotion_fsm<callback_log&> generated;
+    fsm_single_graph<enter_exit_policy_graph_recorded, callback_log&> runtime;
+    assert( runtime.attach( file ) );
+
+    assert( !generated.dispatch( locomotion_events::move, generated_log ) && !runtime.dispatch( locomotion_events::move, runtime_log ) );
+    assert( generated.change_state_immediate( locomotion_states::idle, generated_log ) && runtime.change_state_immediate( locomotion_states::idle, runtime_log ) );
+
+      // Event 0 and 6 are not events
+    srand( 42 );
+    for ( int step = 0; step < STEPS; ++step )
+    {
+        const int event = rand() % 7;
+        assert( generated.dispatch( event, generated_log ) == runtime.dispatch( event, runtime_log ) );
+        assert( generated.get_current_state_id() == (int)runtime.get_current_state_id() );
+    }
+
+    assert( generated_log == runtime_log && generated_log.size() > STEPS / 4 );
+}
+
+void test_stacked_conformance()
+{
+    callback_log generated_log, runtime_log;
+
+    screens_fsm<callback_log&> generated;
+    fsm_stacked_combined_enter_exit<int, runtime_state*, callback_log&> runtime;
+    for ( int i = 1; i <= 6; ++i )
+        runtime.register_state( i, new runtime_state( i ) );
+
+      // Exiting options opens a dialog, and exiting loading closes the hud, so exit functions change
+      // the stack in the middle of removals
+    g_generated_exit_hook = [&]( int id ) {
+        if ( id == screens_states::options ) generated.push_state( screens_states::dialog, generated_log );
+        if ( id == screens_states::loading ) generated.remove_state( screens_states::hud, generated_log ); };
+    g_runtime_exit_hook = [&]( int id ) {
+        if ( id == screens_states::options ) runtime.push_state( screens_states::dialog, runtime_log );
+        if ( id == screens_states::loading ) runtime.remove_state( screens_states::hud, runtime_log ); };
+
+      // Ids 0 and 7 are not states. Pushes are more frequent, so that the stack grows.
+    srand( 42 );
+    for ( int step = 0; step < STEPS; ++step )
+    {
+        const int id = rand() % 8;
+        switch ( rand() % 14 )
+        {
+        case 0: case 1: assert( generated.push_state( id, generated_log ) == runtime.push_state( id, runtime_log ) ); break;
+        case 2: assert( generated.pop_state( generated_log ) == runtime.pop_state( runtime_log ) ); break;
+        case 3: assert( generated.replace_top_state( id, generated_log ) == runtime.replace_top_state( id, runtime_log ) ); break;
+        case 4: assert( generated.remove_state( id, generated_log ) == runtime.remove_state( id, runtime_log ) ); break;
+        case 5: assert( generated.remove_state_and_all_above( id, generated_log ) == runtime.remove_state_and_all_above( id, runtime_log ) ); break;
+        case 6: if ( step % 8 == 0 ) { generated.remove_all_states( generated_log ); runtime.remove_all_states( runtime_log ); } break;
+        case 7: case 8: assert( generated.queue_push_state( id ) == runtime.queue_push_state( id ) ); break;
+        case 9: assert( generated.queue_pop_state() == runtime.queue_pop_state() ); break;
+        case 10: assert( generated.queue_remove_state( id ) == runtime.queue_remove_state( id ) ); break;
+        case 11: assert( generated.queue_remove_state_and_all_above( id ) == runtime.queue_remove_state_and_all_above( id ) ); break;
+        case 12: if ( step % 8 == 0 ) assert( generated.queue_remove_all_states() == runtime.queue_remove_all_states() ); break;
+        case 13: generated.update( generated_log ); runtime.update( runtime_log ); break;
+        }
+
+        assert( generated.get_current_states_count() == runtime.get_current_states().size() );
+        for ( size_t i = 0; i < generated.get_current_states_count(); ++i )
+            assert( generated.get_current_state_id( i ) == runtime.get_current_states()[i]->id );
+    }
+
+    assert( generated_log == runtime_log && generated_log.size() > STEPS / 4 );
+
+      // Check that states pushed by exit functions stay after all states are removed
+    g_generated_exit_hook = exit_hook();
+    g_runtime_exit_hook = exit_hook();
+    generated.remove_all_states( generated_log );
+    assert( generated.push_state( screens_states::main_menu, generated_log ) && generated.push_state( screens_states::options, generated_log ) );
+    g_generated_exit_hook = [&]( int id ) { if ( id == screens_states::options ) generated.push_state( screens_states::dialog, generated_log ); };
+    generated_log.clear();
+    generated.remove_all_states( generated_log );
+    assert( generated.get_current_states_count() == 1 && generated.get_top_state_id() == screens_states::dialog );
+    assert( generated_log.size() == 3 && generated_log[0] == -screens_states::options && generated_log[1] == screens_states::dialog && generated_log[2] == -screens_states::main_menu );
+    g_generated_exit_hook = exit_hook();
+
+      // Check that dispatch replaces the top state along transitions of the definition
+    generated.remove_all_states( generated_log );
+    assert( !generated.dispatch( screens_events::start, generated_log ) );
+    assert( generated.push_state( screens_states::main_menu, generated_log ) && generated.dispatch( screens_events::start, generated_log ) );
+    assert( generated.dispatch( screens_events::loaded, generated_log ) && generated.get_top_state_id() == screens_states::hud );
+    assert( !generated.dispatch( screens_events::back, generated_log ) );
+    assert( generated.push_state( screens_states::pause, generated_log ) && generated.dispatch( screens_events::open_options, generated_log ) );
+    assert( generated.get_current_states_count() == 2 && generated.get_top_state_id() == screens_states::options );
+}
+
+//----------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+    assert( argc == 2 );
+
+    test_single_conformance();
+    test_dispatch_conformance( argv[1] );
+    test_stacked_conformance();
+}
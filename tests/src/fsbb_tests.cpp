@@ -1,6 +1,15 @@
 #include "fsbb_prefabs.hpp"
+#include "fsbb_parallel.hpp"
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
 #include <assert.h>
+#include <stdlib.h>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
 
 using namespace fsbb;
 
@@ -14,6 +23,24 @@ struct test_action
 
 std::vector<test_action> g_test_actions;
 
+//----------------------------------------------------------------
+// Allocation counting
+//----------------------------------------------------------------
+
+size_t g_allocations = 0;
+
+void* operator new( size_t size )
+{
+    ++g_allocations;
+    void* p = malloc( size != 0 ? size : 1 );
+    if ( p == 0 )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete( void* p ) noexcept { free( p ); }
+void operator delete( void* p, size_t ) noexcept { free( p ); }
+
 class state
 {
 public:
@@ -69,6 +96,45 @@ void test_simple_fsm()
     assert( !test1.queue_change_state( 4 ) );
 }
 
+struct counted_context
+{
+    counted_context() : m_enters( 0 ), m_exits( 0 ) {}
+
+    int m_enters;
+    int m_exits;
+};
+
+class value_context_state
+{
+public:
+    void on_enter( counted_context& ctx ) { ++ctx.m_enters; }
+    void on_exit( counted_context& ctx ) { ++ctx.m_exits; }
+};
+
+void test_value_context()
+{
+    value_context_state states[3];
+    fsm_stacked_combined_enter_exit<int, value_context_state*, counted_context> test1;
+    test1.register_state( 1, &states[0] );
+    test1.register_state( 2, &states[1] );
+    test1.register_state( 3, &states[2] );
+
+      // Check that functions taking a non-const reference modify a non-const argument in place
+    counted_context ctx;
+    assert( test1.push_state( 1, ctx ) && test1.push_state( 2, ctx ) );
+    test1.queue_push_state( 3 );
+    test1.update( ctx );
+    assert( ctx.m_enters == 3 && ctx.m_exits == 0 );
+
+      // Check that a const argument is copied, and a temporary is accepted
+    const counted_context const_ctx;
+    assert( test1.pop_state( const_ctx ) && const_ctx.m_exits == 0 );
+    assert( test1.pop_state( counted_context() ) );
+
+    test1.remove_all_states( ctx );
+    assert( ctx.m_enters == 3 && ctx.m_exits == 1 && test1.get_current_states().empty() );
+}
+
 void test_stacked_fsm()
 {
     g_test_actions.clear();
@@ -138,6 +204,80 @@ void test_stacked_fsm()
     assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 2 );
 }
 
+  // Records enter/exit calls as state does, and then calls m_on_exit, which may change the stack
+class reacting_state : public state
+{
+public:
+    reacting_state( int id ) : state( id ) {}
+
+    void on_exit( int ctx )
+    {
+        state::on_exit( ctx );
+        if ( m_on_exit )
+            m_on_exit();
+    }
+
+    std::function<void()> m_on_exit;
+};
+
+bool check_test_action( size_t index, test_action::type type, int state_id )
+{
+    return index < g_test_actions.size() && g_test_actions[index].m_type == type && g_test_actions[index].m_state_id == state_id;
+}
+
+template<typename t_machine>
+void check_remove_all_with_reacting_states( bool queued )
+{
+    t_machine machine;
+    std::vector<reacting_state*> states;
+    for ( int i = 1; i <= 4; ++i )
+    {
+        states.push_back( new reacting_state( i ) );
+        machine.register_state( i, states.back() );
+    }
+
+      // Check that states present at the start are exited, even if on_exit pushes a new state, which stays
+    states[1]->m_on_exit = [&machine]() { machine.push_state( 4, CONTEXT ); };
+    machine.push_state( 1, CONTEXT );
+    machine.push_state( 2, CONTEXT );
+    g_test_actions.clear();
+
+    if ( queued )
+    {
+        machine.queue_remove_all_states();
+        machine.update( CONTEXT );
+    }
+    else
+        machine.remove_all_states( CONTEXT );
+
+    assert( machine.get_current_states().size() == 1 && machine.get_top_state_id() == 4 );
+    assert( g_test_actions.size() == 3 );
+    assert( check_test_action( 0, test_action::exit, 2 ) && check_test_action( 1, test_action::enter, 4 ) && check_test_action( 2, test_action::exit, 1 ) );
+
+      // Check that states removed by on_exit of other states are exited only once
+    machine.remove_all_states( CONTEXT );
+    states[1]->m_on_exit = [&machine]() { machine.remove_state( 1, CONTEXT ); };
+    states[2]->m_on_exit = [&machine]() { machine.push_state( 4, CONTEXT ); };
+    machine.push_state( 1, CONTEXT );
+    machine.push_state( 2, CONTEXT );
+    machine.push_state( 3, CONTEXT );
+    g_test_actions.clear();
+
+    machine.remove_all_states( CONTEXT );
+    assert( machine.get_current_states().size() == 1 && machine.get_top_state_id() == 4 );
+    assert( g_test_actions.size() == 4 );
+    assert( check_test_action( 0, test_action::exit, 3 ) && check_test_action( 1, test_action::enter, 4 ) );
+    assert( check_test_action( 2, test_action::exit, 2 ) && check_test_action( 3, test_action::exit, 1 ) );
+}
+
+void test_stacked_remove_all_reentrant()
+{
+    check_remove_all_with_reacting_states<fsm_stacked_combined_enter_exit<int, reacting_state*, int> >( false );
+    check_remove_all_with_reacting_states<fsm_stacked_combined_enter_exit<int, reacting_state*, int> >( true );
+    check_remove_all_with_reacting_states<fsm_stacked_indexed_combined_enter_exit<int, reacting_state*, int> >( false );
+    check_remove_all_with_reacting_states<fsm_stacked_fixed_combined_enter_exit<int, reacting_state*, 4, 4, int> >( true );
+}
+
 void test_stacked_queued_fsm()
 {
     g_test_actions.clear();
@@ -179,9 +319,1601 @@ void test_stacked_queued_fsm()
     assert( g_test_actions[9].m_type == test_action::exit && g_test_actions[9].m_state_id == 1 );
 }
 
+void test_stacked_coalesced_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_stacked_combined_enter_exit<int, state*, int> test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+    test1.register_state( 3, new state( 3 ) );
+    test1.register_state( 4, new state( 4 ) );
+    test1.set_queue_coalescing( true );
+
+      // Check that states which are added and removed in the same update get no calls at all
+    test1.queue_push_state( 1 );
+    test1.queue_push_state( 2 );
+    test1.queue_pop_state();
+    test1.queue_push_state( 3 );
+    test1.queue_remove_state( 3 );
+    test1.queue_push_state( 4 );
+    test1.update( CONTEXT );
+
+    assert( test1.get_current_states().size() == 2 && test1.get_top_state_id() == 4 );
+    assert( g_test_actions.size() == 2 );
+    assert( g_test_actions[0].m_type == test_action::enter && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 4 );
+
+      // Check that states which are removed and added back in the same order stay untouched
+    g_test_actions.clear();
+    test1.queue_remove_all_states();
+    test1.queue_push_state( 1 );
+    test1.queue_push_state( 2 );
+    test1.queue_push_state( 4 );
+    test1.update( CONTEXT );
+
+    assert( test1.get_current_states().size() == 3 );
+    assert( test1.get_current_states()[0]->id == 1 && test1.get_current_states()[1]->id == 2 && test1.get_current_states()[2]->id == 4 );
+    assert( g_test_actions.size() == 1 );
+    assert( g_test_actions[0].m_type == test_action::enter && g_test_actions[0].m_state_id == 2 );
+
+      // Check that a state which changes its position in the stack is removed and added back
+    g_test_actions.clear();
+    test1.queue_remove_state( 1 );
+    test1.queue_push_state( 1 );
+    test1.update( CONTEXT );
+
+    assert( test1.get_current_states()[0]->id == 2 && test1.get_top_state_id() == 1 );
+    assert( g_test_actions.size() == 2 );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 1 );
+
+      // Check that invalid actions are skipped just as in exact replay
+    g_test_actions.clear();
+    test1.queue_remove_state( 3 );
+    test1.queue_push_state( 5 );
+    test1.queue_push_state( 2 );
+    test1.queue_remove_state_and_all_above( 4 );
+    test1.update( CONTEXT );
+
+    assert( test1.get_current_states().size() == 1 && test1.get_top_state_id() == 2 );
+    assert( g_test_actions.size() == 2 );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::exit && g_test_actions[1].m_state_id == 4 );
+
+      // Check that exact replay is still available on the same machine
+    g_test_actions.clear();
+    test1.set_queue_coalescing( false );
+    test1.queue_push_state( 1 );
+    test1.queue_pop_state();
+    test1.update( CONTEXT );
+
+    assert( g_test_actions.size() == 2 && test1.get_top_state_id() == 2 );
+
+      // Check that machines do not keep scratch stacks for coalescing: the queued impl holds references and the queue only
+    typedef state_manipulator_stacked_queued_impl_base<int, state*, state_registry<int, state*>, stacked_storage_fixed<32, 32> > fixed_queued_impl;
+    assert( sizeof( fixed_queued_impl ) <= sizeof( fixed_queued_impl::queued_actions_vector ) + 4 * sizeof( void* ) );
+}
+
+void check_test_actions( const test_action* expected, size_t count )
+{
+    assert( g_test_actions.size() == count );
+    for ( size_t i = 0; i < count; ++i )
+        assert( g_test_actions[i].m_type == expected[i].m_type && g_test_actions[i].m_state_id == expected[i].m_state_id );
+
+    g_test_actions.clear();
+}
+
+void test_hierarchical_fsm()
+{
+    enum { locomotion = 1, grounded, walking, running, airborne, jumping, falling, dead };
+    const test_action::type enter = test_action::enter;
+    const test_action::type exit = test_action::exit;
+
+    g_test_actions.clear();
+
+    fsm_hierarchical_combined_enter_exit<int, state*, int> test1;
+    for ( int i = locomotion; i <= dead; ++i )
+        test1.register_state( i, new state( i ) );
+
+    assert( test1.set_parent( grounded, locomotion ) && test1.set_parent( airborne, locomotion ) );
+    assert( test1.set_parent( walking, grounded ) && test1.set_parent( running, grounded ) );
+    assert( test1.set_parent( jumping, airborne ) && test1.set_parent( falling, airborne ) );
+    assert( test1.set_initial_state( locomotion, grounded ) && test1.set_initial_state( grounded, walking ) );
+
+      // Check that cycles and initial states which are not direct children are rejected
+    assert( !test1.set_parent( locomotion, walking ) && !test1.set_parent( walking, walking ) );
+    assert( !test1.set_initial_state( locomotion, walking ) && !test1.set_parent( walking, 100 ) );
+
+      // Check that initial states are entered from the top down
+    assert( test1.change_state_immediate( locomotion, CONTEXT ) );
+    const test_action initial[] = { { enter, locomotion }, { enter, grounded }, { enter, walking } };
+    check_test_actions( initial, 3 );
+    assert( test1.get_current_state_id() == walking && test1.get_active_states().size() == 3 );
+    assert( test1.is_in_state( locomotion ) && test1.is_in_state( grounded ) && !test1.is_in_state( airborne ) );
+
+      // Check that only states below the common ancestor are exited and entered
+    assert( test1.change_state_immediate( running, CONTEXT ) );
+    const test_action sibling[] = { { exit, walking }, { enter, running } };
+    check_test_actions( sibling, 2 );
+
+    assert( test1.change_state_immediate( jumping, CONTEXT ) );
+    const test_action cousin[] = { { exit, running }, { exit, grounded }, { enter, airborne }, { enter, jumping } };
+    check_test_actions( cousin, 4 );
+
+      // Check that transitions use the same cached common ancestor when repeated
+    assert( test1.change_state_immediate( running, CONTEXT ) && test1.change_state_immediate( jumping, CONTEXT ) );
+    g_test_actions.clear();
+
+      // Check that changing to an active ancestor exits and enters it again, with its initial states
+    assert( test1.change_state_immediate( airborne, CONTEXT ) );
+    const test_action ancestor[] = { { exit, jumping }, { exit, airborne }, { enter, airborne } };
+    check_test_actions( ancestor, 3 );
+    assert( test1.get_current_state_id() == airborne );
+
+      // Check that an active state cannot be moved in the hierarchy, but an inactive one can
+    assert( !test1.set_parent( airborne, dead ) );
+    assert( test1.set_parent( falling, dead ) && test1.set_parent( falling, airborne ) );
+
+      // Check that queued changes are executed on update
+    assert( test1.queue_change_state( dead ) && test1.get_current_state_id() == airborne );
+    test1.update( CONTEXT );
+    const test_action root[] = { { exit, airborne }, { exit, locomotion }, { enter, dead } };
+    check_test_actions( root, 3 );
+    assert( test1.get_active_states().size() == 1 && test1.get_current_state()->get_id() == dead );
+
+      // Check that states registered after transitions can be added to the hierarchy, even though the
+      // registry moves its states when it grows
+    test1.register_state( 9, new state( 9 ) );
+    assert( test1.set_parent( 9, airborne ) );
+    assert( test1.change_state_immediate( 9, CONTEXT ) );
+    const test_action late[] = { { exit, dead }, { enter, locomotion }, { enter, airborne }, { enter, 9 } };
+    check_test_actions( late, 4 );
+    assert( test1.get_current_state_id() == 9 && test1.get_current_state()->get_id() == 9 && test1.is_in_state( airborne ) );
+}
+
+void test_regions_fsm()
+{
+    enum { idle = 1, walking, holstered, aiming, waving };
+    const test_action::type enter = test_action::enter;
+    const test_action::type exit = test_action::exit;
+
+    g_test_actions.clear();
+
+    fsm_regions_combined_enter_exit<int, state*, int> test1;
+    for ( int i = idle; i <= waving; ++i )
+        test1.register_state( i, new state( i ) );
+
+    const size_t movement = test1.add_region();
+    const size_t weapon = test1.add_region();
+    const size_t emote = test1.add_region();
+    assert( test1.get_regions_count() == 3 && test1.get_current_state( emote ) == 0 );
+
+      // Check that regions change states independently
+    assert( test1.change_state_immediate( movement, idle, CONTEXT ) && test1.change_state_immediate( weapon, holstered, CONTEXT ) );
+    assert( test1.change_state_immediate( movement, walking, CONTEXT ) );
+    const test_action immediate[] = { { enter, idle }, { enter, holstered }, { exit, idle }, { enter, walking } };
+    check_test_actions( immediate, 4 );
+    assert( test1.get_current_state_id( movement ) == walking && test1.get_current_state_id( weapon ) == holstered );
+
+    assert( !test1.change_state_immediate( 3, idle, CONTEXT ) && !test1.change_state_immediate( movement, 100, CONTEXT ) );
+    assert( !test1.queue_change_state( 3, idle ) && !test1.queue_change_state( movement, 100 ) );
+
+      // Check that one update applies queued changes of all regions, in order of queuing,
+      // and only the last change queued for each region
+    assert( test1.queue_change_state( weapon, aiming ) && test1.queue_change_state( emote, waving ) );
+    assert( test1.queue_change_state( movement, walking ) && test1.queue_change_state( movement, idle ) );
+    assert( test1.get_current_state_id( weapon ) == holstered );
+    test1.update( CONTEXT );
+    const test_action queued[] = { { exit, holstered }, { enter, aiming }, { enter, waving }, { exit, walking }, { enter, idle } };
+    check_test_actions( queued, 5 );
+    assert( test1.get_current_state_id( movement ) == idle && test1.get_current_state_id( emote ) == waving );
+
+    test1.update( CONTEXT );
+    assert( g_test_actions.empty() );
+}
+
+struct variant_idle_state
+{
+    variant_idle_state() : m_entered( 0 ), m_exited( 0 ) {}
+
+    void on_enter( int& ctx ) { ++m_entered; ctx += 1; }
+    void on_exit( int& ctx ) { ++m_exited; ctx += 10; }
+
+    int m_entered;
+    int m_exited;
+};
+
+struct variant_walk_state
+{
+    explicit variant_walk_state( int speed = 0 ) : m_speed( speed ), m_exited( 0 ) {}
+
+    void on_enter( int& ctx ) { ctx += 100 * m_speed; }
+    void on_exit( int& ctx ) { ++m_exited; ctx += 1000; }
+
+    int m_speed;
+    int m_exited;
+};
+
+void test_variant_fsm()
+{
+    typedef std::variant<variant_idle_state, variant_walk_state> variant_state;
+
+    fsm_single_variant_combined_enter_exit<int, variant_state, int&> test1;
+    test1.register_state( 1, variant_idle_state() );
+    test1.register_state( 2, variant_walk_state( 2 ) );
+    test1.register_state( 3, variant_walk_state( 3 ) );
+
+      // Check that the concrete state held by the variant is called, and that it is stored inline
+    int ctx = 0;
+    assert( test1.change_state_immediate( 1, ctx ) && ctx == 1 );
+    assert( test1.change_state_immediate( 3, ctx ) && ctx == 1 + 10 + 300 );
+    test1.queue_change_state( 1 );
+    test1.update( ctx );
+    assert( ctx == 311 + 1000 + 1 && test1.get_current_state_id() == 1 );
+    assert( std::get<variant_idle_state>( test1.find_state( 1 )->state ).m_entered == 2 );
+
+    fsm_stacked_variant_combined_enter_exit<int, variant_state, int&> test2;
+    test2.register_state( 1, variant_idle_state() );
+    test2.register_state( 2, variant_walk_state( 2 ) );
+
+    ctx = 0;
+    test2.push_state( 1, ctx );
+    test2.push_state( 2, ctx );
+    test2.pop_state( ctx );
+    assert( ctx == 1 + 200 + 1000 && test2.get_top_state_id() == 1 );
+
+      // Check that on_exit is called on the registered state, not on a copy of it
+    test2.push_state( 2, ctx );
+    assert( test2.remove_state( 2, ctx ) && test2.remove_state( 1, ctx ) );
+    assert( std::get<variant_walk_state>( test2.find_state( 2 )->state ).m_exited == 2 );
+    assert( std::get<variant_idle_state>( test2.find_state( 1 )->state ).m_exited == 1 );
+}
+
+size_t g_lookups = 0;
+
+  // Linear lookup which counts finds
+struct registry_lookup_counted
+{
+    template<typename t_state_id>
+    class index : public registry_lookup_linear::index<t_state_id>
+    {
+    public:
+        template<typename t_states>
+        size_t find( const t_state_id& id, const t_states& states ) const
+        {
+            ++g_lookups;
+            return registry_lookup_linear::index<t_state_id>::find( id, states );
+        }
+    };
+};
+
+template<typename t_trace_policy>
+size_t count_traced_lookups()
+{
+    typedef state_registry<int, state*, registry_lookup_counted> registry;
+    fsm_stacked_traced_enter_exit<int, state*, int, t_trace_policy, registry> machine;
+    for ( int i = 1; i <= 4; ++i )
+        machine.register_state( i, new state( i ) );
+
+    g_lookups = 0;
+    machine.push_state( 1, CONTEXT );
+    machine.push_state( 2, CONTEXT );
+    machine.insert_state( 3, 0, CONTEXT );
+    machine.replace_top_state( 4, CONTEXT );
+    machine.remove_state( 3, CONTEXT );
+    machine.remove_state_and_all_above( 1, CONTEXT );
+
+    return g_lookups;
+}
+
+void test_traced_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_stacked_traced_enter_exit<int, state*, int, trace_policy_ring_buffer<8> > test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+    test1.register_state( 3, new state( 3 ) );
+
+    assert( test1.push_state( 1, CONTEXT ) && test1.push_state( 2, CONTEXT ) );
+    assert( !test1.push_state( 2, CONTEXT ) );
+    assert( test1.queue_remove_state( 1 ) && test1.queue_push_state( 3 ) );
+    test1.update( CONTEXT );
+
+      // Check that calls are recorded after their callbacks, i.e. in order of completion
+    const trace_operation operations[] = { trace_enter, trace_push_state, trace_enter, trace_push_state, trace_push_state,
+        trace_queue_remove_state, trace_queue_push_state, trace_exit, trace_enter, trace_update };
+    const size_t states[] = { 0, 0, 1, 1, 1, 0, 2, 0, 2, invalid_state_index };
+    const size_t depths[] = { invalid_state_index, 1, invalid_state_index, 2, 2, 2, 2, invalid_state_index, invalid_state_index, 2 };
+
+    assert( test1.get_trace().get_written_count() == 10 );
+
+      // Check that only the last 8 entries are kept, and the oldest of them is not returned,
+      // since the next record would rewrite it
+    std::vector<trace_entry> entries;
+    test1.get_trace().get_entries( entries );
+    assert( entries.size() == 7 );
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        assert( entries[i].m_operation == operations[i + 3] && entries[i].m_state == states[i + 3] && entries[i].m_depth == depths[i + 3] );
+        assert( i == 0 || entries[i].m_timestamp + entries[i].m_duration >= entries[i - 1].m_timestamp + entries[i - 1].m_duration );
+    }
+    assert( !entries[1].m_result && entries[2].m_result );
+
+      // Check that the update includes its callbacks
+    assert( entries[6].m_timestamp <= entries[4].m_timestamp && entries[6].m_timestamp + entries[6].m_duration >= entries[5].m_timestamp + entries[5].m_duration );
+
+    std::ostringstream json;
+    test1.export_chrome_trace( json, 5 );
+    const std::string text = json.str();
+    assert( text.find( "{\"traceEvents\":[" ) == 0 && text.find( "\"name\":\"queue_remove_state\"" ) != std::string::npos );
+    assert( text.find( "\"tid\":5" ) != std::string::npos && text.find( "\"state\":\"3\",\"depth\":2" ) != std::string::npos );
+
+      // Check that tracing successful calls and their callbacks looks nothing up in the registry
+    assert( count_traced_lookups<trace_policy_ring_buffer<> >() == count_traced_lookups<trace_policy_none>() );
+    assert( count_traced_lookups<trace_policy_statistics<> >() == count_traced_lookups<trace_policy_none>() );
+
+      // Check that a machine without tracing still works the same way
+    fsm_stacked_traced_enter_exit<int, state*, int, trace_policy_none> test2;
+    test2.register_state( 1, new state( 1 ) );
+    test2.queue_push_state( 1 );
+    test2.update( CONTEXT );
+    assert( test2.get_top_state_id() == 1 );
+}
+
+void test_state_statistics()
+{
+    g_test_actions.clear();
+
+    fsm_single_traced_enter_exit<int, state*, int, trace_policy_statistics<trace_clock_sequence> > test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+    test1.register_state( 3, new state( 3 ) );
+
+    test1.change_state_immediate( 1, CONTEXT );
+    test1.change_state_immediate( 2, CONTEXT );
+    test1.queue_change_state( 1 );
+    test1.update( CONTEXT );
+    test1.change_state_immediate( 2, CONTEXT );
+    assert( !test1.change_state_immediate( 4, CONTEXT ) );
+
+    state_statistics_snapshot snapshot;
+    test1.get_trace().take_snapshot( snapshot );
+    assert( snapshot.get_states_count() == 3 );
+    assert( snapshot.m_enters[0] == 2 && snapshot.m_enters[1] == 2 && snapshot.m_enters[2] == 0 );
+    assert( snapshot.m_total_time[0] > 0 && snapshot.m_max_time[0] > 0 && snapshot.m_max_time[0] <= snapshot.m_total_time[0] );
+    assert( snapshot.m_total_time[2] == 0 );
+    assert( snapshot.get_transitions( 0, 1 ) == 2 && snapshot.get_transitions( 1, 0 ) == 1 && snapshot.get_transitions( 1, 2 ) == 0 );
+
+      // Check that reset returns the same counters and then starts from zero
+    state_statistics_snapshot reset;
+    test1.get_trace().take_snapshot( reset, true );
+    assert( reset.m_enters == snapshot.m_enters && reset.m_transitions == snapshot.m_transitions );
+    test1.get_trace().take_snapshot( reset );
+    assert( reset.m_enters[0] == 0 && reset.m_enters[1] == 0 && reset.get_transitions( 0, 1 ) == 0 );
+
+      // Check that counters grow with the registry, and transitions of stacked machines follow the top state
+    fsm_stacked_traced_enter_exit<int, state*, int, trace_policy_statistics<trace_clock_sequence> > test2;
+    test2.reserve( 2 );
+    test2.register_state( 1, new state( 1 ) );
+    test2.push_state( 1, CONTEXT );
+    test2.register_state( 2, new state( 2 ) );
+    test2.push_state( 2, CONTEXT );
+    test2.queue_pop_state();
+    test2.update( CONTEXT );
+
+    test2.get_trace().take_snapshot( snapshot );
+    assert( snapshot.get_states_count() == 2 );
+    assert( snapshot.m_enters[0] == 1 && snapshot.m_enters[1] == 1 && snapshot.m_max_time[1] > 0 );
+    assert( snapshot.get_transitions( 0, 1 ) == 1 && snapshot.get_transitions( 1, 0 ) == 1 );
+
+      // Check that single-state machines can be traced into a ring buffer as well
+    fsm_single_traced_enter_exit<int, state*, int> test3;
+    test3.register_state( 1, new state( 1 ) );
+    test3.change_state_immediate( 1, CONTEXT );
+    assert( test3.get_trace().get_written_count() == 2 );
+}
+
+void test_snapshots()
+{
+    g_test_actions.clear();
+
+    fsm_single_combined_enter_exit<int, state*, int> singles[3];
+    fsm_single_combined_enter_exit<int, state*, int> restored_singles[3];
+    fsm_stacked_indexed_combined_enter_exit<int, state*, int> stacked;
+    fsm_stacked_indexed_combined_enter_exit<int, state*, int> restored_stacked;
+    for ( int i = 1; i <= 4; ++i )
+    {
+        for ( size_t m = 0; m < 3; ++m )
+        {
+            singles[m].register_state( i, new state( i ) );
+            restored_singles[m].register_state( i, new state( i ) );
+        }
+        stacked.register_state( i, new state( i ) );
+        restored_stacked.register_state( i, new state( i ) );
+    }
+
+    singles[0].change_state_immediate( 2, CONTEXT );
+    singles[1].change_state_immediate( 3, CONTEXT );
+    singles[1].queue_change_state( 4 );
+    singles[2].queue_change_state( 1 );
+
+    stacked.push_state( 1, CONTEXT );
+    stacked.push_state( 3, CONTEXT );
+    stacked.push_state( 2, CONTEXT );
+    stacked.queue_remove_state( 3 );
+    stacked.queue_push_state( 5 );
+    stacked.queue_pop_state();
+    stacked.queue_push_state( 4 );
+
+    std::vector<unsigned char> buffer;
+    save_snapshots( buffer, singles, singles + 3 );
+    const size_t singles_size = buffer.size();
+    assert( singles_size == 8 + 3 * 8 );
+
+    snapshot_writer writer( buffer );
+    stacked.save_snapshot( writer );
+    assert( buffer.size() == singles_size + 4 + 3 * 4 + 4 + 3 * 5 );
+
+      // Check that restoring does not call enter/exit functions
+    g_test_actions.clear();
+    assert( restore_snapshots( &buffer[0], singles_size, restored_singles, restored_singles + 3 ) );
+    snapshot_reader reader( &buffer[singles_size], buffer.size() - singles_size );
+    assert( restored_stacked.restore_snapshot( reader ) && reader.get_remaining() == 0 );
+    assert( g_test_actions.empty() );
+
+    assert( restored_singles[0].get_current_state_id() == 2 && restored_singles[1].get_current_state_id() == 3 );
+    assert( restored_singles[2].get_current_state() == 0 );
+    assert( restored_stacked.get_current_states().size() == 3 && restored_stacked.get_top_state_id() == 2 );
+
+      // Check that queued actions are restored, and the position index is rebuilt
+    for ( size_t m = 0; m < 3; ++m )
+        restored_singles[m].update( CONTEXT );
+    assert( restored_singles[1].get_current_state_id() == 4 && restored_singles[2].get_current_state_id() == 1 );
+
+    restored_stacked.update( CONTEXT );
+    assert( restored_stacked.get_current_states().size() == 2 && restored_stacked.get_top_state_id() == 4 );
+    assert( restored_stacked.is_state_in_stack( 1 ) && !restored_stacked.is_state_in_stack( 3 ) );
+
+      // Check that invalid data is rejected, and the stack is kept
+    snapshot_reader truncated( &buffer[singles_size], buffer.size() - singles_size - 20 );
+    assert( !restored_stacked.restore_snapshot( truncated ) );
+    assert( restored_stacked.get_current_states().size() == 2 && restored_stacked.get_top_state_id() == 4 );
+    assert( !restore_snapshots( &buffer[0], singles_size, restored_singles, restored_singles + 2 ) );
+
+      // Check that a stack with a repeated state is rejected
+    std::vector<unsigned char> repeated;
+    snapshot_writer repeated_writer( repeated );
+    repeated_writer.write_count( 2 );
+    repeated_writer.write_index( 0 );
+    repeated_writer.write_index( 0 );
+    repeated_writer.write_count( 0 );
+    snapshot_reader repeated_reader( &repeated[0], repeated.size() );
+    assert( !restored_stacked.restore_snapshot( repeated_reader ) );
+    assert( restored_stacked.get_current_states().size() == 2 && restored_stacked.get_top_state_id() == 4 && restored_stacked.is_state_in_stack( 1 ) );
+
+      // Check that a world is restored with its pending changes
+    fsm_single_world_enter_exit<int, state*, int> world;
+    fsm_single_world_enter_exit<int, state*, int> restored_world;
+    for ( int i = 1; i <= 2; ++i )
+    {
+        world.register_state( i, new state( i ) );
+        restored_world.register_state( i, new state( i ) );
+    }
+    world.change_state_immediate( world.create_instance(), 1, CONTEXT );
+    world.create_instance();
+    world.queue_change_state( 1, 2 );
+
+    buffer.clear();
+    world.save_snapshot( writer );
+    snapshot_reader world_reader( &buffer[0], buffer.size() );
+    assert( restored_world.restore_snapshot( world_reader ) );
+    assert( restored_world.get_instances_count() == 2 && restored_world.get_current_state_id( 0 ) == 1 && restored_world.get_current_state( 1 ) == 0 );
+    restored_world.update( CONTEXT );
+    assert( restored_world.get_current_state_id( 1 ) == 2 );
+}
+
+class graph_behaviour_policy
+{
+public:
+    static void on_enter( graph_state& state, context_holder<std::vector<graph_id>&>& ctx ) { ctx.m_context.push_back( state.id * 10 + state.state ); }
+    static void on_exit( graph_state& state, context_holder<std::vector<graph_id>&>& ctx ) { ctx.m_context.push_back( state.id * 100 ); }
+};
+
+void test_graph_fsm()
+{
+    state_graph_builder builder;
+    assert( builder.add_state( 10, "idle", 1 ) && builder.add_state( 20, "walk", 2 ) && builder.add_state( 5, "run", 3 ) );
+    assert( !builder.add_state( 20, "again" ) );
+    assert( builder.add_event( 7, "move" ) && builder.add_event( 3, "stop" ) );
+    assert( builder.add_transition( 10, 7, 20 ) && builder.add_transition( 20, 7, 5 ) && builder.add_transition( 20, 3, 10 ) && builder.add_transition( 5, 3, 10 ) );
+    assert( !builder.add_transition( 10, 7, 5 ) && !builder.add_transition( 10, 8, 5 ) );
+
+    std::vector<unsigned char> blob;
+    builder.build( blob );
+
+      // Check that the blob is used from a memory-mapped file
+    const char* path = "test_graph.fsbg";
+    {
+        std::ofstream out( path, std::ios::binary );
+        out.write( reinterpret_cast<const char*>( &blob[0] ), blob.size() );
+    }
+
+    state_graph_file file;
+    assert( file.open( path ) && file.get_size() == blob.size() );
+
+    fsm_single_graph<graph_behaviour_policy, std::vector<graph_id>&> test1;
+    assert( test1.attach( file ) );
+    assert( test1.get_states_count() == 3 && !test1.register_state( 30, 0 ) );
+    assert( test1.find_state_index( 5 ) == 2 && test1.find_state_index( 6 ) == invalid_state_index );
+    assert( std::string( test1.get_graph().get_state_name( 1 ) ) == "walk" && std::string( test1.get_graph().get_event_name( 1 ) ) == "stop" );
+
+    std::vector<graph_id> calls;
+    assert( !test1.dispatch( 7, calls ) );
+    assert( test1.change_state_immediate( 10, calls ) );
+    assert( test1.dispatch( 7, calls ) && test1.dispatch( 7, calls ) );
+    assert( test1.get_current_state_id() == 5 && test1.get_current_state() == 3 );
+    assert( !test1.dispatch( 7, calls ) && !test1.dispatch( 9, calls ) );
+    assert( test1.dispatch( 3, calls ) && test1.get_current_state_id() == 10 );
+
+    const graph_id expected[] = { 101, 1000, 202, 2000, 53, 500, 101 };
+    assert( calls.size() == 7 && std::equal( calls.begin(), calls.end(), expected ) );
+
+      // Check that damaged blobs are rejected
+    state_graph graph;
+    assert( graph.attach( &blob[0], blob.size() ) );
+    assert( !graph.attach( &blob[0], blob.size() - 4 ) );
+    blob[0] = 'X';
+    assert( !graph.attach( &blob[0], blob.size() ) );
+
+    file.close();
+    std::remove( path );
+}
+
+void test_rollback_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_stacked_rollback_enter_exit<int, state*, int> test1;
+    for ( int i = 1; i <= 3; ++i )
+        test1.register_state( i, new state( i ) );
+
+    test1.push_state( 1, CONTEXT );
+    test1.checkpoint( 1 );
+    test1.push_state( 2, CONTEXT );
+    test1.queue_push_state( 3 );
+    test1.checkpoint( 2 );
+    test1.update( CONTEXT );
+    test1.checkpoint( 3 );
+    test1.update( CONTEXT );
+    test1.checkpoint( 4 );
+    test1.pop_state( CONTEXT );
+
+      // Check that only frames with changes were saved
+    assert( test1.get_saved_frames_count() == 4 );
+    assert( test1.get_current_states().size() == 2 );
+
+      // Check that rewinding restores the stack and the queue without calling enter/exit functions
+    g_test_actions.clear();
+    assert( test1.rewind( 3 ) );
+    assert( test1.get_current_states().size() == 3 && test1.get_top_state_id() == 3 );
+    assert( test1.rewind( 2 ) );
+    assert( test1.get_current_states().size() == 2 && test1.get_top_state_id() == 2 );
+    assert( g_test_actions.empty() && test1.get_saved_frames_count() == 2 );
+
+    test1.get_rollback_clock().rewind( 2 );
+    test1.update( CONTEXT );
+    assert( test1.get_top_state_id() == 3 && g_test_actions.size() == 1 && g_test_actions[0].m_state_id == 3 );
+    assert( !test1.rewind( 3 ) );
+    assert( test1.rewind( 0 ) && test1.get_current_states().empty() );
+
+      // Check that machines share a clock, and frames older than the ring can not be restored
+    rollback_clock clock;
+    fsm_stacked_rollback_enter_exit<int, state*, int, 2> test2;
+    fsm_stacked_rollback_enter_exit<int, state*, int, 2> test3;
+    test2.set_rollback_clock( clock );
+    test3.set_rollback_clock( clock );
+    for ( int i = 1; i <= 3; ++i )
+    {
+        test2.register_state( i, new state( i ) );
+        test3.register_state( i, new state( i ) );
+    }
+
+    for ( int frame = 1; frame <= 3; ++frame )
+    {
+        clock.checkpoint( frame );
+        test2.push_state( frame, CONTEXT );
+    }
+    test3.push_state( 1, CONTEXT );
+
+    assert( !test2.rewind( 1 ) && test2.rewind( 2 ) );
+    assert( test2.get_current_states().size() == 1 && test2.get_top_state_id() == 1 );
+    assert( test3.rewind( 3 ) && test3.get_current_states().empty() );
+}
+
+void test_interned_ids()
+{
+    g_test_actions.clear();
+
+    symbol_table table;
+    const interned_id idle = table.intern( "idle" );
+    const interned_id walk = table.intern( std::string( "walk" ) );
+
+      // Check that names map to the same dense handles every time, and hashes are cached
+    assert( idle.is_valid() && idle.get_handle() == 1 && walk.get_handle() == 2 );
+    assert( table.intern( "idle" ) == idle && idle != walk );
+    assert( idle.get_hash() == symbol_table::hash( "idle", 4 ) && std::hash<interned_id>()( walk ) == walk.get_hash() );
+    assert( table.find( "walk" ) == walk && !table.find( "swim" ).is_valid() && !interned_id().is_valid() );
+    assert( table.get_name( walk ) == "walk" && table.get_name( interned_id() ).empty() );
+
+      // Check that the table grows without losing names
+    std::vector<interned_id> ids;
+    for ( int i = 0; i < 1000; ++i )
+    {
+        std::ostringstream name;
+        name << "state_" << i;
+        ids.push_back( table.intern( name.str() ) );
+    }
+    assert( table.get_symbols_count() == 1002 );
+    for ( int i = 0; i < 1000; ++i )
+    {
+        std::ostringstream name;
+        name << "state_" << i;
+        assert( table.find( name.str() ) == ids[i] && table.get_name( ids[i] ) == name.str() );
+    }
+
+      // Check that ids work with every lookup policy, and are loaded from and written to text
+    fsm_stacked_combined_enter_exit<interned_id, state*, int, state_registry<interned_id, state*, registry_lookup_direct> > test1;
+    fsm_stacked_combined_enter_exit<interned_id, state*, int, state_registry<interned_id, state*, registry_lookup_hashed<> > > test2;
+    fsm_stacked_combined_enter_exit<interned_id, state*, int, state_registry<interned_id, state*, registry_lookup_sorted> > test3;
+
+    std::istringstream text( "menu game pause" );
+    for ( int i = 1; i <= 3; ++i )
+    {
+        interned_id id;
+        text >> id;
+        state* s = new state( i );
+        assert( test1.register_state( id, s ) && test2.register_state( id, s ) && test3.register_state( id, s ) );
+    }
+    assert( !test1.register_state( intern( "menu" ), new state( 4 ) ) );
+
+    assert( test1.push_state( intern( "menu" ), CONTEXT ) && test2.push_state( intern( "menu" ), CONTEXT ) && test3.push_state( intern( "menu" ), CONTEXT ) );
+    assert( test1.queue_push_state( intern( "game" ) ) && test1.queue_push_state( intern( "pause" ) ) );
+    assert( test1.queue_remove_state( intern( "game" ) ) );
+    test1.update( CONTEXT );
+    assert( test1.get_current_states().size() == 2 && test1.get_top_state_id() == intern( "pause" ) );
+    assert( !test2.push_state( intern( "swim" ), CONTEXT ) && test3.get_top_state_id() == intern( "menu" ) );
+
+    std::ostringstream name;
+    name << test1.get_top_state_id();
+    assert( name.str() == "pause" && get_interned_name( intern( "game" ) ) == "game" );
+}
+
+#if __cplusplus >= 202002L
+
+  // Enters by streaming for a few frames, exits immediately
+class async_state
+{
+public:
+    async_state( int id, int frames, bool throw_on_exit = false ) : m_id( id ), m_frames( frames ), m_throw_on_exit( throw_on_exit ) {}
+
+    async_task on_enter( async_executor& executor )
+    {
+        test_action a; a.m_type = test_action::enter; a.m_state_id = m_id; g_test_actions.push_back( a );
+
+        if ( m_frames < 0 )
+            throw m_id;
+
+        for ( int i = 0; i < m_frames; ++i )
+            co_await executor.schedule();
+    }
+
+    void on_exit( async_executor& executor )
+    {
+        test_action a; a.m_type = test_action::exit; a.m_state_id = m_id; g_test_actions.push_back( a );
+
+        if ( m_throw_on_exit )
+            throw m_id;
+    }
+
+private:
+    int m_id;
+    int m_frames;
+    bool m_throw_on_exit;
+};
+
+typedef fsm_single_async<int, async_state*, async_executor&> async_machine;
+
+async_task wait_for_transition( async_machine::t_transition transition, int& result )
+{
+    result = co_await transition ? 1 : -1;
+}
+
+void test_async_fsm()
+{
+    g_test_actions.clear();
+
+    async_executor executor;
+    async_machine test1;
+    test1.register_state( 1, new async_state( 1, 0 ) );
+    test1.register_state( 2, new async_state( 2, 2 ) );
+    test1.register_state( 3, new async_state( 3, 1 ) );
+    test1.register_state( 4, new async_state( 4, -1 ) );
+
+    assert( !test1.change_state( 5 ).is_valid() && test1.change_state( 5 ).is_done() );
+
+      // Check that synchronous functions finish a transition within one update
+    async_machine::t_transition t1 = test1.change_state( 1 );
+    assert( !t1.is_done() && test1.get_current_state_id() == 0 );
+    test1.update( executor );
+    assert( t1.is_done() && test1.get_current_state_id() == 1 && test1.get_async_phase() == async_idle );
+
+      // Check that update does not wait for a suspended on_enter, and a later request waits for it
+    int result = 0;
+    async_machine::t_transition t2 = test1.change_state( 2 );
+    async_task waiter = wait_for_transition( t2, result );
+    test1.update( executor );
+    assert( test1.get_async_phase() == async_entering && test1.get_current_state_id() == 2 && !t2.is_done() );
+
+    async_machine::t_transition t3 = test1.change_state( 3 );
+    test1.update( executor );
+    assert( executor.run() == 1 );
+    test1.update( executor );
+    assert( test1.get_current_state_id() == 2 && test1.is_transition_in_progress() && result == 0 );
+
+      // Check that the waiter is resumed when the transition completes, and the queued one starts
+    assert( executor.run() == 1 );
+    test1.update( executor );
+    assert( t2.is_done() && result == 1 && waiter.is_done() );
+    assert( !t3.is_done() && test1.get_current_state_id() == 3 && test1.get_async_phase() == async_entering );
+
+    assert( executor.run() == 1 );
+    test1.update( executor );
+    assert( t3.is_done() && test1.get_async_phase() == async_idle && !test1.is_transition_in_progress() );
+
+    const int expected[] = { 1, 1, 2, 2, 3 };
+    assert( g_test_actions.size() == 5 );
+    for ( size_t i = 0; i < g_test_actions.size(); ++i )
+        assert( g_test_actions[i].m_state_id == expected[i] && g_test_actions[i].m_type == ( i == 1 || i == 3 ? test_action::exit : test_action::enter ) );
+
+      // Check that an exception of on_enter is rethrown by update, which leaves the machine idle,
+      // and that the failed transition is seen as failed by its waiter
+    async_machine::t_transition t4 = test1.change_state( 4 );
+    async_task waiter4 = wait_for_transition( t4, result );
+    bool thrown = false;
+    try
+    {
+        test1.update( executor );
+    }
+    catch ( int id )
+    {
+        thrown = id == 4;
+    }
+    assert( thrown && t4.is_done() && t4.is_failed() && result == -1 && waiter4.is_done() );
+    assert( test1.get_async_phase() == async_idle && test1.get_current_state_id() == 4 && !t3.is_failed() );
+
+      // Check that a synchronous on_exit which throws keeps the old state, and leaves no phase or
+      // entering state behind, so the next update does not enter the new state
+    async_machine test2;
+    test2.register_state( 1, new async_state( 1, 0, true ) );
+    test2.register_state( 2, new async_state( 2, 0 ) );
+    test2.change_state( 1 );
+    test2.update( executor );
+
+    result = 0;
+    async_machine::t_transition t5 = test2.change_state( 2 );
+    async_task waiter5 = wait_for_transition( t5, result );
+    thrown = false;
+    try
+    {
+        test2.update( executor );
+    }
+    catch ( int id )
+    {
+        thrown = id == 1;
+    }
+    assert( thrown && t5.is_failed() && result == -1 );
+    assert( test2.get_async_phase() == async_idle && test2.get_entering_state_id() == 0 && test2.get_current_state_id() == 1 );
+
+    test2.update( executor );
+    assert( test2.get_current_state_id() == 1 && !test2.is_transition_in_progress() );
+
+      // Check that a later transition succeeds after a failed one
+    async_machine::t_transition t6 = test1.change_state( 1 );
+    test1.update( executor );
+    assert( t6.is_done() && !t6.is_failed() && t4.is_failed() && test1.get_current_state_id() == 1 );
+}
+
+#endif
+
+template<typename t_lookup_policy>
+void test_registry_lookup()
+{
+    state_registry<int, int, t_lookup_policy> registry;
+
+    for ( int i = 0; i < 100; ++i )
+        assert( registry.register_state( i * 3, i ) );
+
+      // Check that duplicate ids are rejected
+    assert( !registry.register_state( 3, 100 ) );
+    assert( registry.get_states_count() == 100 );
+
+      // Check that every registered state is found, and unregistered ones are not
+    for ( int i = 0; i < 100; ++i )
+    {
+        state_and_id<int, int>* s = registry.find_state( i * 3 );
+        assert( s != 0 && s->id == i * 3 && s->state == i );
+        assert( registry.get_state_index( s ) == (size_t)i );
+        assert( registry.find_state( i * 3 + 1 ) == 0 );
+    }
+}
+
+void test_registry_lookup_string()
+{
+    state_registry<std::string, int, registry_lookup_hashed<> > hashed;
+    state_registry<std::string, int, registry_lookup_sorted> sorted;
+
+    const char* names[] = { "idle", "walk", "run", "jump", "fall" };
+    for ( int i = 0; i < 5; ++i )
+    {
+        assert( hashed.register_state( names[i], i ) );
+        assert( sorted.register_state( names[i], i ) );
+    }
+
+    for ( int i = 0; i < 5; ++i )
+    {
+        assert( hashed.find_state( names[i] )->state == i );
+        assert( sorted.find_state( names[i] )->state == i );
+    }
+
+    assert( hashed.find_state( "swim" ) == 0 );
+    assert( sorted.find_state( "swim" ) == 0 );
+
+      // Check that a machine can be built on top of a non-default registry
+    fsm_single_combined_enter_exit<int, state*, int, state_registry<int, state*, registry_lookup_direct> > test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+
+    assert( !test1.register_state( -1, new state( -1 ) ) );
+    assert( test1.change_state_immediate( 2, CONTEXT ) );
+    assert( test1.get_current_state_id() == 2 );
+    assert( !test1.change_state_immediate( 3, CONTEXT ) );
+}
+
+void test_registry_stable_storage()
+{
+    typedef state_registry<int, state*, registry_lookup_hashed<>, registry_storage_chunked<4> > registry;
+
+    fsm_stacked_combined_enter_exit<int, state*, int, registry> test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+
+    assert( test1.push_state( 1, CONTEXT ) );
+    assert( test1.push_state( 2, CONTEXT ) );
+    const state_and_id<int, state*>* top = test1.get_current_states().back();
+
+      // Check that registering states while the machine is running does not move existing states
+    for ( int i = 3; i < 1000; ++i )
+        assert( test1.register_state( i, new state( i ) ) );
+
+    assert( test1.get_current_states().back() == top && top->id == 2 );
+    assert( test1.find_state( 2 ) == top );
+    assert( test1.get_state_index( top ) == 1 );
+    assert( test1.get_state_index( test1.find_state( 999 ) ) == 998 );
+
+    g_test_actions.clear();
+    test1.queue_remove_all_states();
+    test1.update( CONTEXT );
+    assert( g_test_actions.size() == 2 && g_test_actions[0].m_state_id == 2 && g_test_actions[1].m_state_id == 1 );
+
+      // Check that bulk registration skips duplicates
+    std::vector<state_and_id<int, int> > states;
+    for ( int i = 0; i < 100; ++i )
+    {
+        state_and_id<int, int> s;
+        s.id = i % 50;
+        s.state = i;
+        states.push_back( s );
+    }
+
+    state_registry<int, int, registry_lookup_direct, registry_storage_chunked<> > bulk;
+    assert( bulk.register_states( states.begin(), states.end() ) == 50 );
+    assert( bulk.get_states_count() == 50 && bulk.find_state( 49 )->state == 49 );
+
+      // Check that a copy of a registry does not share states with the original
+    state_registry<int, int, registry_lookup_direct, registry_storage_chunked<> > copy( bulk );
+    assert( copy.find_state( 10 ) != bulk.find_state( 10 ) && copy.find_state( 10 )->state == 10 );
+
+      // Check that reserve allocates once for states spanning several blocks, and that indices map
+      // to the same states both ways
+    registry_storage_chunked<4>::storage<int> chunked;
+    chunked.push_back( 0 );
+    const size_t allocations = g_allocations;
+    chunked.reserve( 100 );
+    for ( int i = 1; i < 100; ++i )
+        chunked.push_back( i );
+
+    assert( g_allocations - allocations == 1 && chunked.size() == 100 );
+    for ( size_t i = 0; i < chunked.size(); ++i )
+        assert( chunked[i] == (int)i && chunked.index_of( &chunked[i] ) == i );
+}
+
+template<int t_id>
+class static_state
+{
+public:
+    void on_enter( int ctx ) { test_action a; a.m_type = test_action::enter; a.m_state_id = t_id; g_test_actions.push_back( a ); }
+    void on_exit( int ctx ) { test_action a; a.m_type = test_action::exit; a.m_state_id = t_id; g_test_actions.push_back( a ); }
+};
+
+void test_static_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_static_single_immediate_enter_exit<int, static_state<1>, static_state<2>, static_state<3> > test1;
+
+      // Check that FSM correctly enters the first state
+    test1.change_state_immediate<static_state<1> >( CONTEXT );
+    assert( test1.is_current_state<static_state<1> >() && test1.get_current_state_id() == 0 );
+    assert( g_test_actions.size() == 1 );
+    assert( g_test_actions[0].m_type == test_action::enter && g_test_actions[0].m_state_id == 1 );
+
+    g_test_actions.clear();
+
+      // Check that FSM correctly changes states
+    test1.change_state_immediate<static_state<3> >( CONTEXT );
+    assert( test1.is_current_state<static_state<3> >() );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 3 );
+
+    g_test_actions.clear();
+
+      // Check that FSM correctly changes states by runtime index, and rejects invalid indices
+    assert( test1.change_state_immediate( 1, CONTEXT ) );
+    assert( test1.is_current_state<static_state<2> >() );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 3 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 2 );
+    assert( !test1.change_state_immediate( 3, CONTEXT ) );
+    assert( test1.is_current_state<static_state<2> >() );
+}
+
+void test_world_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_single_world_enter_exit<int, state*, int> world;
+    world.register_state( 1, new state( 1 ) );
+    world.register_state( 2, new state( 2 ) );
+
+    const size_t a = world.create_instance();
+    const size_t b = world.create_instance();
+    assert( world.get_instances_count() == 2 );
+    assert( world.get_current_state( a ) == 0 && world.get_current_state_id( b ) == 0 );
+
+      // Check that instances change states independently
+    assert( world.change_state_immediate( a, 1, CONTEXT ) );
+    assert( world.get_current_state_id( a ) == 1 && world.get_current_state( b ) == 0 );
+    assert( g_test_actions.size() == 1 && g_test_actions[0].m_state_id == 1 );
+
+    g_test_actions.clear();
+
+      // Check that queued changes are applied only on update, and only the last one is executed
+    assert( world.queue_change_state( a, 1 ) );
+    assert( world.queue_change_state( a, 2 ) );
+    assert( world.queue_change_state( b, 2 ) );
+    assert( !world.queue_change_state( b, 3 ) );
+    assert( world.get_current_state_id( a ) == 1 && g_test_actions.empty() );
+
+    world.update( CONTEXT );
+    assert( world.get_current_state_id( a ) == 2 && world.get_current_state_id( b ) == 2 );
+    assert( g_test_actions.size() == 3 );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 2 );
+    assert( g_test_actions[2].m_type == test_action::enter && g_test_actions[2].m_state_id == 2 );
+
+    g_test_actions.clear();
+
+      // Check that update does nothing when nothing is queued
+    world.update( CONTEXT );
+    assert( g_test_actions.empty() );
+}
+
+void test_batch_dispatch()
+{
+    const int idle = 1, alarmed = 2, fleeing = 3;
+    const int alarm = 1, calm = 2, unknown = 3;
+
+    typedef fsm_single_world_enter_exit<int, state*, int> world_type;
+    world_type worlds[2];
+    batch_transition_table<int> tables[2];
+    for ( int w = 0; w < 2; ++w )
+    {
+        for ( int i = idle; i <= fleeing; ++i )
+            worlds[w].register_state( i, new state( i ) );
+
+        assert( tables[w].add_transition( worlds[w], idle, alarm, alarmed ) );
+        assert( tables[w].add_transition( worlds[w], alarmed, alarm, fleeing ) );
+        assert( tables[w].add_transition( worlds[w], alarmed, calm, idle ) );
+        assert( tables[w].add_transition( worlds[w], fleeing, calm, idle ) );
+        assert( tables[w].add_transition( worlds[w], fleeing, calm, alarmed ) );
+        assert( !tables[w].add_transition( worlds[w], idle, alarm, 4 ) );
+        assert( tables[w].get_events_count() == 2 && tables[w].get_transitions_count() == 5 );
+    }
+
+      // The first table reads targets with the vector path where the CPU supports it, the second one with the scalar path
+    tables[1].set_vectorized( false );
+    assert( tables[0].is_vectorized() == batch_transition_table<int>::is_avx2_supported() && !tables[1].is_vectorized() );
+
+      // Check that only instances with a transition from their current state change, once update is called.
+      // Instance 0 has no state, the other ones are idle, alarmed or fleeing.
+    const size_t INSTANCES = 103;
+    for ( size_t i = 0; i < INSTANCES; ++i )
+    {
+        for ( int w = 0; w < 2; ++w )
+        {
+            worlds[w].create_instance();
+            if ( i > 0 )
+                worlds[w].change_state_immediate( i, (int)( i % 3 ) + 1, CONTEXT );
+        }
+    }
+
+    g_test_actions.clear();
+    assert( worlds[0].queue_dispatch( tables[0], calm ) == 68 && worlds[0].get_current_state_id( 2 ) == fleeing );
+    assert( worlds[0].queue_dispatch( tables[0], unknown ) == 0 );
+    assert( g_test_actions.empty() );
+    worlds[0].update( CONTEXT );
+    assert( g_test_actions.size() == 68 * 2 );
+    assert( worlds[0].get_current_state_index( 0 ) == invalid_state_index );
+    assert( worlds[0].get_current_state_id( 1 ) == idle && worlds[0].get_current_state_id( 2 ) == idle && worlds[0].get_current_state_id( 3 ) == idle );
+    worlds[1].queue_dispatch( tables[1], calm );
+    worlds[1].update( CONTEXT );
+
+      // Check that both paths do the same for random batches of instances and events
+    std::vector<size_t> instances;
+    std::vector<int> events( INSTANCES );
+    srand( 5 );
+    for ( int step = 0; step < 200; ++step )
+    {
+        size_t queued[2];
+        const int event = rand() % 4;
+        switch ( rand() % 3 )
+        {
+        case 0:
+            for ( int w = 0; w < 2; ++w )
+                queued[w] = worlds[w].queue_dispatch( tables[w], event );
+            break;
+        case 1:
+            instances.resize( rand() % INSTANCES );
+            for ( size_t i = 0; i < instances.size(); ++i )
+                instances[i] = rand() % INSTANCES;
+            for ( int w = 0; w < 2; ++w )
+                queued[w] = worlds[w].queue_dispatch( tables[w], instances.empty() ? 0 : &instances[0], instances.size(), event );
+            break;
+        default:
+            for ( size_t i = 0; i < INSTANCES; ++i )
+                events[i] = rand() % 4;
+            for ( int w = 0; w < 2; ++w )
+                queued[w] = worlds[w].queue_dispatch( tables[w], &events[0] );
+        }
+
+        assert( queued[0] == queued[1] );
+        if ( rand() % 2 == 0 )
+        {
+            worlds[0].update( CONTEXT );
+            worlds[1].update( CONTEXT );
+        }
+
+        for ( size_t i = 0; i < INSTANCES; ++i )
+            assert( worlds[0].get_current_state_index( i ) == worlds[1].get_current_state_index( i ) );
+    }
+}
+
+class counting_state
+{
+public:
+    void on_enter( int& ctx ) { ++ctx; }
+    void on_exit( int& ctx ) { ++ctx; }
+};
+
+void test_parallel_update()
+{
+    typedef fsm_single_queued_enter_exit<int, counting_state*, int&> machine;
+
+    counting_state states[2];
+    std::vector<machine> machines( 1000 );
+    for ( size_t i = 0; i < machines.size(); ++i )
+    {
+        machines[i].register_state( 1, &states[0] );
+        machines[i].register_state( 2, &states[1] );
+        machines[i].queue_change_state( 1 );
+    }
+
+    parallel_update_pool pool( 4 );
+    assert( pool.get_workers_count() == 4 );
+
+      // Check that every machine is updated exactly once, with its worker's context
+    std::vector<int> contexts( pool.get_workers_count(), 0 );
+    assert( update_parallel( pool, machines.begin(), machines.end(), contexts, 7 ) );
+
+    int enters = 0;
+    for ( size_t i = 0; i < contexts.size(); ++i )
+        enters += contexts[i];
+
+    assert( enters == 1000 );
+    for ( size_t i = 0; i < machines.size(); ++i )
+        assert( machines[i].get_current_state_id() == 1 );
+
+      // Check that the pool can be reused, and works with pointers to machines
+    std::vector<machine*> pointers;
+    for ( size_t i = 0; i < machines.size(); i += 2 )
+    {
+        machines[i].queue_change_state( 2 );
+        pointers.push_back( &machines[i] );
+    }
+
+    std::fill( contexts.begin(), contexts.end(), 0 );
+    assert( update_parallel( pool, pointers.begin(), pointers.end(), contexts, 64 ) );
+
+    int transitions = 0;
+    for ( size_t i = 0; i < contexts.size(); ++i )
+        transitions += contexts[i];
+
+    assert( transitions == 1000 );
+    assert( machines[0].get_current_state_id() == 2 && machines[1].get_current_state_id() == 1 );
+
+      // Check that too few contexts (including none) are rejected before any machine is updated
+    machines[1].queue_change_state( 2 );
+    std::vector<int> too_few( pool.get_workers_count() - 1, 0 );
+    std::vector<int> none;
+    assert( !update_parallel( pool, machines.begin(), machines.end(), too_few ) );
+    assert( !update_parallel( pool, machines.begin(), machines.end(), none ) );
+    assert( machines[1].get_current_state_id() == 1 );
+}
+
+void test_concurrent_queued_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_stacked_concurrent_enter_exit<int, state*, int, 16> test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+    test1.register_state( 3, new state( 3 ) );
+
+      // Check that queued actions are executed in order, like in non-concurrent queued machine
+    assert( test1.queue_push_state( 1 ) );
+    assert( test1.queue_push_state( 2 ) );
+    assert( test1.queue_pop_state() );
+    assert( test1.queue_push_state( 3 ) );
+    assert( test1.queue_remove_state( 1 ) );
+    assert( g_test_actions.empty() );
+
+    test1.update( CONTEXT );
+    assert( test1.get_top_state_id() == 3 && test1.get_current_states().size() == 1 );
+    assert( g_test_actions.size() == 5 );
+    assert( g_test_actions[2].m_type == test_action::exit && g_test_actions[2].m_state_id == 2 );
+    assert( g_test_actions[4].m_type == test_action::exit && g_test_actions[4].m_state_id == 1 );
+
+      // Check that a full queue rejects actions
+    for ( int i = 0; i < 16; ++i )
+        assert( test1.queue_remove_all_states() );
+    assert( !test1.queue_push_state( 1 ) );
+    test1.update( CONTEXT );
+    assert( test1.get_current_states().empty() );
+
+      // Check that actions queued from several threads are all executed
+    std::vector<std::thread> threads;
+    for ( int t = 0; t < 4; ++t )
+        threads.push_back( std::thread( [&test1]{ for ( int i = 0; i < 2; ++i ) while ( !test1.queue_push_state( 1 ) ) {} } ) );
+    for ( size_t t = 0; t < threads.size(); ++t )
+        threads[t].join();
+
+    g_test_actions.clear();
+    test1.update( CONTEXT );
+    assert( test1.get_top_state_id() == 1 && g_test_actions.size() == 1 );
+}
+
+enum test_event { event_go, event_stop, event_jump };
+
+struct copy_counted_context
+{
+    copy_counted_context() : m_allow( false ) {}
+    copy_counted_context( const copy_counted_context& other ) : m_allow( other.m_allow ) { ++s_copies; }
+
+    bool m_allow;
+    static size_t s_copies;
+};
+
+size_t copy_counted_context::s_copies = 0;
+
+class copy_counted_state
+{
+public:
+    void on_enter( const copy_counted_context& ctx ) {}
+    void on_exit( const copy_counted_context& ctx ) {}
+};
+
+void test_transition_fsm()
+{
+    g_test_actions.clear();
+
+    fsm_single_transition_enter_exit<int, state*, test_event, int, registry_lookup_direct> test1;
+    test1.register_state( 1, new state( 1 ) );
+    test1.register_state( 2, new state( 2 ) );
+    test1.register_state( 3, new state( 3 ) );
+
+    assert( test1.add_transition( 1, event_go, 2 ) );
+    assert( test1.add_transition( 2, event_stop, 1 ) );
+    assert( test1.add_transition( 2, event_jump, 3, []( int ctx ){ return ctx > 1; } ) );
+    assert( test1.add_transition( 2, event_jump, 1 ) );
+    assert( !test1.add_transition( 1, event_go, 4 ) );
+    assert( test1.get_events_count() == 3 && test1.get_transitions_count() == 4 );
+
+      // Check that events are ignored until the machine enters a state
+    assert( !test1.dispatch( event_go, CONTEXT ) );
+    assert( test1.change_state_immediate( 1, CONTEXT ) );
+
+    g_test_actions.clear();
+
+      // Check that a matching rule changes state
+    assert( test1.dispatch( event_go, CONTEXT ) );
+    assert( test1.get_current_state_id() == 2 );
+    assert( g_test_actions[0].m_type == test_action::exit && g_test_actions[0].m_state_id == 1 );
+    assert( g_test_actions[1].m_type == test_action::enter && g_test_actions[1].m_state_id == 2 );
+
+      // Check that an event without rule for the current state is ignored
+    assert( !test1.dispatch( event_go, CONTEXT ) );
+    assert( test1.get_current_state_id() == 2 );
+
+      // Check that guards are checked, and the next rule is used if a guard fails
+    assert( test1.dispatch( event_jump, CONTEXT ) );
+    assert( test1.get_current_state_id() == 1 );
+    assert( test1.dispatch( event_go, CONTEXT ) );
+    assert( test1.dispatch( event_jump, 2 ) );
+    assert( test1.get_current_state_id() == 3 );
+
+      // Check that rules and states added after dispatch are picked up
+    test1.register_state( 4, new state( 4 ) );
+    assert( test1.add_transition( 3, event_stop, 4 ) );
+    assert( test1.dispatch( event_stop, CONTEXT ) );
+    assert( test1.get_current_state_id() == 4 );
+
+      // Check that guards and enter/exit functions get a value context without copying it
+    copy_counted_state states[2];
+    fsm_single_transition_enter_exit<int, copy_counted_state*, test_event, copy_counted_context, registry_lookup_direct> test2;
+    test2.register_state( 1, &states[0] );
+    test2.register_state( 2, &states[1] );
+    assert( test2.add_transition( 1, event_go, 2, []( const copy_counted_context& ctx ){ return ctx.m_allow; } ) );
+
+    copy_counted_context ctx;
+    assert( test2.change_state_immediate( 1, ctx ) && !test2.dispatch( event_go, ctx ) );
+    ctx.m_allow = true;
+    assert( test2.dispatch( event_go, ctx ) && test2.get_current_state_id() == 2 );
+    assert( copy_counted_context::s_copies == 0 );
+}
+
+void test_stacked_indexed_fsm()
+{
+    fsm_stacked_combined_enter_exit<int, counting_state*, int&> plain;
+    fsm_stacked_indexed_combined_enter_exit<int, counting_state*, int&> indexed;
+
+    counting_state states[40];
+    for ( int i = 0; i < 40; ++i )
+    {
+        plain.register_state( i, &states[i] );
+        indexed.register_state( i, &states[i] );
+    }
+
+      // Check that indexed machine does exactly the same as the plain one on a random sequence of actions
+    int plain_calls = 0;
+    int indexed_calls = 0;
+    srand( 1 );
+    for ( int i = 0; i < 10000; ++i )
+    {
+        const int id = rand() % 42;
+        const size_t position = rand() % ( plain.get_current_states().size() + 2 );
+
+        switch ( rand() % 16 )
+        {
+            case 0: case 1: case 2: case 3: case 4: case 5:
+                assert( plain.push_state( id, plain_calls ) == indexed.push_state( id, indexed_calls ) ); break;
+            case 6: case 7: case 8:
+                assert( plain.insert_state( id, position, plain_calls ) == indexed.insert_state( id, position, indexed_calls ) ); break;
+            case 9: case 10: case 11:
+                assert( plain.remove_state( id, plain_calls ) == indexed.remove_state( id, indexed_calls ) ); break;
+            case 12:
+                assert( plain.remove_state_and_all_above( id, plain_calls ) == indexed.remove_state_and_all_above( id, indexed_calls ) ); break;
+            case 13:
+                assert( plain.pop_state( plain_calls ) == indexed.pop_state( indexed_calls ) ); break;
+            case 14:
+                plain.queue_remove_state( id ); plain.queue_push_state( id ); plain.update( plain_calls );
+                indexed.queue_remove_state( id ); indexed.queue_push_state( id ); indexed.update( indexed_calls ); break;
+            default:
+                if ( rand() % 8 == 0 )
+                {
+                    plain.remove_all_states( plain_calls );
+                    indexed.remove_all_states( indexed_calls );
+                }
+        }
+
+        assert( plain_calls == indexed_calls );
+        assert( plain.get_current_states().size() == indexed.get_current_states().size() );
+        for ( size_t j = 0; j < plain.get_current_states().size(); ++j )
+            assert( plain.get_current_states()[j] ->id == indexed.get_current_states()[j]->id );
+
+        assert( plain.get_state_position( id ) == indexed.get_state_position( id ) );
+        assert( indexed.is_state_in_stack( id ) == ( indexed.get_state_position( id ) != invalid_state_index ) );
+    }
+}
+
+void test_shared_registry()
+{
+    g_test_actions.clear();
+
+    typedef state_registry<int, state*> registry;
+    typedef state_registry_shared<int, state*> shared_registry;
+
+    registry states;
+    for ( int i = 1; i <= 3; ++i )
+        states.register_state( i, new state( i ) );
+
+      // Check that an instance holds only a pointer to states, and has none until it is attached
+    assert( sizeof( shared_registry ) == sizeof( void* ) );
+    assert( sizeof( fsm_single_combined_enter_exit<int, state*, int, shared_registry> ) < sizeof( fsm_single_combined_enter_exit<int, state*, int> ) );
+
+    fsm_single_combined_enter_exit<int, state*, int, shared_registry> machines[16];
+    assert( machines[0].get_states_count() == 0 && !machines[0].change_state_immediate( 1, CONTEXT ) );
+
+      // Check that attaching does not allocate, and the shared registry is frozen for machines
+    const size_t allocations = g_allocations;
+    for ( int i = 0; i < 16; ++i )
+        machines[i].attach( states );
+    assert( g_allocations == allocations );
+    assert( !machines[0].register_state( 4, new state( 4 ) ) && states.get_states_count() == 3 );
+
+      // Check that all machines refer to the same states
+    for ( int i = 0; i < 16; ++i )
+    {
+        assert( machines[i].change_state_immediate( i % 3 + 1, CONTEXT ) );
+        assert( machines[i].get_current_state() == states.find_state( i % 3 + 1 )->state );
+    }
+    assert( g_test_actions.size() == 16 );
+    assert( !machines[0].change_state_immediate( 4, CONTEXT ) );
+
+      // Check that stacked machines work with a shared registry too
+    fsm_stacked_combined_enter_exit<int, state*, int, shared_registry> stacked;
+    stacked.attach( states );
+    assert( stacked.push_state( 1, CONTEXT ) && stacked.queue_push_state( 2 ) && stacked.queue_push_state( 3 ) );
+    stacked.update( CONTEXT );
+    assert( stacked.get_current_states().size() == 3 && stacked.get_top_state_id() == 3 );
+    assert( stacked.remove_state( 2, CONTEXT ) && stacked.get_current_states()[1]->state == states.find_state( 3 )->state );
+}
+
+  // Runs a frame once to let containers grow, then checks that following frames do not allocate memory
+template<typename t_machine, typename t_frame>
+void check_steady_state_allocations( t_machine& machine, t_frame frame )
+{
+    int ctx = 0;
+    frame( machine, ctx );
+
+    const size_t allocations = g_allocations;
+    for ( int i = 0; i < 10; ++i )
+        frame( machine, ctx );
+
+    assert( g_allocations == allocations );
+    assert( ctx > 0 );
+}
+
+template<typename t_machine>
+void register_counting_states( t_machine& machine, counting_state* states )
+{
+    for ( int i = 0; i < 3; ++i )
+        machine.register_state( i + 1, &states[i] );
+}
+
+void test_allocations()
+{
+    counting_state states[3];
+
+    {
+        fsm_single_immediate<int, int> machine;
+        machine.register_state( 1, 1 );
+        machine.register_state( 2, 2 );
+        check_steady_state_allocations( machine, []( fsm_single_immediate<int, int>& m, int& ctx ) {
+            m.change_state_immediate( 1 ); m.change_state_immediate( 2 ); ++ctx; } );
+    }
+    {
+        fsm_single_immediate_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_single_immediate_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.change_state_immediate( 1, ctx ); m.change_state_immediate( 2, ctx ); } );
+    }
+    {
+        fsm_single_queued_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_single_queued_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.queue_change_state( 1 ); m.update( ctx ); m.queue_change_state( 2 ); m.update( ctx ); } );
+    }
+    {
+        fsm_single_combined_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_single_combined_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.change_state_immediate( 1, ctx ); m.queue_change_state( 2 ); m.update( ctx ); } );
+    }
+    {
+        fsm_single_transition_enter_exit<int, counting_state*, test_event, int&> machine;
+        register_counting_states( machine, states );
+        machine.add_transition( 1, event_go, 2 );
+        machine.add_transition( 2, event_stop, 1, []( int& ctx ) { return true; } );
+        int ctx = 0;
+        machine.change_state_immediate( 1, ctx );
+        check_steady_state_allocations( machine, []( fsm_single_transition_enter_exit<int, counting_state*, test_event, int&>& m, int& ctx ) {
+            m.dispatch( event_go, ctx ); m.dispatch( event_stop, ctx ); } );
+    }
+    {
+        fsm_hierarchical_combined_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        machine.set_parent( 2, 1 );
+        machine.set_parent( 3, 1 );
+        check_steady_state_allocations( machine, []( fsm_hierarchical_combined_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.change_state_immediate( 2, ctx ); m.queue_change_state( 3 ); m.update( ctx ); } );
+    }
+    {
+        fsm_regions_combined_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        machine.add_region();
+        machine.add_region();
+        check_steady_state_allocations( machine, []( fsm_regions_combined_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.change_state_immediate( 0, 1, ctx ); m.queue_change_state( 1, 2 ); m.queue_change_state( 0, 3 ); m.update( ctx ); } );
+    }
+    {
+        fsm_stacked_immediate<int, int> machine;
+        machine.register_state( 1, 1 );
+        machine.register_state( 2, 2 );
+        machine.register_state( 3, 3 );
+        check_steady_state_allocations( machine, []( fsm_stacked_immediate<int, int>& m, int& ctx ) {
+            m.push_state( 1 ); m.push_state( 2 ); m.insert_state( 3, 0 ); m.remove_state( 2 ); m.remove_all_states(); ++ctx; } );
+    }
+    {
+        fsm_stacked_immediate_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_stacked_immediate_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.push_state( 1, ctx ); m.push_state( 2, ctx ); m.replace_top_state( 3, ctx ); m.remove_state_and_all_above( 1, ctx ); } );
+    }
+    {
+        fsm_stacked_queued_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_stacked_queued_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.queue_push_state( 1 ); m.queue_push_state( 2 ); m.queue_push_state( 3 ); m.queue_pop_state();
+            m.queue_remove_state( 1 ); m.queue_remove_all_states(); m.update( ctx ); } );
+    }
+    {
+        fsm_stacked_queued_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        machine.set_queue_coalescing( true );
+        check_steady_state_allocations( machine, []( fsm_stacked_queued_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.queue_push_state( 1 ); m.queue_push_state( 2 ); m.queue_push_state( 3 ); m.queue_remove_state( 2 );
+            m.update( ctx ); m.queue_remove_all_states(); m.update( ctx ); } );
+    }
+    {
+        fsm_stacked_combined_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_stacked_combined_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.push_state( 1, ctx ); m.queue_push_state( 2 ); m.queue_remove_state_and_all_above( 1 ); m.update( ctx ); } );
+    }
+    {
+        fsm_stacked_indexed_combined_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_stacked_indexed_combined_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.push_state( 1, ctx ); m.push_state( 2, ctx ); m.insert_state( 3, 0, ctx ); m.remove_state( 1, ctx );
+            m.queue_remove_all_states(); m.update( ctx ); } );
+    }
+    {
+        fsm_stacked_concurrent_enter_exit<int, counting_state*, int&> machine;
+        register_counting_states( machine, states );
+        check_steady_state_allocations( machine, []( fsm_stacked_concurrent_enter_exit<int, counting_state*, int&>& m, int& ctx ) {
+            m.push_state( 1, ctx ); m.queue_push_state( 2 ); m.queue_remove_all_states(); m.update( ctx ); } );
+    }
+    {
+        fsm_single_world_enter_exit<int, counting_state*, int&> world;
+        register_counting_states( world, states );
+        for ( int i = 0; i < 16; ++i )
+            world.create_instance();
+        check_steady_state_allocations( world, []( fsm_single_world_enter_exit<int, counting_state*, int&>& w, int& ctx ) {
+            for ( size_t i = 0; i < w.get_instances_count(); ++i ) w.queue_change_state( i, 1 + (int)( i + ctx ) % 3 );
+            w.update( ctx ); } );
+    }
+
+      // Fixed-capacity and static machines should not allocate even on the first frame
+    {
+        typedef fsm_stacked_fixed_combined_enter_exit<int, counting_state*, 2, 4, int&> fixed_machine;
+        static fixed_machine machine;
+        if ( machine.get_states_count() == 0 )
+            register_counting_states( machine, states );
+
+        const size_t registered = g_allocations;
+        int ctx = 0;
+        for ( int i = 0; i < 10; ++i )
+        {
+            machine.queue_push_state( 1 );
+            machine.queue_push_state( 2 );
+            machine.queue_push_state( 3 );
+            machine.queue_remove_all_states();
+            assert( !machine.queue_pop_state() );
+            machine.update( ctx );
+        }
+        assert( g_allocations == registered && ctx == 40 );
+    }
+    {
+          // Indexed fixed storage allocates positions of all registered states once, on the first push
+        typedef fsm
+        <
+            int,
+            counting_state*,
+            state_container_stacked_interface<int, counting_state*, stacked_storage_indexed<stacked_storage_fixed<4, 4> > >,
+            state_manipulator_stacked_combined_interface<int, counting_state*, enter_exit_policy_notify, int&, state_registry<int, counting_state*>, stacked_storage_indexed<stacked_storage_fixed<4, 4> > >
+        > indexed_fixed_machine;
+        static indexed_fixed_machine machine;
+        if ( machine.get_states_count() == 0 )
+            register_counting_states( machine, states );
+
+        const size_t registered = g_allocations;
+        int ctx = 0;
+        for ( int i = 0; i < 10; ++i )
+        {
+            machine.push_state( 1, ctx );
+            machine.queue_push_state( 3 );
+            machine.queue_push_state( 2 );
+            machine.queue_remove_state( 1 );
+            machine.update( ctx );
+            machine.remove_all_states( ctx );
+            assert( g_allocations - registered <= 1 );
+        }
+        assert( ctx == 60 );
+    }
+    {
+        const size_t before = g_allocations;
+        fsm_static_single_immediate_enter_exit<int&, counting_state> machine;
+        int ctx = 0;
+        machine.change_state_immediate<counting_state>( ctx );
+        machine.change_state_immediate( 0, ctx );
+        assert( g_allocations == before && ctx == 3 );
+    }
+}
+
 int main( int argc, char** argv )
 {
     test_simple_fsm();
+    test_value_context();
     test_stacked_fsm();
+    test_stacked_remove_all_reentrant();
     test_stacked_queued_fsm();
+    test_stacked_coalesced_fsm();
+    test_registry_lookup<registry_lookup_linear>();
+    test_registry_lookup<registry_lookup_hashed<> >();
+    test_registry_lookup<registry_lookup_direct>();
+    test_registry_lookup<registry_lookup_sorted>();
+    test_registry_lookup_string();
+    test_registry_stable_storage();
+    test_static_fsm();
+    test_world_fsm();
+    test_batch_dispatch();
+    test_parallel_update();
+    test_concurrent_queued_fsm();
+    test_transition_fsm();
+    test_hierarchical_fsm();
+    test_regions_fsm();
+    test_variant_fsm();
+    test_traced_fsm();
+    test_state_statistics();
+    test_snapshots();
+    test_graph_fsm();
+    test_rollback_fsm();
+    test_interned_ids();
+#if __cplusplus >= 202002L
+    test_async_fsm();
+#endif
+    test_stacked_indexed_fsm();
+    test_shared_registry();
+    test_allocations();
 }
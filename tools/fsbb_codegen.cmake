@@ -0,0 +1,11 @@
+  # Generates a header from a machine definition with fsbb_codegen, which must be a target of the project.
+  # The header is regenerated when the definition or the generator changes, and should be listed among
+  # sources of the targets which include it.
+function( fsbb_generate_machine definition header )
+    add_custom_command(
+        OUTPUT ${header}
+        COMMAND fsbb_codegen ${definition} ${header}
+        DEPENDS fsbb_codegen ${definition}
+        COMMENT "Generating ${header}"
+    )
+endfunction()
@@ -0,0 +1,621 @@
+/*
+    Generates a header-only C++ machine from a text definition, for shipping builds of machines which
+    are data-driven during development. The generated registry stores states by value, and all state
+    lookups, transitions and enter/exit calls are switches over ids known at compile time.
+
+    Usage: fsbb_codegen <definition> <header>
+
+    Definitions use the format of fsbb_graph_compiler, which ignores declarations of the generator,
+    so the same file can be compiled into a blob or into a header:
+
+        machine <name> single|stacked
+        include <header of state types>
+        state <id> <name> [value]
+        type <state name> <C++ type of the state>
+        event <id> <name>
+        transition <source state name> <event name> <target state name>
+
+    Every state needs a type, which provides on_enter/on_exit for enter_exit_policy_static_notify.
+    Ids must be positive, since 0 is the id of no state.
+
+    For a machine called "name", the header defines:
+    - name_states and name_events, with enumerations of ids;
+    - name_registry, with state objects accessed by get_<state name>();
+    - name_container_interface and name_manipulator_interface, with the interface of the single-state
+      or stacked-state combined manipulator, and dispatch( event ) along transitions; a stacked machine
+      replaces its top state;
+    - name_fsm<t_context, t_on_enter_exit_policy>, the machine built on fsm<>.
+*/
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct state_definition
+{
+    int m_id;
+    std::string m_name;
+    std::string m_type;
+};
+
+struct transition_definition
+{
+    size_t m_source;
+    int m_event;
+    size_t m_target;
+};
+
+struct machine_definition
+{
+    machine_definition() : m_stacked( false ) {}
+
+    std::string m_name;
+    bool m_stacked;
+    std::vector<std::string> m_includes;
+    std::vector<state_definition> m_states;
+    std::vector<std::pair<int, std::string> > m_events;
+    std::vector<transition_definition> m_transitions;
+};
+
+static bool fail( const char* path, size_t line, const std::string& message )
+{
+    std::cerr << path << ":" << line << ": " << message << std::endl;
+    return false;
+}
+
+static bool is_identifier( const std::string& name )
+{
+    if ( name.empty() || ( name[0] >= '0' && name[0] <= '9' ) )
+        return false;
+
+    for ( size_t i = 0; i < name.size(); ++i )
+    {
+        const char c = name[i];
+        if ( !( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || c == '_' ) )
+            return false;
+    }
+
+    return true;
+}
+
+static bool parse( const char* path, machine_definition& machine )
+{
+    std::ifstream in( path );
+    if ( !in )
+    {
+        std::cerr << "can not open " << path << std::endl;
+        return false;
+    }
+
+    std::map<std::string, size_t> states;
+    std::map<std::string, int> events;
+
+    std::string text;
+    size_t line = 1;
+    for ( ; std::getline( in, text ); ++line )
+    {
+        std::istringstream words( text );
+        std::string keyword;
+        if ( !( words >> keyword ) || keyword[0] == '#' )
+            continue;
+
+        if ( keyword == "machine" )
+        {
+            std::string container;
+            if ( !( words >> machine.m_name >> container ) || !is_identifier( machine.m_name ) || ( container != "single" && container != "stacked" ) )
+                return fail( path, line, "expected machine <name> single|stacked" );
+
+            machine.m_stacked = container == "stacked";
+        }
+        else if ( keyword == "include" )
+        {
+            std::string header;
+            if ( !( words >> header ) )
+                return fail( path, line, "expected include <header>" );
+
+            machine.m_includes.push_back( header );
+        }
+        else if ( keyword == "state" || keyword == "event" )
+        {
+            int id;
+            std::string name;
+            unsigned value = 0;
+            if ( !( words >> id >> name ) || ( keyword == "state" && !( words >> value ) && !words.eof() ) )
+                return fail( path, line, "expected " + keyword + " <id> <name>" + ( keyword == "state" ? " [value]" : "" ) );
+
+            if ( id <= 0 || !is_identifier( name ) )
+                return fail( path, line, keyword + " id must be positive, and name must be an identifier" );
+
+            if ( keyword == "state" )
+            {
+                for ( size_t i = 0; i < machine.m_states.size(); ++i )
+                {
+                    if ( machine.m_states[i].m_id == id )
+                        return fail( path, line, "duplicate state id" );
+                }
+
+                if ( !states.insert( std::make_pair( name, machine.m_states.size() ) ).second )
+                    return fail( path, line, "duplicate state " + name );
+
+                state_definition state;
+                state.m_id = id;
+                state.m_name = name;
+                machine.m_states.push_back( state );
+            }
+            else
+            {
+                for ( size_t i = 0; i < machine.m_events.size(); ++i )
+                {
+                    if ( machine.m_events[i].first == id )
+                        return fail( path, line, "duplicate event id" );
+                }
+
+                if ( !events.insert( std::make_pair( name, id ) ).second )
+                    return fail( path, line, "duplicate event " + name );
+
+                machine.m_events.push_back( std::make_pair( id, name ) );
+            }
+        }
+        else if ( keyword == "type" )
+        {
+            std::string name, type;
+            if ( !( words >> name >> type ) )
+                return fail( path, line, "expected type <state name> <type>" );
+
+            if ( states.find( name ) == states.end() )
+                return fail( path, line, "unknown state " + name );
+
+            machine.m_states[states[name]].m_type = type;
+        }
+        else if ( keyword == "transition" )
+        {
+            std::string source, event, target;
+            if ( !( words >> source >> event >> target ) )
+                return fail( path, line, "expected transition <source> <event> <target>" );
+
+            if ( states.find( source ) == states.end() || states.find( target ) == states.end() || events.find( event ) == events.end() )
+                return fail( path, line, "unknown state or event" );
+
+            transition_definition transition;
+            transition.m_source = states[source];
+            transition.m_event = events[event];
+            transition.m_target = states[target];
+
+            for ( size_t i = 0; i < machine.m_transitions.size(); ++i )
+            {
+                if ( machine.m_transitions[i].m_source == transition.m_source && machine.m_transitions[i].m_event == transition.m_event )
+                    return fail( path, line, "duplicate transition from " + source + " by " + event );
+            }
+
+            machine.m_transitions.push_back( transition );
+        }
+        else
+            return fail( path, line, "unknown declaration " + keyword );
+
+        std::string extra;
+        if ( words >> extra )
+            return fail( path, line, "unexpected " + extra );
+    }
+
+    if ( machine.m_name.empty() )
+        return fail( path, line, "missing machine declaration" );
+
+    if ( machine.m_states.empty() )
+        return fail( path, line, "machine has no states" );
+
+    for ( size_t i = 0; i < machine.m_states.size(); ++i )
+    {
+        if ( machine.m_states[i].m_type.empty() )
+            return fail( path, line, "missing type of state " + machine.m_states[i].m_name );
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------
+// Code generation
+//----------------------------------------------------------------
+
+  // Replaces $id, $name, $type and $slot in the text with values of the state
+static std::string expand( const std::string& text, const state_definition& state, size_t slot )
+{
+    std::ostringstream out;
+    for ( size_t i = 0; i < text.size(); ++i )
+    {
+        if ( text.compare( i, 3, "$id" ) == 0 )
+            out << state.m_id, i += 2;
+        else if ( text.compare( i, 5, "$name" ) == 0 )
+            out << state.m_name, i += 4;
+        else if ( text.compare( i, 5, "$type" ) == 0 )
+            out << state.m_type, i += 4;
+        else if ( text.compare( i, 5, "$slot" ) == 0 )
+            out << slot, i += 4;
+        else
+            out << text[i];
+    }
+
+    return out.str();
+}
+
+  // Writes the line for every state
+static void write_states( std::ostream& out, const machine_definition& machine, const std::string& line )
+{
+    for ( size_t i = 0; i < machine.m_states.size(); ++i )
+        out << expand( line, machine.m_states[i], i ) << "\n";
+}
+
+static void write_separator( std::ostream& out, const char* title = 0 )
+{
+    out << "//----------------------------------------------------------------\n";
+    if ( title )
+        out << "// " << title << "\n//----------------------------------------------------------------\n";
+    out << "\n";
+}
+
+static void write_ids( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    out << "struct " << name << "_states\n{\n    enum\n    {\n";
+    for ( size_t i = 0; i < machine.m_states.size(); ++i )
+        out << "        " << machine.m_states[i].m_name << " = " << machine.m_states[i].m_id << ( i + 1 < machine.m_states.size() ? "," : "" ) << "\n";
+    out << "    };\n};\n\n";
+
+    out << "struct " << name << "_events\n{\n    enum\n    {\n";
+    for ( size_t i = 0; i < machine.m_events.size(); ++i )
+        out << "        " << machine.m_events[i].second << " = " << machine.m_events[i].first << ( i + 1 < machine.m_events.size() ? "," : "" ) << "\n";
+    if ( machine.m_events.empty() )
+        out << "        none = 0\n";
+    out << "    };\n};\n\n";
+}
+
+static void write_registry( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    write_separator( out, "Registry" );
+    out << "class " << name << "_registry\n{\npublic:\n";
+    out << "    static const size_t states_count = " << machine.m_states.size() << ";\n\n";
+    out << "      // Dense index of the state, or invalid_state_index if the id is not a state\n";
+    out << "    static size_t get_state_slot( int id )\n    {\n        switch ( id )\n        {\n";
+    write_states( out, machine, "        case $id: return $slot;" );
+    out << "        default: return fsbb::invalid_state_index;\n        }\n    }\n\n";
+    write_states( out, machine, "    $type& get_$name() { return m_$name; }" );
+    out << "\nprotected:\n";
+    write_states( out, machine, "    $type m_$name;" );
+    out << "};\n\n";
+}
+
+static void write_containers( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    write_separator( out, "State containers ( impl; interface )" );
+
+    if ( !machine.m_stacked )
+    {
+        out << "struct " << name << "_container_impl\n{\n";
+        out << "    " << name << "_container_impl() : m_current_state( 0 ) {}\n\n";
+        out << "    int m_current_state;\n};\n\n";
+
+        out << "class " << name << "_container_interface\n{\npublic:\n";
+        out << "    typedef " << name << "_container_impl t_impl;\n\n";
+        out << "    " << name << "_container_interface( t_impl& impl ) : m_impl( impl ) {}\n\n";
+        out << "    int get_current_state_id() const { return m_impl.m_current_state; }\n\n";
+        out << "protected:\n    t_impl& m_impl;\n};\n\n";
+        return;
+    }
+
+    out << "struct " << name << "_container_impl\n{\n";
+    out << "    " << name << "_container_impl() : m_count( 0 ) {}\n\n";
+    out << "      // Returns position of the state in the stack (0 is the bottom), or invalid_state_index if it is not in the stack\n";
+    out << "    size_t find_position( int id ) const\n    {\n";
+    out << "        for ( size_t i = 0; i < m_count; ++i )\n        {\n";
+    out << "            if ( m_states[i] == id )\n                return i;\n        }\n\n";
+    out << "        return fsbb::invalid_state_index;\n    }\n\n";
+    out << "    int get_top_state_id() const { return m_count > 0 ? m_states[m_count - 1] : 0; }\n\n";
+    out << "      // Every state is in the stack at most once\n";
+    out << "    int m_states[" << name << "_registry::states_count];\n";
+    out << "    size_t m_count;\n};\n\n";
+
+    out << "class " << name << "_container_interface\n{\npublic:\n";
+    out << "    typedef " << name << "_container_impl t_impl;\n\n";
+    out << "    " << name << "_container_interface( t_impl& impl ) : m_impl( impl ) {}\n\n";
+    out << "    int get_top_state_id() const { return m_impl.get_top_state_id(); }\n";
+    out << "    size_t get_current_states_count() const { return m_impl.m_count; }\n";
+    out << "    int get_current_state_id( size_t position ) const { return m_impl.m_states[position]; }\n";
+    out << "    size_t get_state_position( int id ) const { return m_impl.find_position( id ); }\n";
+    out << "    bool is_state_in_stack( int id ) const { return m_impl.find_position( id ) != fsbb::invalid_state_index; }\n\n";
+    out << "protected:\n    t_impl& m_impl;\n};\n\n";
+}
+
+static void write_manipulator_impl( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    write_separator( out, "State manipulators ( impl; interface )" );
+
+    out << "struct " << name << "_manipulator_impl\n{\n";
+    if ( machine.m_stacked )
+    {
+        out << "    struct queued_action\n    {\n";
+        out << "        enum type { push, pop, remove, remove_and_above, remove_all } m_type;\n";
+        out << "        int m_state_id;\n    };\n\n";
+    }
+    out << "    typedef " << name << "_container_impl t_state_container_impl;\n";
+    out << "    " << name << "_manipulator_impl\n        (\n";
+    out << "            t_state_container_impl& state_container_impl,\n";
+    out << "            " << name << "_registry& state_registry\n        )\n";
+    out << "        : m_state_container_impl( state_container_impl )\n";
+    out << "        , m_state_registry( state_registry )\n";
+    if ( !machine.m_stacked )
+        out << "        , m_next_state( 0 )\n";
+    out << "    {}\n\n";
+    out << "    t_state_container_impl& m_state_container_impl;\n";
+    out << "    " << name << "_registry& m_state_registry;\n";
+    out << ( machine.m_stacked ? "    std::vector<queued_action> m_queued_actions;\n" : "    int m_next_state;\n" );
+    out << "};\n\n";
+}
+
+static void write_single_operations( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    out << "    bool change_state_immediate( int id, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        if ( " << name << "_registry::get_state_slot( id ) == fsbb::invalid_state_index )\n            return false;\n\n";
+    out << "        int& current_state = m_impl.m_state_container_impl.m_current_state;\n";
+    out << "        on_exit( current_state, ctx );\n";
+    out << "        current_state = id;\n";
+    out << "        on_enter( current_state, ctx );\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    bool queue_change_state( int id )\n    {\n";
+    out << "        if ( " << name << "_registry::get_state_slot( id ) == fsbb::invalid_state_index )\n            return false;\n\n";
+    out << "        m_impl.m_next_state = id;\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    void update( fsbb::context_holder<t_context> ctx )\n    {\n";
+    out << "        if ( m_impl.m_next_state == 0 )\n            return;\n\n";
+    out << "        const int next_state = m_impl.m_next_state;\n";
+    out << "        m_impl.m_next_state = 0;\n\n";
+    out << "        change_state_immediate( next_state, ctx );\n    }\n\n";
+
+    out << "      // Changes the state along the transition for the current state and the event. Returns false if there is no such transition.\n";
+    out << "    bool dispatch( int event, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        int& current_state = m_impl.m_state_container_impl.m_current_state;\n";
+    out << "        const int target = get_transition_target( current_state, event );\n";
+    out << "        if ( target == 0 )\n            return false;\n\n";
+    out << "        on_exit( current_state, ctx );\n";
+    out << "        current_state = target;\n";
+    out << "        on_enter( current_state, ctx );\n\n";
+    out << "        return true;\n    }\n\n";
+}
+
+static void write_stacked_operations( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    out << "    bool replace_top_state( int id, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        pop_state( ctx );\n";
+    out << "        return push_state( id, ctx );\n    }\n\n";
+
+    out << "    bool push_state( int id, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        t_impl::t_state_container_impl& container = m_impl.m_state_container_impl;\n";
+    out << "        if ( " << name << "_registry::get_state_slot( id ) == fsbb::invalid_state_index || container.find_position( id ) != fsbb::invalid_state_index )\n";
+    out << "            return false;\n\n";
+    out << "        container.m_states[container.m_count++] = id;\n";
+    out << "        on_enter( id, ctx );\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    bool pop_state( fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        t_impl::t_state_container_impl& container = m_impl.m_state_container_impl;\n";
+    out << "        if ( container.m_count == 0 )\n            return false;\n\n";
+    out << "        on_exit( container.m_states[--container.m_count], ctx );\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    bool remove_state( int id, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        t_impl::t_state_container_impl& container = m_impl.m_state_container_impl;\n";
+    out << "        const size_t position = container.find_position( id );\n";
+    out << "        if ( position == fsbb::invalid_state_index )\n            return false;\n\n";
+    out << "        for ( size_t i = position + 1; i < container.m_count; ++i )\n";
+    out << "            container.m_states[i - 1] = container.m_states[i];\n";
+    out << "        --container.m_count;\n";
+    out << "        on_exit( id, ctx );\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    bool remove_state_and_all_above( int id, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        t_impl::t_state_container_impl& container = m_impl.m_state_container_impl;\n";
+    out << "        const size_t position = container.find_position( id );\n";
+    out << "        if ( position == fsbb::invalid_state_index )\n            return false;\n\n";
+    out << "        for ( size_t i = container.m_count; i-- > position; )\n";
+    out << "            on_exit( container.m_states[i], ctx );\n\n";
+    out << "        container.m_count = position;\n\n";
+    out << "        return true;\n    }\n\n";
+
+    out << "    void remove_all_states( fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        t_impl::t_state_container_impl& container = m_impl.m_state_container_impl;\n\n";
+    out << "          // States present at the start are removed from the top down, even if on_exit adds or removes\n";
+    out << "          // states. States added by on_exit stay, and states it already removed are skipped.\n";
+    out << "        int states_to_remove[" << name << "_registry::states_count];\n";
+    out << "        const size_t count = container.m_count;\n";
+    out << "        for ( size_t i = 0; i < count; ++i )\n";
+    out << "            states_to_remove[i] = container.m_states[i];\n\n";
+    out << "        for ( size_t i = count; i-- > 0; )\n        {\n";
+    out << "            if ( container.m_count > 0 && container.m_states[container.m_count - 1] == states_to_remove[i] )\n";
+    out << "                pop_state( ctx );\n";
+    out << "            else\n";
+    out << "                remove_state( states_to_remove[i], ctx );\n";
+    out << "        }\n    }\n\n";
+
+    const char* queued[][3] =
+    {
+        { "queue_push_state", "int id", "push, id" },
+        { "queue_pop_state", "", "pop, 0" },
+        { "queue_remove_state", "int id", "remove, id" },
+        { "queue_remove_state_and_all_above", "int id", "remove_and_above, id" },
+        { "queue_remove_all_states", "", "remove_all, 0" }
+    };
+
+    for ( size_t i = 0; i < sizeof( queued ) / sizeof( queued[0] ); ++i )
+    {
+        out << "    bool " << queued[i][0] << "(" << ( *queued[i][1] ? " " : "" ) << queued[i][1] << ( *queued[i][1] ? " " : "" ) << ")\n    {\n";
+        out << "        const t_impl::queued_action action = { t_impl::queued_action::" << queued[i][2] << " };\n";
+        out << "        m_impl.m_queued_actions.push_back( action );\n\n";
+        out << "        return true;\n    }\n\n";
+    }
+
+    out << "      // Actions queued by enter/exit functions during update are executed by the same update\n";
+    out << "    void update( fsbb::context_holder<t_context> ctx )\n    {\n";
+    out << "        for ( size_t i = 0; i < m_impl.m_queued_actions.size(); ++i )\n        {\n";
+    out << "            const t_impl::queued_action action = m_impl.m_queued_actions[i];\n";
+    out << "            switch ( action.m_type )\n            {\n";
+    out << "            case t_impl::queued_action::push: push_state( action.m_state_id, ctx ); break;\n";
+    out << "            case t_impl::queued_action::pop: pop_state( ctx ); break;\n";
+    out << "            case t_impl::queued_action::remove: remove_state( action.m_state_id, ctx ); break;\n";
+    out << "            case t_impl::queued_action::remove_and_above: remove_state_and_all_above( action.m_state_id, ctx ); break;\n";
+    out << "            case t_impl::queued_action::remove_all: remove_all_states( ctx ); break;\n";
+    out << "            }\n        }\n\n";
+    out << "        m_impl.m_queued_actions.clear();\n    }\n\n";
+
+    out << "      // Replaces the top state along the transition for it and the event. Returns false if there is no such transition.\n";
+    out << "    bool dispatch( int event, fsbb::context_holder<t_context> ctx = fsbb::context_holder<t_context>() )\n    {\n";
+    out << "        const int target = get_transition_target( m_impl.m_state_container_impl.get_top_state_id(), event );\n";
+    out << "        if ( target == 0 )\n            return false;\n\n";
+    out << "        return replace_top_state( target, ctx );\n    }\n\n";
+}
+
+static void write_manipulator_interface( std::ostream& out, const machine_definition& machine )
+{
+    const std::string& name = machine.m_name;
+
+    out << "template\n<\n";
+    out << "    typename t_on_enter_exit_policy = fsbb::enter_exit_policy_static_notify,\n";
+    out << "    typename t_context = void\n>\n";
+    out << "class " << name << "_manipulator_interface\n{\npublic:\n";
+    out << "    typedef " << name << "_manipulator_impl t_impl;\n";
+    out << "    typedef " << name << "_registry t_registry;\n\n";
+    out << "    " << name << "_manipulator_interface( t_impl& impl ) : m_impl( impl ) {}\n\n";
+
+    if ( machine.m_stacked )
+        write_stacked_operations( out, machine );
+    else
+        write_single_operations( out, machine );
+
+    out << "    template<typename T = t_context>\n";
+    out << "    typename std::enable_if<std::is_void<T>::value, void>::type update()\n    {\n";
+    out << "        update(fsbb::context_holder<void>());\n    }\n\n";
+
+    out << "      // Target of the transition, or 0 if there is no transition for the state and the event\n";
+    out << "    static int get_transition_target( int state, int event )\n    {\n";
+    out << "        switch ( state )\n        {\n";
+    for ( size_t i = 0; i < machine.m_states.size(); ++i )
+    {
+        bool has_transitions = false;
+        for ( size_t j = 0; j < machine.m_transitions.size(); ++j )
+        {
+            const transition_definition& transition = machine.m_transitions[j];
+            if ( transition.m_source != i )
+                continue;
+
+            if ( !has_transitions )
+                out << "        case " << machine.m_states[i].m_id << ":\n            switch ( event )\n            {\n";
+
+            out << "            case " << transition.m_event << ": return " << machine.m_states[transition.m_target].m_id << ";\n";
+            has_transitions = true;
+        }
+
+        if ( has_transitions )
+            out << "            }\n            break;\n";
+    }
+    out << "        }\n\n        return 0;\n    }\n\n";
+
+    out << "protected:\n";
+
+    const char* callbacks[] = { "on_enter", "on_exit" };
+    for ( size_t i = 0; i < 2; ++i )
+    {
+        out << "    void " << callbacks[i] << "( int id, fsbb::context_holder<t_context>& ctx )\n    {\n";
+        out << "        switch ( id )\n        {\n";
+        write_states( out, machine, std::string( "        case $id: t_on_enter_exit_policy::" ) + callbacks[i] + "( m_impl.m_state_registry.get_$name(), ctx ); break;" );
+        out << "        }\n    }\n\n";
+    }
+
+    out << "    t_impl& m_impl;\n};\n\n";
+}
+
+static void write_machine( std::ostream& out, const machine_definition& machine, const std::string& definition )
+{
+    const std::string& name = machine.m_name;
+
+    write_separator( out );
+    out << "/*\n";
+    out << "    Current state : " << ( machine.m_stacked ? "stack" : "single" ) << "\n";
+    out << "    Switching     : combined, and by events along transitions of the definition\n";
+    out << "    Reactions     : as defined by t_on_enter_exit_policy, called on states stored in the registry\n";
+    out << "    Comment       : generated from " << definition << "\n";
+    out << "*/\n";
+    out << "template\n<\n";
+    out << "    typename t_context = void,\n";
+    out << "    typename t_on_enter_exit_policy = fsbb::enter_exit_policy_static_notify\n>\n";
+    out << "class " << name << "_fsm\n";
+    out << "    : public fsbb::fsm\n    <\n";
+    out << "        int,\n";
+    out << "        " << name << "_registry,\n";
+    out << "        " << name << "_container_interface,\n";
+    out << "        " << name << "_manipulator_interface<t_on_enter_exit_policy, t_context>\n";
+    out << "    >\n{\n};\n\n";
+}
+
+static void generate( std::ostream& out, const machine_definition& machine, const std::string& definition )
+{
+    out << "// Generated by fsbb_codegen from " << definition << ", do not edit.\n\n";
+    out << "#pragma once\n\n";
+    out << "#include \"fsbb_static.hpp\"\n";
+    if ( machine.m_stacked )
+        out << "#include <vector>\n";
+    for ( size_t i = 0; i < machine.m_includes.size(); ++i )
+        out << "#include \"" << machine.m_includes[i] << "\"\n";
+    out << "\n";
+
+    write_separator( out );
+    write_ids( out, machine );
+    write_registry( out, machine );
+    write_containers( out, machine );
+    write_manipulator_impl( out, machine );
+    write_manipulator_interface( out, machine );
+    write_machine( out, machine, definition );
+}
+
+int main( int argc, char** argv )
+{
+    if ( argc != 3 )
+    {
+        std::cerr << "usage: fsbb_codegen <definition> <header>" << std::endl;
+        return 2;
+    }
+
+    machine_definition machine;
+    if ( !parse( argv[1], machine ) )
+        return 1;
+
+      // Only the file name, so the header does not depend on where the sources are
+    std::string definition( argv[1] );
+    const size_t slash = definition.find_last_of( "/\\" );
+    if ( slash != std::string::npos )
+        definition.erase( 0, slash + 1 );
+
+    std::ostringstream text;
+    generate( text, machine, definition );
+
+    std::ofstream out( argv[2] );
+    if ( !( out << text.str() ) )
+    {
+        std::cerr << "can not write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+    Compiles a text definition of a machine into a state graph blob, which can be memory-mapped
+    and used by state_registry_graph (see fsbb_graph.hpp).
+
+    Usage: fsbb_graph_compiler <definition> <blob>
+
+    A definition contains one declaration per line, and lines starting with # are comments:
+
+        state <id> <name> [value]
+        event <id> <name>
+        transition <source state name> <event name> <target state name>
+
+    States and events must be declared before transitions which use them. Declarations of the code
+    generator (machine, include and type, see fsbb_codegen.cpp) are ignored.
+*/
+
+#include "fsbb_graph.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace fsbb;
+
+static bool fail( const char* path, size_t line, const std::string& message )
+{
+    std::cerr << path << ":" << line << ": " << message << std::endl;
+    return false;
+}
+
+static bool compile( const char* path, state_graph_builder& builder )
+{
+    std::ifstream in( path );
+    if ( !in )
+    {
+        std::cerr << "can not open " << path << std::endl;
+        return false;
+    }
+
+    std::map<std::string, graph_id> states;
+    std::map<std::string, graph_id> events;
+
+    std::string text;
+    for ( size_t line = 1; std::getline( in, text ); ++line )
+    {
+        std::istringstream words( text );
+        std::string keyword;
+        if ( !( words >> keyword ) || keyword[0] == '#' )
+            continue;
+
+        if ( keyword == "machine" || keyword == "include" || keyword == "type" )
+            continue;
+
+        if ( keyword == "state" || keyword == "event" )
+        {
+            graph_id id;
+            std::string name;
+            graph_id value = 0;
+            if ( !( words >> id >> name ) || ( keyword == "state" && !( words >> value ) && !words.eof() ) )
+                return fail( path, line, "expected " + keyword + " <id> <name>" + ( keyword == "state" ? " [value]" : "" ) );
+
+            std::map<std::string, graph_id>& names = keyword == "state" ? states : events;
+            const bool added = keyword == "state" ? builder.add_state( id, name, value ) : builder.add_event( id, name );
+            if ( !added || !names.insert( std::make_pair( name, id ) ).second )
+                return fail( path, line, "duplicate " + keyword + " " + name );
+        }
+        else if ( keyword == "transition" )
+        {
+            std::string source, event, target;
+            if ( !( words >> source >> event >> target ) )
+                return fail( path, line, "expected transition <source> <event> <target>" );
+
+            if ( states.find( source ) == states.end() || states.find( target ) == states.end() || events.find( event ) == events.end() )
+                return fail( path, line, "unknown state or event" );
+
+            if ( !builder.add_transition( states[source], events[event], states[target] ) )
+                return fail( path, line, "duplicate transition from " + source + " by " + event );
+        }
+        else
+            return fail( path, line, "unknown declaration " + keyword );
+
+        std::string extra;
+        if ( words >> extra )
+            return fail( path, line, "unexpected " + extra );
+    }
+
+    return true;
+}
+
+int main( int argc, char** argv )
+{
+    if ( argc != 3 )
+    {
+        std::cerr << "usage: fsbb_graph_compiler <definition> <blob>" << std::endl;
+        return 2;
+    }
+
+    state_graph_builder builder;
+    if ( !compile( argv[1], builder ) )
+        return 1;
+
+    std::vector<unsigned char> blob;
+    builder.build( blob );
+
+    std::ofstream out( argv[2], std::ios::binary );
+    if ( !out.write( reinterpret_cast<const char*>( &blob[0] ), blob.size() ) )
+    {
+        std::cerr << "can not write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    return 0;
+}